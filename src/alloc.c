@@ -0,0 +1,176 @@
+#include "alloc.h"
+
+#ifdef NWM_ALLOC_TRACKING
+
+#include <signal.h>
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <wayland-server-core.h>
+#include <wlr/util/log.h>
+
+#define ALLOC_MAX_TYPES 32
+
+struct alloc_counter
+{
+        size_t live_bytes;
+        size_t live_objects;
+        size_t peak_bytes;
+        size_t peak_objects;
+        size_t total_objects; // allocated since startup
+};
+
+struct alloc_type
+{
+        const char          *name;
+        enum alloc_subsystem subsystem;
+        struct alloc_counter counter;
+};
+
+/** Prepended to every tracked object. Keeps it on the live list so leaks can
+ * be listed one by one, padded so the object keeps malloc's alignment. */
+struct alloc_header
+{
+        alignas (max_align_t) struct wl_list link;
+        struct alloc_type   *type;
+        enum alloc_subsystem subsystem;
+        size_t               size;
+};
+
+static const char *const subsystem_names[ALLOC_SUBSYSTEM_COUNT] = {
+        [ALLOC_XDG_SHELL]   = "xdg_shell",
+        [ALLOC_LAYER_SHELL] = "layer_shell",
+        [ALLOC_OUTPUT]      = "output",
+        [ALLOC_INPUT]       = "input",
+        [ALLOC_PACING]      = "pacing",
+};
+
+/* Global, like the allocator it wraps. Only the compositor thread allocates
+ * through here, so no locking. */
+static struct alloc_counter subsystems[ALLOC_SUBSYSTEM_COUNT];
+static struct alloc_type    types[ALLOC_MAX_TYPES];
+static int                  num_types;
+static struct wl_list       live = { &live, &live };
+
+static struct alloc_type *alloc_type_get (enum alloc_subsystem subsystem, const char *name) {
+        /* The same literal may live at different addresses in different
+         * translation units, hence the strcmp. */
+        for (int i = 0; i < num_types; i++) {
+                if (types[i].subsystem == subsystem && strcmp (types[i].name, name) == 0) {
+                        return &types[i];
+                }
+        }
+        if (num_types == ALLOC_MAX_TYPES) {
+                /* Fold anything beyond the table into its last entry. */
+                return &types[ALLOC_MAX_TYPES - 1];
+        }
+        struct alloc_type *type = &types[num_types++];
+        type->name              = name;
+        type->subsystem         = subsystem;
+        return type;
+}
+
+static void counter_add (struct alloc_counter *counter, size_t size) {
+        counter->live_bytes += size;
+        counter->live_objects++;
+        counter->total_objects++;
+        if (counter->live_bytes > counter->peak_bytes) {
+                counter->peak_bytes = counter->live_bytes;
+        }
+        if (counter->live_objects > counter->peak_objects) {
+                counter->peak_objects = counter->live_objects;
+        }
+}
+
+static void counter_sub (struct alloc_counter *counter, size_t size) {
+        counter->live_bytes -= size;
+        counter->live_objects--;
+}
+
+void *alloc_tracked_calloc (enum alloc_subsystem subsystem, const char *name, size_t size) {
+        struct alloc_header *header = calloc (1, sizeof (*header) + size);
+        if (header == NULL) {
+                return NULL;
+        }
+        header->type      = alloc_type_get (subsystem, name);
+        header->subsystem = subsystem;
+        header->size      = size;
+        wl_list_insert (&live, &header->link);
+
+        counter_add (&header->type->counter, size);
+        counter_add (&subsystems[subsystem], size);
+        return header + 1;
+}
+
+void alloc_tracked_free (void *ptr) {
+        if (ptr == NULL) {
+                return;
+        }
+        struct alloc_header *header = (struct alloc_header *) ptr - 1;
+        wl_list_remove (&header->link);
+
+        counter_sub (&header->type->counter, header->size);
+        counter_sub (&subsystems[header->subsystem], header->size);
+        free (header);
+}
+
+static void counter_log (const char *label, const struct alloc_counter *counter) {
+        wlr_log (WLR_INFO,
+                 "alloc %s: live %zu B in %zu objects, peak %zu B / %zu objects, %zu allocated",
+                 label,
+                 counter->live_bytes,
+                 counter->live_objects,
+                 counter->peak_bytes,
+                 counter->peak_objects,
+                 counter->total_objects);
+}
+
+void alloc_log (void) {
+        char label[96];
+        for (int s = 0; s < ALLOC_SUBSYSTEM_COUNT; s++) {
+                counter_log (subsystem_names[s], &subsystems[s]);
+                for (int i = 0; i < num_types; i++) {
+                        if (types[i].subsystem != (enum alloc_subsystem) s) {
+                                continue;
+                        }
+                        snprintf (label, sizeof (label), "%s/%s", subsystem_names[s], types[i].name);
+                        counter_log (label, &types[i].counter);
+                }
+        }
+}
+
+size_t alloc_report_leaks (void) {
+        /* Everything nwm allocates is tied to a client, device or output, all
+         * of which are gone by now; whatever is left leaked. */
+        alloc_log ();
+        size_t               leaks = 0;
+        struct alloc_header *header;
+        wl_list_for_each (header, &live, link) {
+                wlr_log (WLR_ERROR,
+                         "alloc leak: %s %s (%zu B) at %p",
+                         subsystem_names[header->subsystem],
+                         header->type->name,
+                         header->size,
+                         (void *) (header + 1));
+                leaks++;
+        }
+        if (leaks > 0) {
+                wlr_log (WLR_ERROR, "alloc: %zu objects leaked", leaks);
+        } else {
+                wlr_log (WLR_INFO, "alloc: no leaks");
+        }
+        return leaks;
+}
+
+static int alloc_signal_notify (int signal, void *data) {
+        alloc_log ();
+        return 0;
+}
+
+void alloc_tracking_init (struct wl_event_loop *loop) {
+        wl_event_loop_add_signal (loop, SIGUSR1, alloc_signal_notify, NULL);
+        wlr_log (WLR_INFO, "Allocation tracking enabled, send SIGUSR1 for a report");
+}
+
+#endif // NWM_ALLOC_TRACKING
@@ -0,0 +1,47 @@
+#ifndef COMP_ALLOC_H
+#define COMP_ALLOC_H
+
+#include <stddef.h>
+#include <stdlib.h>
+
+struct wl_event_loop;
+
+/** Subsystems whose allocations are accounted for. */
+enum alloc_subsystem
+{
+        ALLOC_XDG_SHELL,
+        ALLOC_LAYER_SHELL,
+        ALLOC_OUTPUT,
+        ALLOC_INPUT,
+        ALLOC_PACING,
+        ALLOC_SUBSYSTEM_COUNT,
+};
+
+/* nwm_alloc returns a zeroed object of the given type, nwm_free releases it.
+ * Built with -Dalloc-tracking (on by default in debug builds), every object
+ * is counted per subsystem and per type, with high-water marks, and objects
+ * still alive at exit are reported as leaks. SIGUSR1 logs the current
+ * totals. Otherwise these are plain calloc and free and the rest compiles
+ * to nothing. */
+#ifdef NWM_ALLOC_TRACKING
+
+#define nwm_alloc(subsystem, type) ((type *) alloc_tracked_calloc (subsystem, #type, sizeof (type)))
+#define nwm_free(ptr)              alloc_tracked_free (ptr)
+
+void  *alloc_tracked_calloc (enum alloc_subsystem subsystem, const char *type, size_t size);
+void   alloc_tracked_free (void *ptr);
+void   alloc_tracking_init (struct wl_event_loop *loop);
+void   alloc_log (void);
+size_t alloc_report_leaks (void);
+
+#else
+
+#define nwm_alloc(subsystem, type)  ((type *) calloc (1, sizeof (type)))
+#define nwm_free(ptr)               free (ptr)
+#define alloc_tracking_init(loop)   ((void) (loop))
+#define alloc_log()                 ((void) 0)
+#define alloc_report_leaks()        ((void) 0)
+
+#endif // NWM_ALLOC_TRACKING
+
+#endif // COMP_ALLOC_H
@@ -0,0 +1,263 @@
+#include "animation.h"
+#include "alloc.h"
+#include "nwm_server.h"
+#include "output.h"
+#include "timespec.h"
+
+#include <time.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+#define ANIMATION_DEFAULT_REFRESH_USEC 16667
+
+struct animation
+{
+        struct wl_list          link;
+        struct wlr_scene_node  *node;
+        enum animation_property property;
+        float                   from, to;
+        int                     offset_x, offset_y; // scale: shift last added to the node position
+        int                     width, height;      // scale: extent of the subtree at 1
+        int64_t                 start_usec;         // CLOCK_MONOTONIC
+        int64_t                 duration_usec;
+
+        struct wl_listener node_destroy;
+};
+
+static float ease_out_cubic (float t) {
+        /* Fast start, gentle landing: windows react at once and settle. */
+        const float u = 1.0f - t;
+        return 1.0f - u * u * u;
+}
+
+static void buffer_set_opacity (struct wlr_scene_buffer *buffer, int sx, int sy, void *data) {
+        wlr_scene_buffer_set_opacity (buffer, *(const float *) data);
+}
+
+static void buffer_set_scale (struct wlr_scene_buffer *buffer, int sx, int sy, void *data) {
+        /* Only surface buffers know their size at scale 1. Subsurfaces keep
+         * their offsets, which is not noticeable over a short animation. */
+        struct wlr_scene_surface *scene_surface = wlr_scene_surface_try_from_buffer (buffer);
+        if (scene_surface == NULL) {
+                return;
+        }
+        const float               scale   = *(const float *) data;
+        const struct wlr_surface *surface = scene_surface->surface;
+        const int                 width   = (int) (surface->current.width * scale + 0.5f);
+        const int                 height  = (int) (surface->current.height * scale + 0.5f);
+        wlr_scene_buffer_set_dest_size (buffer, width > 0 ? width : 1, height > 0 ? height : 1);
+}
+
+struct extent
+{
+        int x, y; // the node position, buffer coordinates include it
+        int width, height;
+};
+
+static void buffer_add_extent (struct wlr_scene_buffer *buffer, int sx, int sy, void *data) {
+        struct extent            *extent        = data;
+        struct wlr_scene_surface *scene_surface = wlr_scene_surface_try_from_buffer (buffer);
+        if (scene_surface == NULL) {
+                return;
+        }
+        const int right  = sx - extent->x + scene_surface->surface->current.width;
+        const int bottom = sy - extent->y + scene_surface->surface->current.height;
+        extent->width    = right > extent->width ? right : extent->width;
+        extent->height   = bottom > extent->height ? bottom : extent->height;
+}
+
+static void animation_apply (struct animation *animation, float t) {
+        /* Sets the property to its value at progress t, which is eased. */
+        struct wlr_scene_node *node = animation->node;
+        const float            e    = ease_out_cubic (t);
+        switch (animation->property) {
+        case ANIMATION_OPACITY: {
+                const float opacity = animation->from + (animation->to - animation->from) * e;
+                wlr_scene_node_for_each_buffer (node, buffer_set_opacity, (void *) &opacity);
+                break;
+        }
+        case ANIMATION_SCALE: {
+                /* The node moves so the subtree shrinks towards its center.
+                 * Only the shift is ours: it is swapped on top of wherever the
+                 * node is now, so a move made meanwhile, an interactive one
+                 * say, is kept. */
+                const float scale = animation->from + (animation->to - animation->from) * e;
+                const int   dx    = (int) (animation->width * (1 - scale) / 2);
+                const int   dy    = (int) (animation->height * (1 - scale) / 2);
+                wlr_scene_node_for_each_buffer (node, buffer_set_scale, (void *) &scale);
+                wlr_scene_node_set_position (
+                    node, node->x - animation->offset_x + dx, node->y - animation->offset_y + dy);
+                animation->offset_x = dx;
+                animation->offset_y = dy;
+                break;
+        }
+        }
+}
+
+static void animation_destroy (struct animation *animation) {
+        wl_list_remove (&animation->node_destroy.link);
+        wl_list_remove (&animation->link);
+        nwm_free (animation);
+}
+
+static void animation_node_destroy (struct wl_listener *listener, void *data) {
+        struct animation *animation = wl_container_of (listener, animation, node_destroy);
+        animation_destroy (animation);
+}
+
+static struct animation *animation_find (struct wlr_scene_node *node, enum animation_property property) {
+        /* Every animation listens for its node's destruction, so the node's
+         * own listeners lead to its animations: the cost depends on what is
+         * attached to this node, not on how many animations are running. */
+        struct wl_listener *listener;
+        wl_list_for_each (listener, &node->events.destroy.listener_list, link) {
+                if (listener->notify == animation_node_destroy) {
+                        struct animation *animation = wl_container_of (listener, animation, node_destroy);
+                        if (animation->property == property) {
+                                return animation;
+                        }
+                }
+        }
+        return NULL;
+}
+
+static void animation_schedule_frames (struct comp_server *server) {
+        /* Keeps the frame clock ticking: on outputs whose content does not
+         * change this frame, nothing is damaged and nothing is drawn. */
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                if (output->wlr_output->enabled && !output->idle_off && !output->mirror) {
+                        wlr_output_schedule_frame (output->wlr_output);
+                }
+        }
+}
+
+static struct animation *animation_start (struct comp_server     *server,
+                                          struct wlr_scene_node  *node,
+                                          enum animation_property property,
+                                          int                     duration_ms) {
+        /* Replaces a running animation of the same property, which is left
+         * wherever it got to; the new one picks up from there. */
+        struct comp_animation *animations = &server->animation;
+        struct animation      *animation  = animation_find (node, property);
+        if (animation != NULL) {
+                animation_destroy (animation);
+        }
+
+        if (wl_list_empty (&animations->animations)) {
+                animations->frames = 0;
+                animation_schedule_frames (server);
+        }
+        animation                      = nwm_alloc (ALLOC_OUTPUT, struct animation);
+        animation->node                = node;
+        animation->property            = property;
+        animation->start_usec          = now_usec ();
+        animation->duration_usec       = (int64_t) duration_ms * 1000;
+        animation->node_destroy.notify = animation_node_destroy;
+        wl_signal_add (&node->events.destroy, &animation->node_destroy);
+        wl_list_insert (animations->animations.prev, &animation->link);
+        return animation;
+}
+
+void animation_opacity (struct comp_server *server, struct wlr_scene_node *node, float from, float to, int duration_ms) {
+        if (!server->animation.enabled || duration_ms <= 0) {
+                wlr_scene_node_for_each_buffer (node, buffer_set_opacity, &to);
+                return;
+        }
+        struct animation *animation = animation_start (server, node, ANIMATION_OPACITY, duration_ms);
+        animation->from             = from;
+        animation->to               = to;
+        animation_apply (animation, 0);
+}
+
+void animation_scale (struct comp_server *server, struct wlr_scene_node *node, float from, float to, int duration_ms) {
+        /* Shifts the node position while it runs; a scale animation it
+         * replaces hands over the shift it left, to be taken back. */
+        if (!server->animation.enabled || duration_ms <= 0) {
+                wlr_scene_node_for_each_buffer (node, buffer_set_scale, &to);
+                return;
+        }
+        int               offset_x = 0, offset_y = 0;
+        struct animation *animation = animation_find (node, ANIMATION_SCALE);
+        if (animation != NULL) {
+                offset_x = animation->offset_x;
+                offset_y = animation->offset_y;
+        }
+        struct extent extent = { .x = node->x, .y = node->y };
+        wlr_scene_node_for_each_buffer (node, buffer_add_extent, &extent);
+
+        animation           = animation_start (server, node, ANIMATION_SCALE, duration_ms);
+        animation->from     = from;
+        animation->to       = to;
+        animation->offset_x = offset_x;
+        animation->offset_y = offset_y;
+        animation->width    = extent.width;
+        animation->height   = extent.height;
+        animation_apply (animation, 0);
+}
+
+static int64_t output_next_present_usec (struct comp_output *output, int64_t now) {
+        /* A frame committed now is shown on the refresh after the last one
+         * presented, unless that one is long gone. */
+        const int     refresh = output->wlr_output->refresh; // mHz, 0 when unknown
+        const int64_t cycle   = refresh > 0 ? 1000000000ll / refresh : ANIMATION_DEFAULT_REFRESH_USEC;
+        const int64_t next    = timespec_to_usec (&output->last_frame) + cycle;
+        return next > now ? next : now;
+}
+
+void animation_output_frame (struct comp_output *output) {
+        /* Called on every output frame before the scene is committed. All
+         * animations advance together, to when this frame will be seen. */
+        struct comp_server    *server     = output->server;
+        struct comp_animation *animations = &server->animation;
+        if (wl_list_empty (&animations->animations)) {
+                return;
+        }
+
+        const int64_t     when = output_next_present_usec (output, now_usec ());
+        struct animation *animation, *tmp;
+        wl_list_for_each_safe (animation, tmp, &animations->animations, link) {
+                const int64_t elapsed = when - animation->start_usec;
+                if (elapsed >= animation->duration_usec) {
+                        animation_apply (animation, 1);
+                        animation_destroy (animation);
+                        continue;
+                }
+                animation_apply (animation, elapsed > 0 ? (float) elapsed / (float) animation->duration_usec : 0);
+        }
+        animations->frames++;
+
+        if (wl_list_empty (&animations->animations)) {
+                wlr_log (WLR_DEBUG, "Animations done after %lu frames", animations->frames);
+                return;
+        }
+        animation_schedule_frames (server);
+}
+
+void animation_set_enabled (struct comp_server *server, bool enabled) {
+        /* Turning animations off lands the running ones right away. */
+        struct comp_animation *animations = &server->animation;
+        animations->enabled               = enabled;
+        if (enabled) {
+                return;
+        }
+        struct animation *animation, *tmp;
+        wl_list_for_each_safe (animation, tmp, &animations->animations, link) {
+                animation_apply (animation, 1);
+                animation_destroy (animation);
+        }
+}
+
+void animation_init (struct comp_server *server) {
+        wl_list_init (&server->animation.animations);
+}
+
+void animation_finish (struct comp_server *server) {
+        /* Whatever is left is attached to nodes that outlive us. */
+        struct animation *animation, *tmp;
+        wl_list_for_each_safe (animation, tmp, &server->animation.animations, link) {
+                animation_destroy (animation);
+        }
+}
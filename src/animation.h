@@ -0,0 +1,46 @@
+#ifndef COMP_ANIMATION_H
+#define COMP_ANIMATION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+struct comp_output;
+struct comp_server;
+struct wlr_scene_node;
+
+#define ANIMATION_MAP_MS      150
+#define ANIMATION_FOCUS_MS    100
+#define ANIMATION_OVERVIEW_MS 120
+
+enum animation_property
+{
+        ANIMATION_OPACITY, // every buffer in the subtree
+        ANIMATION_SCALE,   // surface buffers in the subtree, about their center
+};
+
+/** Scene node animations driven by the output frame clock. Every active
+ * animation is advanced once per output frame, just before the scene is
+ * committed, to the time that frame is expected on screen, so concurrent
+ * animations land in the same damage pass. Frames are only scheduled while
+ * something is animating; once the last animation ends, outputs go back to
+ * rendering on damage alone. */
+struct comp_animation
+{
+        bool           enabled;
+        struct wl_list animations; // animation::link
+        uint64_t       frames;     // ticks since the first of the running animations started
+};
+
+void animation_init (struct comp_server *server);
+void animation_finish (struct comp_server *server);
+void animation_set_enabled (struct comp_server *server, bool enabled);
+void animation_output_frame (struct comp_output *output);
+
+/* Starts animating one property of a node, replacing any animation of the
+ * same property on it. With animations disabled the end value is applied
+ * right away. Animations end on their own when the node is destroyed. */
+void animation_opacity (struct comp_server *server, struct wlr_scene_node *node, float from, float to, int duration_ms);
+void animation_scale (struct comp_server *server, struct wlr_scene_node *node, float from, float to, int duration_ms);
+
+#endif // COMP_ANIMATION_H
@@ -0,0 +1,827 @@
+#include "capture.h"
+#include "alloc.h"
+#include "ext-foreign-toplevel-list-v1-protocol.h"
+#include "ext-image-capture-source-v1-protocol.h"
+#include "ext-image-copy-capture-v1-protocol.h"
+#include "nwm_server.h"
+#include "output.h"
+#include "xdg_shell.h"
+
+#include <drm_fourcc.h>
+#include <pixman.h>
+#include <time.h>
+#include <wayland-server-protocol.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/drm_format_set.h>
+#include <wlr/render/pass.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_ext_foreign_toplevel_list_v1.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+/* What a client wants to capture. Only one of output and toplevel is set,
+ * and neither once the object went away. */
+struct capture_source
+{
+        struct wl_list      link;
+        struct wl_resource *resource;
+        struct comp_output *output;
+        struct toplevel    *toplevel;
+};
+
+struct capture_frame;
+
+struct capture_session
+{
+        struct wl_list        link;
+        struct comp_server   *server;
+        struct wl_resource   *resource;
+        struct comp_output   *output;   // NULL once stopped
+        struct toplevel      *toplevel; // NULL once stopped
+        bool                  paint_cursors; // holds a software cursor lock on output
+        bool                  stopped;
+        int                   width, height;
+        pixman_region32_t     damage;  // buffer coords, changed since the last copy
+        struct wlr_buffer    *scratch; // toplevels are rendered here, then read back
+        struct capture_frame *frame;
+};
+
+struct capture_frame
+{
+        struct capture_session *session; // NULL once the session is destroyed
+        struct wl_resource     *resource;
+        struct wl_resource     *buffer; // wl_buffer
+        pixman_region32_t       buffer_damage;
+        bool                    captured; // capture was requested
+        bool                    pending;  // captured, neither ready nor failed yet
+
+        struct wl_listener buffer_destroy;
+};
+
+static void resource_handle_destroy (struct wl_client *client, struct wl_resource *resource) {
+        wl_resource_destroy (resource);
+}
+
+/* Frames */
+
+static void frame_fail (struct capture_frame *frame, enum ext_image_copy_capture_frame_v1_failure_reason reason) {
+        frame->pending = false;
+        ext_image_copy_capture_frame_v1_send_failed (frame->resource, reason);
+}
+
+static struct wlr_buffer *frame_buffer_get (struct capture_frame *frame) {
+        /* The attached buffer, locked, if it fits what the session
+         * advertised: its size and one of the two shm formats. */
+        const struct capture_session *session = frame->session;
+        if (frame->buffer == NULL) {
+                return NULL;
+        }
+        struct wlr_buffer *buffer = wlr_buffer_try_from_resource (frame->buffer);
+        if (buffer == NULL) {
+                return NULL;
+        }
+        void    *data;
+        uint32_t format;
+        size_t   stride;
+        if (buffer->width != session->width || buffer->height != session->height
+            || !wlr_buffer_begin_data_ptr_access (
+                buffer, WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &data, &format, &stride)) {
+                wlr_buffer_unlock (buffer);
+                return NULL;
+        }
+        wlr_buffer_end_data_ptr_access (buffer);
+        if (format != DRM_FORMAT_ARGB8888 && format != DRM_FORMAT_XRGB8888) {
+                wlr_buffer_unlock (buffer);
+                return NULL;
+        }
+        return buffer;
+}
+
+static void frame_copy (struct capture_frame    *frame,
+                        struct wlr_texture      *texture,
+                        enum wl_output_transform transform,
+                        const struct timespec   *when) {
+        /* Reads back the boxes that changed since the last copy, plus those
+         * the client says are stale in this particular buffer, and reports
+         * the same boxes as damage. */
+        struct capture_session *session = frame->session;
+        struct wlr_buffer      *buffer  = frame_buffer_get (frame);
+        if (buffer == NULL) {
+                frame_fail (frame, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS);
+                return;
+        }
+
+        pixman_region32_t region;
+        pixman_region32_init (&region);
+        pixman_region32_union (&region, &session->damage, &frame->buffer_damage);
+        pixman_region32_intersect_rect (&region, &region, 0, 0, session->width, session->height);
+
+        void    *data;
+        uint32_t format;
+        size_t   stride;
+        bool     ok = wlr_buffer_begin_data_ptr_access (
+            buffer, WLR_BUFFER_DATA_PTR_ACCESS_WRITE, &data, &format, &stride);
+        int                   nboxes = 0;
+        const pixman_box32_t *boxes  = pixman_region32_rectangles (&region, &nboxes);
+        if (ok) {
+                for (int i = 0; i < nboxes && ok; i++) {
+                        const pixman_box32_t *box = &boxes[i];
+                        ok = wlr_texture_read_pixels (texture,
+                                                      &(struct wlr_texture_read_pixels_options) {
+                                                          .data    = data,
+                                                          .format  = format,
+                                                          .stride  = stride,
+                                                          .dst_x   = box->x1,
+                                                          .dst_y   = box->y1,
+                                                          .src_box = {
+                                                              .x      = box->x1,
+                                                              .y      = box->y1,
+                                                              .width  = box->x2 - box->x1,
+                                                              .height = box->y2 - box->y1,
+                                                          },
+                                                      });
+                }
+                wlr_buffer_end_data_ptr_access (buffer);
+        }
+        wlr_buffer_unlock (buffer);
+
+        if (!ok) {
+                pixman_region32_fini (&region);
+                frame_fail (frame, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_UNKNOWN);
+                return;
+        }
+
+        ext_image_copy_capture_frame_v1_send_transform (frame->resource, transform);
+        for (int i = 0; i < nboxes; i++) {
+                ext_image_copy_capture_frame_v1_send_damage (frame->resource,
+                                                             boxes[i].x1,
+                                                             boxes[i].y1,
+                                                             boxes[i].x2 - boxes[i].x1,
+                                                             boxes[i].y2 - boxes[i].y1);
+        }
+        const uint64_t tv_sec = (uint64_t) when->tv_sec;
+        ext_image_copy_capture_frame_v1_send_presentation_time (
+            frame->resource, tv_sec >> 32, tv_sec & 0xffffffff, when->tv_nsec);
+        ext_image_copy_capture_frame_v1_send_ready (frame->resource);
+
+        pixman_region32_fini (&region);
+        pixman_region32_clear (&session->damage);
+        frame->pending = false;
+}
+
+static void frame_handle_attach_buffer (struct wl_client   *client,
+                                        struct wl_resource *resource,
+                                        struct wl_resource *buffer_resource) {
+        struct capture_frame *frame = wl_resource_get_user_data (resource);
+        if (frame->captured) {
+                wl_resource_post_error (
+                    resource, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_ALREADY_CAPTURED, "capture already requested");
+                return;
+        }
+        if (frame->buffer != NULL) {
+                wl_list_remove (&frame->buffer_destroy.link);
+        }
+        frame->buffer = buffer_resource;
+        wl_resource_add_destroy_listener (buffer_resource, &frame->buffer_destroy);
+}
+
+static void frame_handle_damage_buffer (struct wl_client   *client,
+                                        struct wl_resource *resource,
+                                        int32_t             x,
+                                        int32_t             y,
+                                        int32_t             width,
+                                        int32_t             height) {
+        struct capture_frame *frame = wl_resource_get_user_data (resource);
+        if (frame->captured) {
+                wl_resource_post_error (
+                    resource, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_ALREADY_CAPTURED, "capture already requested");
+                return;
+        }
+        if (x < 0 || y < 0 || width <= 0 || height <= 0) {
+                wl_resource_post_error (resource,
+                                        EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_INVALID_BUFFER_DAMAGE,
+                                        "invalid buffer damage");
+                return;
+        }
+        pixman_region32_union_rect (&frame->buffer_damage, &frame->buffer_damage, x, y, width, height);
+}
+
+static struct wlr_texture *toplevel_render (struct capture_session *session) {
+        /* Draws the toplevel at scale 1, window geometry at the origin, the
+         * way the client sees it, into the session scratch buffer. */
+        struct comp_server *server = session->server;
+        if (session->scratch == NULL) {
+                const struct wlr_drm_format *format = wlr_drm_format_set_get (
+                    wlr_renderer_get_render_formats (server->renderer), DRM_FORMAT_ARGB8888);
+                if (format == NULL) {
+                        wlr_log (WLR_ERROR, "Capture: no ARGB8888 render format for toplevels");
+                        return NULL;
+                }
+                session->scratch
+                    = wlr_allocator_create_buffer (server->allocator, session->width, session->height, format);
+                if (session->scratch == NULL) {
+                        return NULL;
+                }
+        }
+
+        struct wlr_render_pass *pass = wlr_renderer_begin_buffer_pass (server->renderer, session->scratch, NULL);
+        if (pass == NULL) {
+                return NULL;
+        }
+        wlr_render_pass_add_rect (pass,
+                                  &(struct wlr_render_rect_options) {
+                                      .box        = { .width = session->width, .height = session->height },
+                                      .color      = { .r = 0, .g = 0, .b = 0, .a = 0 },
+                                      .blend_mode = WLR_RENDER_BLEND_MODE_NONE,
+                                  });
+        xdg_toplevel_render (session->toplevel, pass, 1.0);
+        if (!wlr_render_pass_submit (pass)) {
+                return NULL;
+        }
+        return wlr_texture_from_buffer (server->renderer, session->scratch);
+}
+
+static void session_try_copy (struct capture_session *session) {
+        /* Fills the pending frame, if there is anything new to put in it.
+         * Otherwise it waits for the next commit that damages the source. */
+        struct capture_frame *frame = session->frame;
+        if (frame == NULL || !frame->pending || !pixman_region32_not_empty (&session->damage)) {
+                return;
+        }
+
+        struct wlr_texture *texture = NULL;
+        if (session->output != NULL) {
+                if (session->output->capture_buffer == NULL) {
+                        return;
+                }
+                texture = wlr_texture_from_buffer (session->server->renderer, session->output->capture_buffer);
+        } else if (session->toplevel != NULL) {
+                texture = toplevel_render (session);
+        }
+        if (texture == NULL) {
+                frame_fail (frame, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_UNKNOWN);
+                return;
+        }
+
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        frame_copy (frame,
+                    texture,
+                    session->output != NULL ? session->output->wlr_output->transform : WL_OUTPUT_TRANSFORM_NORMAL,
+                    &now);
+        wlr_texture_destroy (texture);
+}
+
+static void frame_handle_capture (struct wl_client *client, struct wl_resource *resource) {
+        struct capture_frame *frame = wl_resource_get_user_data (resource);
+        if (frame->captured) {
+                wl_resource_post_error (
+                    resource, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_ALREADY_CAPTURED, "capture already requested");
+                return;
+        }
+        if (frame->buffer == NULL) {
+                wl_resource_post_error (resource, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_ERROR_NO_BUFFER, "no buffer attached");
+                return;
+        }
+        frame->captured = true;
+
+        struct capture_session *session = frame->session;
+        if (session == NULL || session->stopped) {
+                ext_image_copy_capture_frame_v1_send_failed (resource, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED);
+                return;
+        }
+        struct wlr_buffer *buffer = frame_buffer_get (frame);
+        if (buffer == NULL) {
+                ext_image_copy_capture_frame_v1_send_failed (
+                    resource, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS);
+                return;
+        }
+        wlr_buffer_unlock (buffer);
+
+        frame->pending = true;
+        session_try_copy (session);
+}
+
+static const struct ext_image_copy_capture_frame_v1_interface frame_impl = {
+        .destroy       = resource_handle_destroy,
+        .attach_buffer = frame_handle_attach_buffer,
+        .damage_buffer = frame_handle_damage_buffer,
+        .capture       = frame_handle_capture,
+};
+
+static void frame_buffer_destroy (struct wl_listener *listener, void *data) {
+        /* A pending frame fails on the constraints when its turn comes. */
+        struct capture_frame *frame = wl_container_of (listener, frame, buffer_destroy);
+        wl_list_remove (&frame->buffer_destroy.link);
+        frame->buffer = NULL;
+}
+
+static void frame_resource_destroy (struct wl_resource *resource) {
+        struct capture_frame *frame = wl_resource_get_user_data (resource);
+        if (frame->session != NULL) {
+                frame->session->frame = NULL;
+        }
+        if (frame->buffer != NULL) {
+                wl_list_remove (&frame->buffer_destroy.link);
+        }
+        pixman_region32_fini (&frame->buffer_damage);
+        nwm_free (frame);
+}
+
+/* Sessions */
+
+static void capture_output_release (struct comp_output *output) {
+        /* Lets go of the last committed buffer once nobody captures the
+         * output anymore, so the swapchain gets it back. */
+        struct capture_session *session;
+        wl_list_for_each (session, &output->server->capture.sessions, link) {
+                if (session->output == output) {
+                        return;
+                }
+        }
+        if (output->capture_buffer != NULL) {
+                wlr_buffer_unlock (output->capture_buffer);
+                output->capture_buffer = NULL;
+        }
+}
+
+static void session_detach (struct capture_session *session) {
+        /* Forgets the captured object and whatever was held for it. */
+        struct comp_output *output = session->output;
+        if (session->paint_cursors) {
+                wlr_output_lock_software_cursors (output->wlr_output, false);
+                session->paint_cursors = false;
+        }
+        session->output   = NULL;
+        session->toplevel = NULL;
+        if (session->scratch != NULL) {
+                wlr_buffer_drop (session->scratch);
+                session->scratch = NULL;
+        }
+        if (output != NULL) {
+                capture_output_release (output);
+        }
+}
+
+static void session_stop (struct capture_session *session) {
+        if (session->stopped) {
+                return;
+        }
+        session->stopped = true;
+        if (session->frame != NULL && session->frame->pending) {
+                frame_fail (session->frame, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED);
+        }
+        session_detach (session);
+        ext_image_copy_capture_session_v1_send_stopped (session->resource);
+}
+
+static void session_resize (struct capture_session *session, int width, int height) {
+        /* New constraints for the client. A frame in flight was sized for the
+         * old ones, so it fails, and the next one starts with full damage. */
+        if (session->width == width && session->height == height) {
+                return;
+        }
+        session->width  = width;
+        session->height = height;
+        pixman_region32_fini (&session->damage);
+        pixman_region32_init_rect (&session->damage, 0, 0, width, height);
+        if (session->scratch != NULL) {
+                wlr_buffer_drop (session->scratch);
+                session->scratch = NULL;
+        }
+
+        ext_image_copy_capture_session_v1_send_buffer_size (session->resource, width, height);
+        ext_image_copy_capture_session_v1_send_shm_format (session->resource, WL_SHM_FORMAT_ARGB8888);
+        ext_image_copy_capture_session_v1_send_shm_format (session->resource, WL_SHM_FORMAT_XRGB8888);
+        ext_image_copy_capture_session_v1_send_done (session->resource);
+
+        if (session->frame != NULL && session->frame->pending) {
+                frame_fail (session->frame, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_BUFFER_CONSTRAINTS);
+        }
+}
+
+static void session_handle_create_frame (struct wl_client *client, struct wl_resource *resource, uint32_t id) {
+        struct capture_session *session = wl_resource_get_user_data (resource);
+        if (session->frame != NULL) {
+                wl_resource_post_error (resource,
+                                        EXT_IMAGE_COPY_CAPTURE_SESSION_V1_ERROR_DUPLICATE_FRAME,
+                                        "the session already has a frame");
+                return;
+        }
+
+        struct capture_frame *frame = nwm_alloc (ALLOC_OUTPUT, struct capture_frame);
+        frame->resource             = wl_resource_create (
+            client, &ext_image_copy_capture_frame_v1_interface, wl_resource_get_version (resource), id);
+        if (frame->resource == NULL) {
+                nwm_free (frame);
+                wl_client_post_no_memory (client);
+                return;
+        }
+        frame->session               = session;
+        frame->buffer_destroy.notify = frame_buffer_destroy;
+        pixman_region32_init (&frame->buffer_damage);
+        wl_resource_set_implementation (frame->resource, &frame_impl, frame, frame_resource_destroy);
+        session->frame = frame;
+}
+
+static const struct ext_image_copy_capture_session_v1_interface session_impl = {
+        .create_frame = session_handle_create_frame,
+        .destroy      = resource_handle_destroy,
+};
+
+static void session_resource_destroy (struct wl_resource *resource) {
+        struct capture_session *session = wl_resource_get_user_data (resource);
+        if (session->frame != NULL) {
+                if (session->frame->pending) {
+                        frame_fail (session->frame, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_STOPPED);
+                }
+                session->frame->session = NULL;
+        }
+        wl_list_remove (&session->link);
+        session_detach (session);
+        pixman_region32_fini (&session->damage);
+        nwm_free (session);
+}
+
+static struct capture_session *session_create (struct comp_server *server,
+                                               struct wl_client   *client,
+                                               uint32_t            version,
+                                               uint32_t            id) {
+        struct capture_session *session = nwm_alloc (ALLOC_OUTPUT, struct capture_session);
+        session->resource = wl_resource_create (client, &ext_image_copy_capture_session_v1_interface, version, id);
+        if (session->resource == NULL) {
+                nwm_free (session);
+                wl_client_post_no_memory (client);
+                return NULL;
+        }
+        session->server = server;
+        pixman_region32_init (&session->damage);
+        wl_list_insert (&server->capture.sessions, &session->link);
+        wl_resource_set_implementation (session->resource, &session_impl, session, session_resource_destroy);
+        return session;
+}
+
+static void copy_manager_handle_create_session (struct wl_client   *client,
+                                                struct wl_resource *resource,
+                                                uint32_t            id,
+                                                struct wl_resource *source_resource,
+                                                uint32_t            options) {
+        struct comp_server *server = wl_resource_get_user_data (resource);
+        if (options & ~EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_OPTIONS_PAINT_CURSORS) {
+                wl_resource_post_error (
+                    resource, EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_ERROR_INVALID_OPTION, "unknown options");
+                return;
+        }
+        struct capture_source  *source = wl_resource_get_user_data (source_resource);
+        struct capture_session *session
+            = session_create (server, client, wl_resource_get_version (resource), id);
+        if (session == NULL) {
+                return;
+        }
+
+        if (source->output != NULL) {
+                struct comp_output *output = source->output;
+                session->output            = output;
+                if (options & EXT_IMAGE_COPY_CAPTURE_MANAGER_V1_OPTIONS_PAINT_CURSORS) {
+                        /* The hardware cursor plane is not in the committed
+                         * buffer, so composite it for as long as we capture. */
+                        wlr_output_lock_software_cursors (output->wlr_output, true);
+                        session->paint_cursors = true;
+                }
+                session_resize (session, output->wlr_output->width, output->wlr_output->height);
+                if (output->capture_buffer == NULL) {
+                        /* Nothing committed since we started holding on to
+                         * buffers; have the whole output drawn once. */
+                        output_damage_whole (output);
+                }
+        } else if (source->toplevel != NULL) {
+                struct wlr_box geometry;
+                wlr_xdg_surface_get_geometry (source->toplevel->xdg_toplevel->base, &geometry);
+                session->toplevel = source->toplevel;
+                session_resize (session, geometry.width, geometry.height);
+        } else {
+                session_stop (session);
+        }
+}
+
+/* Cursors are not captured on their own. The session a cursor session hands
+ * out is stopped right away; paint_cursors covers the common case. */
+struct capture_cursor_session
+{
+        struct comp_server *server;
+        bool                has_session;
+};
+
+static void cursor_session_handle_get_capture_session (struct wl_client   *client,
+                                                       struct wl_resource *resource,
+                                                       uint32_t            id) {
+        struct capture_cursor_session *cursor_session = wl_resource_get_user_data (resource);
+        if (cursor_session->has_session) {
+                wl_resource_post_error (resource,
+                                        EXT_IMAGE_COPY_CAPTURE_CURSOR_SESSION_V1_ERROR_DUPLICATE_SESSION,
+                                        "the cursor session already has a capture session");
+                return;
+        }
+        cursor_session->has_session     = true;
+        struct capture_session *session = session_create (
+            cursor_session->server, client, wl_resource_get_version (resource), id);
+        if (session != NULL) {
+                session_stop (session);
+        }
+}
+
+static const struct ext_image_copy_capture_cursor_session_v1_interface cursor_session_impl = {
+        .destroy             = resource_handle_destroy,
+        .get_capture_session = cursor_session_handle_get_capture_session,
+};
+
+static void cursor_session_resource_destroy (struct wl_resource *resource) {
+        nwm_free (wl_resource_get_user_data (resource));
+}
+
+static void copy_manager_handle_create_pointer_cursor_session (struct wl_client   *client,
+                                                               struct wl_resource *resource,
+                                                               uint32_t            id,
+                                                               struct wl_resource *source_resource,
+                                                               struct wl_resource *pointer_resource) {
+        struct capture_cursor_session *cursor_session
+            = nwm_alloc (ALLOC_OUTPUT, struct capture_cursor_session);
+        struct wl_resource *cursor_resource = wl_resource_create (
+            client, &ext_image_copy_capture_cursor_session_v1_interface, wl_resource_get_version (resource), id);
+        if (cursor_resource == NULL) {
+                nwm_free (cursor_session);
+                wl_client_post_no_memory (client);
+                return;
+        }
+        cursor_session->server = wl_resource_get_user_data (resource);
+        wl_resource_set_implementation (
+            cursor_resource, &cursor_session_impl, cursor_session, cursor_session_resource_destroy);
+}
+
+static const struct ext_image_copy_capture_manager_v1_interface copy_manager_impl = {
+        .create_session                = copy_manager_handle_create_session,
+        .create_pointer_cursor_session = copy_manager_handle_create_pointer_cursor_session,
+        .destroy                       = resource_handle_destroy,
+};
+
+static void copy_manager_bind (struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+        struct wl_resource *resource
+            = wl_resource_create (client, &ext_image_copy_capture_manager_v1_interface, version, id);
+        if (resource == NULL) {
+                wl_client_post_no_memory (client);
+                return;
+        }
+        wl_resource_set_implementation (resource, &copy_manager_impl, data, NULL);
+}
+
+/* Sources */
+
+static const struct ext_image_capture_source_v1_interface source_impl = {
+        .destroy = resource_handle_destroy,
+};
+
+static void source_resource_destroy (struct wl_resource *resource) {
+        struct capture_source *source = wl_resource_get_user_data (resource);
+        wl_list_remove (&source->link);
+        nwm_free (source);
+}
+
+static void source_create (struct comp_server *server,
+                           struct wl_resource *manager,
+                           uint32_t            id,
+                           struct comp_output *output,
+                           struct toplevel    *toplevel) {
+        /* A source for an object that is already gone is still valid, its
+         * sessions just stop right away. */
+        struct wl_client      *client = wl_resource_get_client (manager);
+        struct capture_source *source = nwm_alloc (ALLOC_OUTPUT, struct capture_source);
+        source->resource              = wl_resource_create (
+            client, &ext_image_capture_source_v1_interface, wl_resource_get_version (manager), id);
+        if (source->resource == NULL) {
+                nwm_free (source);
+                wl_client_post_no_memory (client);
+                return;
+        }
+        source->output   = output;
+        source->toplevel = toplevel;
+        wl_list_insert (&server->capture.sources, &source->link);
+        wl_resource_set_implementation (source->resource, &source_impl, source, source_resource_destroy);
+}
+
+static void output_source_manager_handle_create_source (struct wl_client   *client,
+                                                        struct wl_resource *resource,
+                                                        uint32_t            id,
+                                                        struct wl_resource *output_resource) {
+        struct wlr_output *wlr_output = wlr_output_from_resource (output_resource);
+        source_create (wl_resource_get_user_data (resource),
+                       resource,
+                       id,
+                       wlr_output != NULL ? wlr_output->data : NULL,
+                       NULL);
+}
+
+static const struct ext_output_image_capture_source_manager_v1_interface output_source_manager_impl = {
+        .create_source = output_source_manager_handle_create_source,
+        .destroy       = resource_handle_destroy,
+};
+
+static void output_source_manager_bind (struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+        struct wl_resource *resource = wl_resource_create (
+            client, &ext_output_image_capture_source_manager_v1_interface, version, id);
+        if (resource == NULL) {
+                wl_client_post_no_memory (client);
+                return;
+        }
+        wl_resource_set_implementation (resource, &output_source_manager_impl, data, NULL);
+}
+
+static void toplevel_source_manager_handle_create_source (struct wl_client   *client,
+                                                          struct wl_resource *resource,
+                                                          uint32_t            id,
+                                                          struct wl_resource *handle_resource) {
+        /* Handle resources belong to wlroots, which leaves their user data
+         * pointing at the handle until it is destroyed, and to NULL after. */
+        struct comp_server                        *server = wl_resource_get_user_data (resource);
+        struct wlr_ext_foreign_toplevel_handle_v1 *handle = wl_resource_get_user_data (handle_resource);
+        struct toplevel                           *toplevel = NULL;
+        if (handle != NULL) {
+                struct toplevel *candidate;
+                wl_list_for_each (candidate, &server->toplevels, link) {
+                        if (candidate->foreign_handle == handle) {
+                                toplevel = candidate;
+                                break;
+                        }
+                }
+        }
+        source_create (server, resource, id, NULL, toplevel);
+}
+
+static const struct ext_foreign_toplevel_image_capture_source_manager_v1_interface toplevel_source_manager_impl = {
+        .create_source = toplevel_source_manager_handle_create_source,
+        .destroy       = resource_handle_destroy,
+};
+
+static void toplevel_source_manager_bind (struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+        struct wl_resource *resource = wl_resource_create (
+            client, &ext_foreign_toplevel_image_capture_source_manager_v1_interface, version, id);
+        if (resource == NULL) {
+                wl_client_post_no_memory (client);
+                return;
+        }
+        wl_resource_set_implementation (resource, &toplevel_source_manager_impl, data, NULL);
+}
+
+/* Compositor side */
+
+void capture_output_commit (struct comp_output *output, struct wlr_output_event_commit *event) {
+        /* Every buffer the output commits while it is captured is held until
+         * the next one, with its damage added to each session. Frames that
+         * were waiting are filled from it right away. */
+        struct comp_capture           *capture = &output->server->capture;
+        const struct wlr_output_state *state   = event->state;
+        if (output->capture_buffer == NULL && wl_list_empty (&capture->sessions)) {
+                return;
+        }
+
+        struct capture_session *session;
+        bool                    captured = false;
+        wl_list_for_each (session, &capture->sessions, link) {
+                if (session->output == output) {
+                        session_resize (session, output->wlr_output->width, output->wlr_output->height);
+                        captured = true;
+                }
+        }
+        if (!captured || !(state->committed & WLR_OUTPUT_STATE_BUFFER) || state->buffer == NULL) {
+                return;
+        }
+
+        if (output->capture_buffer != NULL) {
+                wlr_buffer_unlock (output->capture_buffer);
+        }
+        output->capture_buffer = wlr_buffer_lock (state->buffer);
+
+        struct wlr_texture *texture = NULL;
+        wl_list_for_each (session, &capture->sessions, link) {
+                if (session->output != output) {
+                        continue;
+                }
+                if (state->committed & WLR_OUTPUT_STATE_DAMAGE) {
+                        pixman_region32_union (&session->damage, &session->damage, &state->damage);
+                } else {
+                        pixman_region32_union_rect (
+                            &session->damage, &session->damage, 0, 0, session->width, session->height);
+                }
+
+                struct capture_frame *frame = session->frame;
+                if (frame == NULL || !frame->pending || !pixman_region32_not_empty (&session->damage)) {
+                        continue;
+                }
+                /* One import serves every session on the output. */
+                if (texture == NULL) {
+                        texture = wlr_texture_from_buffer (output->server->renderer, state->buffer);
+                        if (texture == NULL) {
+                                frame_fail (frame, EXT_IMAGE_COPY_CAPTURE_FRAME_V1_FAILURE_REASON_UNKNOWN);
+                                continue;
+                        }
+                }
+                struct timespec now;
+                if (event->when == NULL) {
+                        clock_gettime (CLOCK_MONOTONIC, &now);
+                }
+                frame_copy (frame, texture, output->wlr_output->transform, event->when != NULL ? event->when : &now);
+        }
+        if (texture != NULL) {
+                wlr_texture_destroy (texture);
+        }
+}
+
+void capture_output_destroy (struct comp_output *output) {
+        struct comp_capture    *capture = &output->server->capture;
+        struct capture_session *session;
+        wl_list_for_each (session, &capture->sessions, link) {
+                if (session->output == output) {
+                        session_stop (session);
+                }
+        }
+        struct capture_source *source;
+        wl_list_for_each (source, &capture->sources, link) {
+                if (source->output == output) {
+                        source->output = NULL;
+                }
+        }
+        if (output->capture_buffer != NULL) {
+                wlr_buffer_unlock (output->capture_buffer);
+                output->capture_buffer = NULL;
+        }
+}
+
+void capture_toplevel_commit (struct toplevel *toplevel) {
+        /* Only the toplevel's own damage is tracked. Subsurfaces may change
+         * without it noticing, so with any around every commit counts as
+         * damaging the whole window. */
+        struct comp_capture    *capture = &toplevel->server->capture;
+        struct wlr_surface     *surface = toplevel->xdg_toplevel->base->surface;
+        struct capture_session *session;
+        wl_list_for_each (session, &capture->sessions, link) {
+                if (session->toplevel != toplevel) {
+                        continue;
+                }
+                struct wlr_box geometry;
+                wlr_xdg_surface_get_geometry (toplevel->xdg_toplevel->base, &geometry);
+                session_resize (session, geometry.width, geometry.height);
+
+                if (wl_list_empty (&surface->current.subsurfaces_below)
+                    && wl_list_empty (&surface->current.subsurfaces_above)) {
+                        pixman_region32_t damage;
+                        pixman_region32_init (&damage);
+                        wlr_surface_get_effective_damage (surface, &damage);
+                        pixman_region32_translate (&damage, -geometry.x, -geometry.y);
+                        pixman_region32_union (&session->damage, &session->damage, &damage);
+                        pixman_region32_fini (&damage);
+                } else {
+                        pixman_region32_union_rect (
+                            &session->damage, &session->damage, 0, 0, session->width, session->height);
+                }
+                session_try_copy (session);
+        }
+}
+
+void capture_toplevel_unmap (struct toplevel *toplevel) {
+        struct comp_capture    *capture = &toplevel->server->capture;
+        struct capture_session *session;
+        wl_list_for_each (session, &capture->sessions, link) {
+                if (session->toplevel == toplevel) {
+                        session_stop (session);
+                }
+        }
+        struct capture_source *source;
+        wl_list_for_each (source, &capture->sources, link) {
+                if (source->toplevel == toplevel) {
+                        source->toplevel = NULL;
+                }
+        }
+}
+
+void capture_init (struct comp_server *server) {
+        /* Toplevel sources name windows by their ext-foreign-toplevel-list
+         * handle, so the list has to exist first. The globals go with the
+         * display, as do the sessions with their clients. */
+        struct comp_capture *capture = &server->capture;
+        wl_list_init (&capture->sources);
+        wl_list_init (&capture->sessions);
+        capture->output_source_manager   = wl_global_create (server->wl_display,
+                                                           &ext_output_image_capture_source_manager_v1_interface,
+                                                           1,
+                                                           server,
+                                                           output_source_manager_bind);
+        capture->toplevel_source_manager = wl_global_create (server->wl_display,
+                                                             &ext_foreign_toplevel_image_capture_source_manager_v1_interface,
+                                                             1,
+                                                             server,
+                                                             toplevel_source_manager_bind);
+        capture->copy_manager            = wl_global_create (
+            server->wl_display, &ext_image_copy_capture_manager_v1_interface, 1, server, copy_manager_bind);
+}
@@ -0,0 +1,33 @@
+#ifndef COMP_CAPTURE_H
+#define COMP_CAPTURE_H
+
+#include <wayland-server-core.h>
+
+struct comp_output;
+struct comp_server;
+struct toplevel;
+struct wlr_output_event_commit;
+
+/** Screen capture: ext-image-copy-capture-v1, with outputs and toplevels as
+ * ext-image-capture-source-v1 sources. Copies are driven by damage: a frame
+ * the client asks for is only filled once its source changed, and then only
+ * the changed boxes (plus whatever the client says is stale in its buffer)
+ * are read back. Outputs are copied from the buffer they just committed, so
+ * capturing never adds a render of its own; toplevels are drawn off screen
+ * when one of their commits damaged them. Shared memory buffers only. */
+struct comp_capture
+{
+        struct wl_global *output_source_manager;
+        struct wl_global *toplevel_source_manager;
+        struct wl_global *copy_manager;
+        struct wl_list    sources;  // capture_source::link
+        struct wl_list    sessions; // capture_session::link
+};
+
+void capture_init (struct comp_server *server);
+void capture_output_commit (struct comp_output *output, struct wlr_output_event_commit *event);
+void capture_output_destroy (struct comp_output *output);
+void capture_toplevel_commit (struct toplevel *toplevel);
+void capture_toplevel_unmap (struct toplevel *toplevel);
+
+#endif // COMP_CAPTURE_H
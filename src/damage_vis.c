@@ -0,0 +1,106 @@
+#include "damage_vis.h"
+#include "nwm_server.h"
+#include "output.h"
+
+#include <pixman.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+#define DAMAGE_VIS_INTERVAL_MS 1000
+
+static uint64_t region_area (const pixman_region32_t *region) {
+        /* Pixman regions are made of non-overlapping boxes. */
+        int                   nboxes;
+        const pixman_box32_t *boxes = pixman_region32_rectangles (region, &nboxes);
+        uint64_t              area  = 0;
+        for (int i = 0; i < nboxes; i++) {
+                area += (uint64_t) (boxes[i].x2 - boxes[i].x1) * (uint64_t) (boxes[i].y2 - boxes[i].y1);
+        }
+        return area;
+}
+
+static int damage_vis_timer_notify (void *data) {
+        struct comp_server *server = data;
+
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                if (output->damage_frames == 0) {
+                        continue;
+                }
+                const uint64_t frame_pixels = (uint64_t) output->wlr_output->width
+                                              * (uint64_t) output->wlr_output->height;
+                const double ratio = frame_pixels > 0 ? (double) output->damage_pixels
+                                                            / (double) (frame_pixels * output->damage_frames)
+                                                      : 0;
+                wlr_log (WLR_INFO,
+                         "damage %s: %.1f%% of pixels repainted over %lu frames",
+                         output->wlr_output->name,
+                         ratio * 100,
+                         (unsigned long) output->damage_frames);
+                output->damage_pixels = 0;
+                output->damage_frames = 0;
+        }
+
+        wl_event_source_timer_update (server->damage_vis.timer, DAMAGE_VIS_INTERVAL_MS);
+        return 0;
+}
+
+void damage_vis_set_enabled (struct comp_server *server, bool enabled) {
+        struct comp_damage_vis *vis = &server->damage_vis;
+        if (vis->enabled == enabled) {
+                return;
+        }
+        vis->enabled = enabled;
+
+        /* The scene already knows how to tint damage and fade it out; it reads
+         * the option on every frame, so flipping it is enough. Turning it off
+         * puts back whatever WLR_SCENE_DEBUG_DAMAGE asked for and repaints
+         * everything to wipe highlights that are still fading. */
+        if (enabled) {
+                vis->saved_option                  = server->scene->debug_damage_option;
+                server->scene->debug_damage_option = WLR_SCENE_DEBUG_DAMAGE_HIGHLIGHT;
+        } else {
+                server->scene->debug_damage_option = vis->saved_option;
+                struct comp_output *output;
+                wl_list_for_each (output, &server->outputs, link) {
+                        output_damage_whole (output);
+                }
+        }
+
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                output->damage_pixels = 0;
+                output->damage_frames = 0;
+        }
+        wl_event_source_timer_update (vis->timer, enabled ? DAMAGE_VIS_INTERVAL_MS : 0);
+        wlr_log (WLR_INFO, "Damage visualization %s", enabled ? "on" : "off");
+}
+
+void damage_vis_output_frame (struct comp_output *output, struct wlr_scene_output *scene_output) {
+        /* Called right before the scene output is committed, while the damage
+         * it is about to repaint is still pending. Frames with nothing to
+         * repaint are skipped by the scene and not counted. */
+        if (!output->server->damage_vis.enabled || !wlr_scene_output_needs_frame (scene_output)) {
+                return;
+        }
+        output->damage_pixels += region_area (&scene_output->pending_commit_damage);
+        output->damage_frames++;
+}
+
+void damage_vis_init (struct comp_server *server) {
+        /* Must run after the scene is created. The option may have been set on
+         * the command line already. */
+        struct comp_damage_vis *vis     = &server->damage_vis;
+        const bool              enabled = vis->enabled;
+        vis->timer   = wl_event_loop_add_timer (server->wl_event_loop, damage_vis_timer_notify, server);
+        vis->enabled = false;
+        damage_vis_set_enabled (server, enabled);
+}
+
+void damage_vis_finish (struct comp_server *server) {
+        if (server->damage_vis.timer != NULL) {
+                wl_event_source_remove (server->damage_vis.timer);
+                server->damage_vis.timer = NULL;
+        }
+}
@@ -0,0 +1,28 @@
+#ifndef COMP_DAMAGE_VIS_H
+#define COMP_DAMAGE_VIS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <wlr/types/wlr_scene.h>
+
+struct comp_output;
+struct comp_server;
+
+/** Damage visualization. While enabled, the regions repainted in each frame
+ * are tinted and fade out over a few frames, and the share of each output
+ * that gets repainted is logged once per second. A full-screen repaint on
+ * every frame, or damage far larger than what actually changed, stands out
+ * immediately. */
+struct comp_damage_vis
+{
+        bool                               enabled;
+        enum wlr_scene_debug_damage_option saved_option; // WLR_SCENE_DEBUG_DAMAGE, while enabled
+        struct wl_event_source            *timer;
+};
+
+void damage_vis_init (struct comp_server *server);
+void damage_vis_finish (struct comp_server *server);
+void damage_vis_set_enabled (struct comp_server *server, bool enabled);
+void damage_vis_output_frame (struct comp_output *output, struct wlr_scene_output *scene_output);
+
+#endif // COMP_DAMAGE_VIS_H
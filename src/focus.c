@@ -0,0 +1,183 @@
+#include "focus.h"
+#include "animation.h"
+#include "histogram.h"
+#include "input/keyboard.h"
+#include "nwm_server.h"
+#include "xdg_shell.h"
+
+#include <stdlib.h>
+#include <time.h>
+#include <wlr/types/wlr_scene.h>
+
+#define FOCUS_INITIAL_SLOTS 64
+#define FOCUS_BENCH_BATCH   64 // focus changes between client flushes
+
+struct focus_slot
+{
+        struct toplevel *toplevel;   // NULL while unused
+        uint32_t         generation; // bumped every time the slot is given out
+        uint32_t         next_free;  // while unused
+};
+
+static uint64_t slot_id (uint32_t slot, uint32_t generation) {
+        return ((uint64_t) generation << 32) | slot;
+}
+
+bool focus_toplevel_create (struct toplevel *toplevel) {
+        /* Gives the toplevel its ID, reusing the most recently freed slot.
+         * The table only grows, doubling, so this is amortized constant. */
+        struct comp_focus *focus = &toplevel->server->focus;
+        uint32_t           slot  = focus->free_head;
+        if (slot != FOCUS_NO_SLOT) {
+                focus->free_head = focus->slots[slot].next_free;
+        } else {
+                if (focus->nslots == focus->cap) {
+                        const uint32_t     cap   = focus->cap > 0 ? focus->cap * 2 : FOCUS_INITIAL_SLOTS;
+                        struct focus_slot *slots = realloc (focus->slots, cap * sizeof (*slots));
+                        if (slots == NULL) {
+                                return false;
+                        }
+                        focus->slots = slots;
+                        focus->cap   = cap;
+                }
+                slot                          = focus->nslots++;
+                focus->slots[slot].generation = 0;
+        }
+        focus->slots[slot].toplevel = toplevel;
+        focus->slots[slot].generation++;
+        toplevel->id = slot_id (slot, focus->slots[slot].generation);
+        return true;
+}
+
+void focus_toplevel_destroy (struct toplevel *toplevel) {
+        /* Generations start at 1, an ID of 0 never got a slot. */
+        struct comp_focus *focus = &toplevel->server->focus;
+        const uint32_t     slot  = (uint32_t) toplevel->id;
+        if (toplevel->id == 0) {
+                return;
+        }
+        focus->slots[slot].toplevel  = NULL;
+        focus->slots[slot].next_free = focus->free_head;
+        focus->free_head             = slot;
+}
+
+struct toplevel *focus_toplevel_from_id (struct comp_server *server, uint64_t id) {
+        const struct comp_focus *focus = &server->focus;
+        const uint32_t           slot  = (uint32_t) id;
+        if (slot >= focus->nslots || focus->slots[slot].toplevel == NULL
+            || slot_id (slot, focus->slots[slot].generation) != id) {
+                return NULL;
+        }
+        return focus->slots[slot].toplevel;
+}
+
+void focus_toplevel_map (struct toplevel *toplevel) {
+        /* Mapped toplevels enter the MRU list at the front, and so on top of
+         * the others; the caller focuses them right after. */
+        struct comp_server *server = toplevel->server;
+        wl_list_insert (&server->toplevels, &toplevel->link);
+        wlr_scene_node_raise_to_top (&toplevel->scene_tree->node);
+        server->focus.count++;
+}
+
+void focus_toplevel_unmap (struct toplevel *toplevel) {
+        wl_list_remove (&toplevel->link);
+        toplevel->server->focus.count--;
+}
+
+bool focus_raise (struct toplevel *toplevel) {
+        /* Moves the toplevel to the front of the MRU list. Returns false if
+         * it already was there, in which case it is also on top already and
+         * there is nothing to restack. */
+        struct wl_list *toplevels = &toplevel->server->toplevels;
+        if (toplevels->next == &toplevel->link) {
+                return false;
+        }
+        wl_list_remove (&toplevel->link);
+        wl_list_insert (toplevels, &toplevel->link);
+        return true;
+}
+
+void focus_cycle (struct comp_server *server, bool forward) {
+        /* Forward focuses the least recently used toplevel, which rotates the
+         * list by one: repeated, it visits every toplevel in turn. Backward
+         * undoes that rotation by focusing the second toplevel and sending
+         * the one that was focused to the back, of the list and of the
+         * stacking order both, so the front of the list stays on top. */
+        if (server->focus.count < 2) {
+                return;
+        }
+        struct wl_list *toplevels = &server->toplevels;
+        if (forward) {
+                struct toplevel *next = wl_container_of (toplevels->prev, next, link);
+                keyboard_focus_toplevel (next, next->xdg_toplevel->base->surface);
+                return;
+        }
+        struct toplevel *current = wl_container_of (toplevels->next, current, link);
+        struct toplevel *prev    = wl_container_of (current->link.next, prev, link);
+        keyboard_focus_toplevel (prev, prev->xdg_toplevel->base->surface);
+        wl_list_remove (&current->link);
+        wl_list_insert (toplevels->prev, &current->link);
+        wlr_scene_node_lower_to_bottom (&current->scene_tree->node);
+}
+
+struct toplevel *focus_toplevel_at (struct comp_server *server, uint32_t index) {
+        /* The toplevel at the given MRU position, 0 being the focused one.
+         * Constant time focus changes rule out constant time ranks, so this
+         * walks in from whichever end of the list is closer. */
+        const uint32_t count = server->focus.count;
+        if (index >= count) {
+                return NULL;
+        }
+        struct wl_list *link = &server->toplevels;
+        if (index < count / 2) {
+                for (uint32_t i = 0; i <= index; i++) {
+                        link = link->next;
+                }
+        } else {
+                for (uint32_t i = count; i > index; i--) {
+                        link = link->prev;
+                }
+        }
+        struct toplevel *toplevel = wl_container_of (link, toplevel, link);
+        return toplevel;
+}
+
+void focus_bench (struct comp_server *server, uint32_t changes, struct histogram *hist) {
+        /* Cycles focus forward and records what each change costs, in
+         * nanoseconds, up to the point where the activation configure and
+         * the keyboard enter are queued for the clients. Animations are off
+         * meanwhile, they are not part of the cost being measured. Clients
+         * are flushed between batches, outside the timing, so the events
+         * queued for them do not pile up until their connections overflow. */
+        const bool animations = server->animation.enabled;
+        animation_set_enabled (server, false);
+        histogram_reset (hist);
+        if (changes > FOCUS_BENCH_MAX) {
+                changes = FOCUS_BENCH_MAX;
+        }
+        for (uint32_t i = 0; i < changes && server->focus.count >= 2; i++) {
+                struct timespec start, end;
+                clock_gettime (CLOCK_MONOTONIC, &start);
+                focus_cycle (server, true);
+                clock_gettime (CLOCK_MONOTONIC, &end);
+                histogram_add (hist,
+                               (uint64_t) (end.tv_sec - start.tv_sec) * 1000000000
+                                   + (uint64_t) (end.tv_nsec - start.tv_nsec));
+                if ((i + 1) % FOCUS_BENCH_BATCH == 0) {
+                        wl_display_flush_clients (server->wl_display);
+                }
+        }
+        animation_set_enabled (server, animations);
+}
+
+void focus_init (struct comp_server *server) {
+        wl_list_init (&server->toplevels);
+        server->focus.free_head = FOCUS_NO_SLOT;
+}
+
+void focus_finish (struct comp_server *server) {
+        /* Runs after the clients, and their toplevels, are gone. */
+        free (server->focus.slots);
+        server->focus = (struct comp_focus) { .free_head = FOCUS_NO_SLOT };
+}
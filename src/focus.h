@@ -0,0 +1,42 @@
+#ifndef COMP_FOCUS_H
+#define COMP_FOCUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct comp_server;
+struct focus_slot;
+struct histogram;
+struct toplevel;
+
+/** Focus order and toplevel IDs. comp_server::toplevels is the most
+ * recently used list, the focused toplevel first; focusing moves a toplevel
+ * to the front and cycling rotates the list from either end, all in
+ * constant time. Every toplevel also gets an ID that stays the same for as
+ * long as it exists: a slot in a table, which makes looking a toplevel up
+ * by ID constant time as well, plus the slot's generation so that a stale
+ * ID never names whatever reused the slot. */
+struct comp_focus
+{
+        struct focus_slot *slots;
+        uint32_t           nslots, cap;
+        uint32_t           free_head; // first unused slot, FOCUS_NO_SLOT if none
+        uint32_t           count;     // mapped toplevels, the length of the MRU list
+};
+
+#define FOCUS_NO_SLOT   UINT32_MAX
+#define FOCUS_BENCH_MAX 20000 // focus changes per focus_bench run
+
+void             focus_init (struct comp_server *server);
+void             focus_finish (struct comp_server *server);
+bool             focus_toplevel_create (struct toplevel *toplevel);
+void             focus_toplevel_destroy (struct toplevel *toplevel);
+void             focus_toplevel_map (struct toplevel *toplevel);
+void             focus_toplevel_unmap (struct toplevel *toplevel);
+bool             focus_raise (struct toplevel *toplevel);
+void             focus_cycle (struct comp_server *server, bool forward);
+struct toplevel *focus_toplevel_from_id (struct comp_server *server, uint64_t id);
+struct toplevel *focus_toplevel_at (struct comp_server *server, uint32_t index);
+void             focus_bench (struct comp_server *server, uint32_t changes, struct histogram *hist);
+
+#endif // COMP_FOCUS_H
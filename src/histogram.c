@@ -0,0 +1,80 @@
+#include "histogram.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static unsigned int bucket_index (uint64_t value) {
+        if (value < HIST_SUB_BUCKETS) {
+                return value;
+        }
+        /* Position of the top bit picks the octave, the next HIST_SUB_BITS bits
+         * pick the linear bucket within it. */
+        const unsigned int top    = 63 - __builtin_clzll (value);
+        const unsigned int octave = top - HIST_SUB_BITS + 1;
+        const unsigned int sub    = (value >> (top - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1);
+        const unsigned int index  = octave * HIST_SUB_BUCKETS + sub;
+        return index < HIST_BUCKETS ? index : HIST_BUCKETS - 1;
+}
+
+static uint64_t bucket_upper_bound (unsigned int index) {
+        if (index < HIST_SUB_BUCKETS) {
+                return index;
+        }
+        const unsigned int octave = index / HIST_SUB_BUCKETS;
+        const unsigned int sub    = index % HIST_SUB_BUCKETS;
+        const unsigned int shift  = octave - 1;
+        return ((uint64_t) (HIST_SUB_BUCKETS + sub + 1) << shift) - 1;
+}
+
+void histogram_reset (struct histogram *hist) {
+        memset (hist, 0, sizeof (*hist));
+}
+
+void histogram_add (struct histogram *hist, uint64_t value) {
+        if (hist->count == 0 || value < hist->min) {
+                hist->min = value;
+        }
+        if (value > hist->max) {
+                hist->max = value;
+        }
+        hist->count++;
+        hist->sum += value;
+        hist->buckets[bucket_index (value)]++;
+}
+
+uint64_t histogram_percentile (const struct histogram *hist, double percentile) {
+        /* Returns the upper bound of the bucket holding the given percentile,
+         * clamped to the largest value actually seen. */
+        if (hist->count == 0) {
+                return 0;
+        }
+        uint64_t rank = (uint64_t) (percentile / 100.0 * hist->count);
+        if (rank >= hist->count) {
+                rank = hist->count - 1;
+        }
+        uint64_t seen = 0;
+        for (unsigned int i = 0; i < HIST_BUCKETS; i++) {
+                seen += hist->buckets[i];
+                if (seen > rank) {
+                        const uint64_t bound = bucket_upper_bound (i);
+                        return bound < hist->max ? bound : hist->max;
+                }
+        }
+        return hist->max;
+}
+
+int histogram_format (const struct histogram *hist, const char *label, char *buf, size_t size) {
+        if (hist->count == 0) {
+                return snprintf (buf, size, "%s: no samples", label);
+        }
+        return snprintf (buf,
+                         size,
+                         "%s: n=%lu avg=%.2fms p50=%.2fms p90=%.2fms p99=%.2fms max=%.2fms",
+                         label,
+                         (unsigned long) hist->count,
+                         (double) hist->sum / hist->count / 1000.0,
+                         histogram_percentile (hist, 50) / 1000.0,
+                         histogram_percentile (hist, 90) / 1000.0,
+                         histogram_percentile (hist, 99) / 1000.0,
+                         hist->max / 1000.0);
+}
@@ -0,0 +1,33 @@
+#ifndef COMP_HISTOGRAM_H
+#define COMP_HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Log-linear histogram over microsecond values: every power of two is split
+ * into HIST_SUB_BUCKETS linear buckets, so the relative error of a reported
+ * percentile is bounded by 1/HIST_SUB_BUCKETS no matter the magnitude. Fixed
+ * size, no allocation, constant time insertion. Nothing here depends on
+ * wlroots, nwm-loadgen builds it too. */
+#define HIST_SUB_BITS    3
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_OCTAVES     32
+#define HIST_BUCKETS     (HIST_OCTAVES * HIST_SUB_BUCKETS)
+
+struct histogram
+{
+        uint64_t count;
+        uint64_t sum;
+        uint64_t min;
+        uint64_t max;
+        uint32_t buckets[HIST_BUCKETS];
+};
+
+void     histogram_reset (struct histogram *hist);
+void     histogram_add (struct histogram *hist, uint64_t value);
+uint64_t histogram_percentile (const struct histogram *hist, double percentile);
+/* Formats "label: n=.. avg=.. p50=.. p90=.. p99=.. max=.." in milliseconds,
+ * returns what snprintf returns. */
+int      histogram_format (const struct histogram *hist, const char *label, char *buf, size_t size);
+
+#endif // COMP_HISTOGRAM_H
@@ -0,0 +1,188 @@
+#include "idle.h"
+#include "nwm_server.h"
+#include "output.h"
+
+#include <stdlib.h>
+#include <wlr/types/wlr_idle_inhibit_v1.h>
+#include <wlr/types/wlr_idle_notify_v1.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_power_management_v1.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/log.h>
+
+#define IDLE_NOTIFY_INTERVAL_MS 500
+
+struct idle_inhibitor
+{
+        struct comp_server *server;
+        struct wl_listener  destroy;
+};
+
+static int64_t msec_since (const struct timespec *then) {
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        return (int64_t) (now.tv_sec - then->tv_sec) * 1000 + (now.tv_nsec - then->tv_nsec) / 1000000;
+}
+
+static void output_set_power (struct comp_output *output, bool on) {
+        struct wlr_output_state state;
+        wlr_output_state_init (&state);
+        wlr_output_state_set_enabled (&state, on);
+        if (!wlr_output_commit_state (output->wlr_output, &state)) {
+                wlr_log (WLR_ERROR,
+                         "Failed to power %s output %s",
+                         on ? "on" : "off",
+                         output->wlr_output->name);
+        }
+        wlr_output_state_finish (&state);
+}
+
+static void idle_enter (struct comp_server *server) {
+        struct comp_idle *idle = &server->idle;
+        wlr_log (WLR_INFO, "Idle for %dms, powering outputs down", idle->timeout_ms);
+        idle->idle = true;
+
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                if (output->wlr_output->enabled) {
+                        output->idle_off = true;
+                        output_set_power (output, false);
+                }
+        }
+}
+
+static void idle_leave (struct comp_server *server) {
+        /* Bring back only what we turned off ourselves, and ask for a frame
+         * right away so the first frame after wakeup is the next vblank. */
+        struct comp_idle *idle = &server->idle;
+        idle->idle             = false;
+
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                if (output->idle_off) {
+                        output->idle_off = false;
+                        output_set_power (output, true);
+                        wlr_output_schedule_frame (output->wlr_output);
+                }
+        }
+        wl_event_source_timer_update (idle->timer, idle->timeout_ms);
+        wlr_log (WLR_INFO, "Input activity, outputs powered up");
+}
+
+static int idle_timer_notify (void *data) {
+        /* Input only records a timestamp, so the timer may fire early; in that
+         * case just sleep for whatever is left of the timeout. */
+        struct comp_server *server = data;
+        struct comp_idle   *idle   = &server->idle;
+
+        if (idle->idle) {
+                return 0;
+        }
+        if (idle->inhibitors > 0) {
+                wl_event_source_timer_update (idle->timer, idle->timeout_ms);
+                return 0;
+        }
+        const int64_t elapsed = msec_since (&idle->last_activity);
+        if (elapsed < idle->timeout_ms) {
+                wl_event_source_timer_update (idle->timer, idle->timeout_ms - elapsed);
+                return 0;
+        }
+        idle_enter (server);
+        return 0;
+}
+
+void idle_notify_activity (struct comp_server *server) {
+        /* Called for every input event. Keep it to a clock read unless we are
+         * actually waking up. The notifier re-arms a timer per idle
+         * notification it has, so it hears of activity at most every
+         * IDLE_NOTIFY_INTERVAL_MS. The first event after a pause always
+         * gets through, so nothing idle resumes late. */
+        struct comp_idle *idle = &server->idle;
+        clock_gettime (CLOCK_MONOTONIC, &idle->last_activity);
+        const int64_t since
+            = (int64_t) (idle->last_activity.tv_sec - idle->last_notify.tv_sec) * 1000
+              + (idle->last_activity.tv_nsec - idle->last_notify.tv_nsec) / 1000000;
+        if (since >= IDLE_NOTIFY_INTERVAL_MS) {
+                wlr_idle_notifier_v1_notify_activity (idle->notifier, server->seat);
+                idle->last_notify = idle->last_activity;
+        }
+        if (idle->idle) {
+                idle_leave (server);
+        }
+}
+
+static void idle_inhibitor_destroy (struct wl_listener *listener, void *data) {
+        struct idle_inhibitor *inhibitor = wl_container_of (listener, inhibitor, destroy);
+        struct comp_idle      *idle      = &inhibitor->server->idle;
+
+        idle->inhibitors--;
+        wlr_idle_notifier_v1_set_inhibited (idle->notifier, idle->inhibitors > 0);
+
+        wl_list_remove (&inhibitor->destroy.link);
+        free (inhibitor);
+}
+
+static void idle_new_inhibitor (struct wl_listener *listener, void *data) {
+        /* Video players and presentations keep the screen on through these.
+         * Visibility of the inhibiting surface is not taken into account. */
+        struct comp_server           *server        = wl_container_of (listener, server, idle.new_inhibitor);
+        struct wlr_idle_inhibitor_v1 *wlr_inhibitor = data;
+        struct comp_idle             *idle          = &server->idle;
+
+        struct idle_inhibitor *inhibitor = calloc (1, sizeof (*inhibitor));
+        inhibitor->server                = server;
+        inhibitor->destroy.notify        = idle_inhibitor_destroy;
+        wl_signal_add (&wlr_inhibitor->events.destroy, &inhibitor->destroy);
+
+        idle->inhibitors++;
+        wlr_idle_notifier_v1_set_inhibited (idle->notifier, true);
+}
+
+static void idle_output_power_set_mode (struct wl_listener *listener, void *data) {
+        /* A client (e.g. swayidle) asked for an output to be turned on or off. */
+        struct comp_server *server = wl_container_of (listener, server, idle.output_power_set_mode);
+        struct wlr_output_power_v1_set_mode_event *event = data;
+
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                if (output->wlr_output == event->output) {
+                        const bool on    = event->mode == ZWLR_OUTPUT_POWER_V1_MODE_ON;
+                        output->idle_off = false;
+                        output_set_power (output, on);
+                        if (on) {
+                                wlr_output_schedule_frame (output->wlr_output);
+                        }
+                        return;
+                }
+        }
+}
+
+void idle_init (struct comp_server *server) {
+        struct comp_idle *idle = &server->idle;
+
+        idle->notifier = wlr_idle_notifier_v1_create (server->wl_display);
+
+        idle->inhibit_manager      = wlr_idle_inhibit_v1_create (server->wl_display);
+        idle->new_inhibitor.notify = idle_new_inhibitor;
+        wl_signal_add (&idle->inhibit_manager->events.new_inhibitor, &idle->new_inhibitor);
+
+        idle->power_manager                = wlr_output_power_manager_v1_create (server->wl_display);
+        idle->output_power_set_mode.notify = idle_output_power_set_mode;
+        wl_signal_add (&idle->power_manager->events.set_mode, &idle->output_power_set_mode);
+
+        clock_gettime (CLOCK_MONOTONIC, &idle->last_activity);
+        if (idle->timeout_ms > 0) {
+                idle->timer = wl_event_loop_add_timer (server->wl_event_loop, idle_timer_notify, server);
+                wl_event_source_timer_update (idle->timer, idle->timeout_ms);
+        }
+}
+
+void idle_finish (struct comp_server *server) {
+        struct comp_idle *idle = &server->idle;
+        if (idle->timer != NULL) {
+                wl_event_source_remove (idle->timer);
+                idle->timer = NULL;
+        }
+        wl_list_remove (&idle->new_inhibitor.link);
+        wl_list_remove (&idle->output_power_set_mode.link);
+}
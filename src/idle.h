@@ -0,0 +1,34 @@
+#ifndef COMP_IDLE_H
+#define COMP_IDLE_H
+
+#include <stdbool.h>
+#include <time.h>
+#include <wayland-server-core.h>
+
+struct comp_server;
+
+/** Idle manager. After `timeout_ms` without input, and while no client holds
+ * an idle inhibitor, every enabled output is powered down. Disabled outputs
+ * produce no frame events, so nwm stops committing and stops sending frame
+ * callbacks until input wakes it up again. */
+struct comp_idle
+{
+        int             timeout_ms; // 0 never goes idle
+        bool            idle;
+        struct timespec last_activity;
+        struct timespec last_notify; // last activity passed on to ext-idle-notify
+
+        struct wl_event_source             *timer;
+        struct wlr_idle_notifier_v1        *notifier;
+        struct wlr_idle_inhibit_manager_v1 *inhibit_manager;
+        struct wl_listener                  new_inhibitor;
+        int                                 inhibitors;
+        struct wlr_output_power_manager_v1 *power_manager;
+        struct wl_listener                  output_power_set_mode;
+};
+
+void idle_init (struct comp_server *server);
+void idle_finish (struct comp_server *server);
+void idle_notify_activity (struct comp_server *server);
+
+#endif // COMP_IDLE_H
@@ -0,0 +1,170 @@
+#include "constraint.h"
+#include "../alloc.h"
+
+#include <pixman.h>
+#include <stdlib.h>
+#include <wlr/types/wlr_cursor.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/log.h>
+#include <wlr/util/region.h>
+
+static void warp_to_constraint_hint (struct comp_server               *server,
+                                     struct wlr_pointer_constraint_v1 *constraint) {
+        /* Clients that lock the pointer usually hide it and draw their own, so
+         * when the lock goes away they may ask for the cursor to reappear where
+         * their fake one was. The hint is surface-local; the surface origin is
+         * recovered from the last position we reported to the seat. */
+        if (!constraint->current.cursor_hint.enabled) {
+                return;
+        }
+        struct wlr_seat *seat = server->seat;
+        if (seat->pointer_state.focused_surface != constraint->surface) {
+                return;
+        }
+        const double origin_x = server->cursor->x - seat->pointer_state.sx;
+        const double origin_y = server->cursor->y - seat->pointer_state.sy;
+        const double hint_x   = constraint->current.cursor_hint.x;
+        const double hint_y   = constraint->current.cursor_hint.y;
+
+        wlr_cursor_warp (server->cursor, NULL, origin_x + hint_x, origin_y + hint_y);
+        wlr_seat_pointer_warp (seat, hint_x, hint_y);
+}
+
+void cursor_constrain (struct comp_server *server, struct wlr_pointer_constraint_v1 *constraint) {
+        /* Only one constraint can be active per seat. Switching constraints
+         * deactivates the previous one before the new one is announced. */
+        struct wlr_pointer_constraint_v1 *prev = server->active_constraint;
+        if (prev == constraint) {
+                return;
+        }
+        if (prev != NULL) {
+                if (constraint == NULL) {
+                        warp_to_constraint_hint (server, prev);
+                }
+                wlr_pointer_constraint_v1_send_deactivated (prev);
+        }
+
+        server->active_constraint = constraint;
+        if (constraint == NULL) {
+                return;
+        }
+        wlr_pointer_constraint_v1_send_activated (constraint);
+}
+
+void cursor_update_constraint (struct comp_server *server) {
+        /* Called whenever pointer or keyboard focus changes. A constraint only
+         * applies while its surface has both, so a game that lost focus to
+         * another window does not keep the pointer. */
+        struct wlr_seat                  *seat       = server->seat;
+        struct wlr_surface               *surface    = seat->pointer_state.focused_surface;
+        struct wlr_pointer_constraint_v1 *constraint = NULL;
+        if (surface != NULL && surface == seat->keyboard_state.focused_surface) {
+                constraint = wlr_pointer_constraints_v1_constraint_for_surface (
+                    server->pointer_constraints, surface, seat);
+        }
+        cursor_constrain (server, constraint);
+}
+
+bool cursor_constrain_motion (struct comp_server *server, double *dx, double *dy) {
+        /* Clamps a relative motion delta to the active constraint. Returns false
+         * if the cursor must not move at all, which is the case for locks and for
+         * confinements that cannot be satisfied. */
+        struct wlr_pointer_constraint_v1 *constraint = server->active_constraint;
+        if (constraint == NULL) {
+                return true;
+        }
+        if (constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED) {
+                return false;
+        }
+
+        const double sx = server->seat->pointer_state.sx;
+        const double sy = server->seat->pointer_state.sy;
+        double       sx_confined, sy_confined;
+        if (!wlr_region_confine (
+                &constraint->region, sx, sy, sx + *dx, sy + *dy, &sx_confined, &sy_confined)) {
+                return false;
+        }
+        *dx = sx_confined - sx;
+        *dy = sy_confined - sy;
+        return true;
+}
+
+static void pointer_constraint_set_region (struct wl_listener *listener, void *data) {
+        /* A confining client shrank its region; pull the cursor back inside if it
+         * now sits outside of it. */
+        struct pointer_constraint *constraint = wl_container_of (listener, constraint, set_region);
+        struct comp_server        *server     = constraint->server;
+        struct wlr_pointer_constraint_v1 *wlr_constraint = constraint->constraint;
+
+        if (server->active_constraint != wlr_constraint
+            || wlr_constraint->type != WLR_POINTER_CONSTRAINT_V1_CONFINED) {
+                return;
+        }
+
+        struct wlr_seat *seat = server->seat;
+        const double     sx   = seat->pointer_state.sx;
+        const double     sy   = seat->pointer_state.sy;
+        if (pixman_region32_contains_point (&wlr_constraint->region, (int) sx, (int) sy, NULL)) {
+                return;
+        }
+
+        int                   nboxes;
+        const pixman_box32_t *boxes = pixman_region32_rectangles (&wlr_constraint->region, &nboxes);
+        if (nboxes == 0) {
+                return;
+        }
+        const double new_sx = (boxes[0].x1 + boxes[0].x2) / 2.0;
+        const double new_sy = (boxes[0].y1 + boxes[0].y2) / 2.0;
+        wlr_cursor_warp (server->cursor,
+                         NULL,
+                         server->cursor->x - sx + new_sx,
+                         server->cursor->y - sy + new_sy);
+        wlr_seat_pointer_warp (seat, new_sx, new_sy);
+}
+
+static void pointer_constraint_destroy (struct wl_listener *listener, void *data) {
+        struct pointer_constraint *constraint = wl_container_of (listener, constraint, destroy);
+        struct comp_server        *server     = constraint->server;
+
+        wl_list_remove (&constraint->set_region.link);
+        wl_list_remove (&constraint->destroy.link);
+
+        if (server->active_constraint == constraint->constraint) {
+                /* The constraint is going away, so there is nothing to deactivate;
+                 * just honor its cursor hint and forget about it. */
+                warp_to_constraint_hint (server, constraint->constraint);
+                server->active_constraint = NULL;
+        }
+
+        nwm_free (constraint);
+}
+
+void seat_keyboard_focus_change (struct wl_listener *listener, void *data) {
+        /* Keyboard focus moves without the pointer when a window is focused
+         * from the keyboard, or closes, or a layer surface takes focus. */
+        struct comp_server *server = wl_container_of (listener, server, keyboard_focus_change);
+        cursor_update_constraint (server);
+}
+
+void server_new_pointer_constraint (struct wl_listener *listener, void *data) {
+        /* This event is raised when a client asks to lock or confine the pointer
+         * to one of its surfaces. The constraint only becomes active once that
+         * surface has pointer and keyboard focus. */
+        struct comp_server *server = wl_container_of (listener, server, new_pointer_constraint);
+        struct wlr_pointer_constraint_v1 *wlr_constraint = data;
+
+        struct pointer_constraint *constraint = nwm_alloc (ALLOC_INPUT, struct pointer_constraint);
+        constraint->server                    = server;
+        constraint->constraint                = wlr_constraint;
+
+        constraint->set_region.notify = pointer_constraint_set_region;
+        wl_signal_add (&wlr_constraint->events.set_region, &constraint->set_region);
+        constraint->destroy.notify = pointer_constraint_destroy;
+        wl_signal_add (&wlr_constraint->events.destroy, &constraint->destroy);
+
+        wlr_log (WLR_DEBUG,
+                 "New %s pointer constraint",
+                 wlr_constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED ? "locked" : "confined");
+
+        cursor_update_constraint (server);
+}
@@ -0,0 +1,23 @@
+#ifndef CONSTRAINT_H
+#define CONSTRAINT_H
+
+#include "../nwm_server.h"
+
+#include <wlr/types/wlr_pointer_constraints_v1.h>
+
+struct pointer_constraint
+{
+        struct comp_server                *server;
+        struct wlr_pointer_constraint_v1 *constraint;
+
+        struct wl_listener set_region;
+        struct wl_listener destroy;
+};
+
+void server_new_pointer_constraint (struct wl_listener *listener, void *data);
+void seat_keyboard_focus_change (struct wl_listener *listener, void *data);
+void cursor_constrain (struct comp_server *server, struct wlr_pointer_constraint_v1 *constraint);
+void cursor_update_constraint (struct comp_server *server);
+bool cursor_constrain_motion (struct comp_server *server, double *dx, double *dy);
+
+#endif // CONSTRAINT_H
@@ -12,15 +12,82 @@
 #include <wlr/types/wlr_cursor.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_pointer.h>
+#include <wlr/types/wlr_relative_pointer_v1.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/util/edges.h>
 #include <wlr/util/log.h>
 
+#include "../idle.h"
+#include "../latency.h"
+#include "../layer_shell.h"
+#include "../overview.h"
+#include "../record.h"
 #include "../xdg_shell.h"
+#include "constraint.h"
 #include "cursor.h"
 #include "keyboard.h"
 
 #include <stdlib.h>
+#include <string.h>
+#include <wlr/types/wlr_xcursor_manager.h>
+
+static void cursor_image_forget_surface (struct comp_server *server) {
+        wl_list_remove (&server->cursor_image_surface_destroy.link);
+        wl_list_init (&server->cursor_image_surface_destroy.link);
+}
+
+static void cursor_image_surface_destroy (struct wl_listener *listener, void *data) {
+        /* The client cursor surface went away. Forget it, so a new surface that
+         * happens to get the same address is not mistaken for the old one. */
+        struct comp_server *server = wl_container_of (listener, server, cursor_image_surface_destroy);
+        cursor_image_forget_surface (server);
+        server->cursor_image.type    = CURSOR_IMAGE_NONE;
+        server->cursor_image.surface = NULL;
+}
+
+void cursor_set_xcursor (struct comp_server *server, const char *name) {
+        /* Sets a theme cursor, unless it is already the one being shown. Every
+         * real change re-uploads the image and damages the cursor plane. */
+        struct cursor_image *image = &server->cursor_image;
+        if (image->type == CURSOR_IMAGE_XCURSOR && strcmp (image->xcursor_name, name) == 0) {
+                server->stats.cursor_image_skipped++;
+                return;
+        }
+
+        cursor_image_forget_surface (server);
+        image->type         = CURSOR_IMAGE_XCURSOR;
+        image->xcursor_name = name;
+        image->surface      = NULL;
+        wlr_cursor_set_xcursor (server->cursor, server->cursor_mgr, name);
+        server->stats.cursor_image_updates++;
+}
+
+void cursor_set_surface (struct comp_server *server,
+                         struct wlr_surface *surface,
+                         int32_t             hotspot_x,
+                         int32_t             hotspot_y) {
+        /* Same as above, for client provided cursor surfaces. A NULL surface
+         * hides the cursor and is cached like any other image. */
+        struct cursor_image *image = &server->cursor_image;
+        if (image->type == CURSOR_IMAGE_SURFACE && image->surface == surface
+            && image->hotspot_x == hotspot_x && image->hotspot_y == hotspot_y) {
+                server->stats.cursor_image_skipped++;
+                return;
+        }
+
+        cursor_image_forget_surface (server);
+        image->type         = CURSOR_IMAGE_SURFACE;
+        image->xcursor_name = NULL;
+        image->surface      = surface;
+        image->hotspot_x    = hotspot_x;
+        image->hotspot_y    = hotspot_y;
+        if (surface != NULL) {
+                server->cursor_image_surface_destroy.notify = cursor_image_surface_destroy;
+                wl_signal_add (&surface->events.destroy, &server->cursor_image_surface_destroy);
+        }
+        wlr_cursor_set_surface (server->cursor, surface, hotspot_x, hotspot_y);
+        server->stats.cursor_image_updates++;
+}
 
 void reset_cursor_mode (struct comp_server *server) {
         /* Reset the cursor mode to passthrough. */
@@ -36,9 +103,28 @@ void server_cursor_button (struct wl_listener *listener, void *data) {
         struct comp_server              *server = wl_container_of (listener, server, cursor_button);
         struct wlr_pointer_button_event *event  = data;
 
+        const struct record_pointer_button rec = {
+                .time_msec = event->time_msec,
+                .button    = event->button,
+                .state     = event->state,
+        };
+        record_device_event (
+            server, &event->pointer->base, RECORD_POINTER_BUTTON, &rec, sizeof (rec));
+        idle_notify_activity (server);
+
+        /* Clicks while the overview is up pick a window, clients never see them. */
+        if (overview_handle_button (server,
+                                    event->button,
+                                    event->state == WL_POINTER_BUTTON_STATE_PRESSED,
+                                    server->cursor->x,
+                                    server->cursor->y)) {
+                return;
+        }
+
         /* Notify the client with pointer focus that a button press has occurred */
         wlr_seat_pointer_notify_button (
             server->seat, event->time_msec, event->button, event->state);
+        latency_input (server, &event->pointer->base, server->seat->pointer_state.focused_client);
         double              sx, sy;
         struct wlr_surface *surface  = NULL;
         struct toplevel    *toplevel = desktop_toplevel_at (
@@ -49,6 +135,9 @@ void server_cursor_button (struct wl_listener *listener, void *data) {
         } else {
                 /* Focus that client if the button was _pressed_ */
                 keyboard_focus_toplevel (toplevel, surface);
+                if (toplevel == NULL && surface != NULL) {
+                        layer_surface_focus_on_click (server, surface);
+                }
         }
 }
 
@@ -57,6 +146,18 @@ void server_cursor_axis (struct wl_listener *listener, void *data) {
          * for example when you move the scroll wheel. */
         struct comp_server            *server = wl_container_of (listener, server, cursor_axis);
         struct wlr_pointer_axis_event *event  = data;
+
+        const struct record_pointer_axis rec = {
+                .time_msec          = event->time_msec,
+                .source             = event->source,
+                .orientation        = event->orientation,
+                .relative_direction = event->relative_direction,
+                .delta              = event->delta,
+                .delta_discrete     = event->delta_discrete,
+        };
+        record_device_event (
+            server, &event->pointer->base, RECORD_POINTER_AXIS, &rec, sizeof (rec));
+        idle_notify_activity (server);
         /* Notify the client with pointer focus of the axis event. */
         wlr_seat_pointer_notify_axis (server->seat,
                                       event->time_msec,
@@ -143,15 +244,16 @@ static void process_cursor_motion (struct comp_server *server, uint32_t time) {
 
         /* Otherwise, find the toplevel under the pointer and send the event along. */
         double              sx, sy;
-        struct wlr_seat    *seat     = server->seat;
-        struct wlr_surface *surface  = NULL;
-        struct toplevel    *toplevel = desktop_toplevel_at (
+        struct wlr_seat    *seat       = server->seat;
+        struct wlr_surface *prev_focus = seat->pointer_state.focused_surface;
+        struct wlr_surface *surface    = NULL;
+        struct toplevel    *toplevel   = desktop_toplevel_at (
             server, server->cursor->x, server->cursor->y, &surface, &sx, &sy);
-        if (!toplevel) {
-                /* If there's no toplevel under the cursor, set the cursor image to a
+        if (!surface) {
+                /* If there's no surface under the cursor, set the cursor image to a
                  * default. This is what makes the cursor image appear when you move it
-                 * around the screen, not over any toplevels. */
-                wlr_cursor_set_xcursor (server->cursor, server->cursor_mgr, "default");
+                 * around the screen, not over any toplevels or panels. */
+                cursor_set_xcursor (server, "default");
         }
         if (surface) {
                 /*
@@ -172,6 +274,11 @@ static void process_cursor_motion (struct comp_server *server, uint32_t time) {
                  * the last client to have the cursor over it. */
                 wlr_seat_pointer_clear_focus (seat);
         }
+
+        /* Pointer constraints follow pointer focus. */
+        if (seat->pointer_state.focused_surface != prev_focus) {
+                cursor_update_constraint (server);
+        }
 }
 
 void server_cursor_motion (struct wl_listener *listener, void *data) {
@@ -179,13 +286,46 @@ void server_cursor_motion (struct wl_listener *listener, void *data) {
          * pointer motion event (i.e. a delta) */
         struct comp_server *server = wl_container_of (listener, server, cursor_motion);
         const struct wlr_pointer_motion_event *event = data;
+
+        const struct record_pointer_motion rec = {
+                .time_msec  = event->time_msec,
+                .delta_x    = event->delta_x,
+                .delta_y    = event->delta_y,
+                .unaccel_dx = event->unaccel_dx,
+                .unaccel_dy = event->unaccel_dy,
+        };
+        record_device_event (
+            server, &event->pointer->base, RECORD_POINTER_MOTION, &rec, sizeof (rec));
+        idle_notify_activity (server);
+
+        /* Clients using relative-pointer get the raw deltas regardless of what
+         * happens to the cursor below, both accelerated and unaccelerated. */
+        wlr_relative_pointer_manager_v1_send_relative_motion (server->relative_pointer_mgr,
+                                                              server->seat,
+                                                              (uint64_t) event->time_msec * 1000,
+                                                              event->delta_x,
+                                                              event->delta_y,
+                                                              event->unaccel_dx,
+                                                              event->unaccel_dy);
+
+        /* While the pointer is locked the cursor stays put, so there is no point
+         * in hit-testing the scene or touching the cursor image. */
+        double dx = event->delta_x, dy = event->delta_y;
+        if (!cursor_constrain_motion (server, &dx, &dy)) {
+                latency_input (
+                    server, &event->pointer->base, server->seat->pointer_state.focused_client);
+                return;
+        }
+
         /* The cursor doesn't move unless we tell it to. The cursor automatically
          * handles constraining the motion to the output layout, as well as any
          * special configuration applied for the specific input device which
          * generated the event. You can pass NULL for the device if you want to move
          * the cursor around without any input. */
-        wlr_cursor_move (server->cursor, &event->pointer->base, event->delta_x, event->delta_y);
+        wlr_cursor_move (server->cursor, &event->pointer->base, dx, dy);
+        server->stats.cursor_moves++;
         process_cursor_motion (server, event->time_msec);
+        latency_input (server, &event->pointer->base, server->seat->pointer_state.focused_client);
 }
 
 void server_cursor_motion_absolute (struct wl_listener *listener, void *data) {
@@ -197,8 +337,24 @@ void server_cursor_motion_absolute (struct wl_listener *listener, void *data) {
          * emits these events. */
         struct comp_server *server = wl_container_of (listener, server, cursor_motion_absolute);
         struct wlr_pointer_motion_absolute_event *event = data;
+
+        const struct record_pointer_motion_absolute rec = {
+                .time_msec = event->time_msec,
+                .x         = event->x,
+                .y         = event->y,
+        };
+        record_device_event (
+            server, &event->pointer->base, RECORD_POINTER_MOTION_ABSOLUTE, &rec, sizeof (rec));
+        idle_notify_activity (server);
+
+        if (server->active_constraint != NULL
+            && server->active_constraint->type == WLR_POINTER_CONSTRAINT_V1_LOCKED) {
+                return;
+        }
         wlr_cursor_warp_absolute (server->cursor, &event->pointer->base, event->x, event->y);
+        server->stats.cursor_moves++;
         process_cursor_motion (server, event->time_msec);
+        latency_input (server, &event->pointer->base, server->seat->pointer_state.focused_client);
 }
 
 void server_cursor_frame (struct wl_listener *listener, void *data) {
@@ -207,6 +363,7 @@ void server_cursor_frame (struct wl_listener *listener, void *data) {
          * multiple events together. For instance, two axis events may happen at the
          * same time, in which case a frame event won't be sent in between. */
         struct comp_server *server = wl_container_of (listener, server, cursor_frame);
+        record_event (server, RECORD_POINTER_FRAME, server->record.last_pointer_id, NULL, 0);
         /* Notify the client with pointer focus of the frame event. */
         wlr_seat_pointer_notify_frame (server->seat);
 }
\ No newline at end of file
@@ -8,6 +8,11 @@
 #include "../nwm_server.h"
 
 void reset_cursor_mode (struct comp_server *server);
+void cursor_set_xcursor (struct comp_server *server, const char *name);
+void cursor_set_surface (struct comp_server *server,
+                         struct wlr_surface *surface,
+                         int32_t             hotspot_x,
+                         int32_t             hotspot_y);
 
 void server_cursor_button (struct wl_listener *listener, void *data);
 void server_cursor_axis (struct wl_listener *listener, void *data);
@@ -3,6 +3,7 @@
 //
 
 #include "input.h"
+#include "../record.h"
 #include "keyboard.h"
 
 #include <wlr/util/log.h>
@@ -20,6 +21,7 @@ void server_new_input (struct wl_listener *listener, void *data) {
          * available. */
         struct comp_server      *server = wl_container_of (listener, server, new_input);
         struct wlr_input_device *device = data;
+        record_input_device (server, device);
         switch (device->type) {
         case WLR_INPUT_DEVICE_KEYBOARD:
                 server_new_keyboard (server, device);
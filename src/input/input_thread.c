@@ -0,0 +1,707 @@
+#define _GNU_SOURCE
+
+#include "input_thread.h"
+#include "../latency.h"
+#include "../log.h"
+#include "../nwm_server.h"
+#include "../timespec.h"
+#include "input.h"
+#include "synthetic.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libinput.h>
+#include <libudev.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <wayland-server-protocol.h>
+#include <wlr/backend/drm.h>
+#include <wlr/backend/multi.h>
+#include <wlr/backend/session.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/util/log.h>
+
+#define INPUT_THREAD_REPORT_INTERVAL_MS 10000
+#define INPUT_THREAD_NICE               -10
+
+/// Input thread
+
+static int open_restricted (const char *path, int flags, void *user_data) {
+        /* Devices are opened directly rather than through the session, which
+         * is not thread safe. This needs read access to /dev/input. */
+        const int fd = open (path, flags | O_CLOEXEC);
+        return fd < 0 ? -errno : fd;
+}
+
+static void close_restricted (int fd, void *user_data) {
+        close (fd);
+}
+
+static const struct libinput_interface libinput_impl = {
+        .open_restricted  = open_restricted,
+        .close_restricted = close_restricted,
+};
+
+static void queue_push (struct comp_input_thread *input, const struct input_thread_event *event) {
+        struct input_queue *queue = input->queue;
+        const uint32_t      tail  = atomic_load_explicit (&queue->tail, memory_order_relaxed);
+        const uint32_t      head  = atomic_load_explicit (&queue->head, memory_order_acquire);
+        if (tail - head == INPUT_QUEUE_SIZE) {
+                /* The compositor thread is stuck for a thousand events; losing
+                 * some is better than blocking the reader. */
+                atomic_fetch_add_explicit (&input->dropped, 1, memory_order_relaxed);
+                return;
+        }
+        queue->events[tail & (INPUT_QUEUE_SIZE - 1)] = *event;
+        atomic_store_explicit (&queue->tail, tail + 1, memory_order_release);
+}
+
+static void queue_wake (struct comp_input_thread *input) {
+        /* One write per batch at most: the flag stays set until the compositor
+         * thread starts draining. */
+        if (!atomic_exchange (&input->wake_pending, true)) {
+                const uint64_t one = 1;
+                if (write (input->wake_fd, &one, sizeof (one)) < 0) {
+                        wlr_log_errno (WLR_ERROR, "Input thread: failed to wake compositor");
+                }
+        }
+}
+
+static int slot_alloc (struct comp_input_thread *input) {
+        for (int i = 0; i < INPUT_THREAD_MAX_DEVICES; i++) {
+                if (!input->slots_used[i]) {
+                        input->slots_used[i] = true;
+                        return i;
+                }
+        }
+        return -1;
+}
+
+static void push_pointer_frame (struct comp_input_thread *input, struct input_thread_event *event) {
+        event->type = RECORD_POINTER_FRAME;
+        queue_push (input, event);
+}
+
+static void push_scroll (struct comp_input_thread      *input,
+                         struct input_thread_event     *event,
+                         struct libinput_event_pointer *pointer,
+                         struct libinput_device        *device,
+                         enum wl_pointer_axis_source    source) {
+        static const struct
+        {
+                enum libinput_pointer_axis axis;
+                enum wl_pointer_axis       orientation;
+        } axes[] = {
+                {  LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL,   WL_POINTER_AXIS_VERTICAL_SCROLL},
+                {LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL, WL_POINTER_AXIS_HORIZONTAL_SCROLL},
+        };
+        const bool natural = libinput_device_config_scroll_get_natural_scroll_enabled (device);
+
+        event->type = RECORD_POINTER_AXIS;
+        for (size_t i = 0; i < sizeof (axes) / sizeof (axes[0]); i++) {
+                if (!libinput_event_pointer_has_axis (pointer, axes[i].axis)) {
+                        continue;
+                }
+                event->axis.source             = source;
+                event->axis.orientation        = axes[i].orientation;
+                event->axis.relative_direction = natural ? WL_POINTER_AXIS_RELATIVE_DIRECTION_INVERTED
+                                                         : WL_POINTER_AXIS_RELATIVE_DIRECTION_IDENTICAL;
+                event->axis.delta = libinput_event_pointer_get_scroll_value (pointer, axes[i].axis);
+                event->axis.delta_discrete
+                    = source == WL_POINTER_AXIS_SOURCE_WHEEL
+                          ? (int32_t) libinput_event_pointer_get_scroll_value_v120 (pointer, axes[i].axis)
+                          : 0;
+                queue_push (input, event);
+        }
+        push_pointer_frame (input, event);
+}
+
+static void handle_event (struct comp_input_thread *input,
+                          struct libinput_event    *li_event,
+                          const struct timespec    *arrival) {
+        struct libinput_device        *device  = libinput_event_get_device (li_event);
+        struct libinput_event_pointer *pointer = libinput_event_get_pointer_event (li_event);
+        struct input_thread_event      event   = { .arrival = *arrival };
+        const intptr_t                 slot    = (intptr_t) libinput_device_get_user_data (device);
+        event.device                           = slot > 0 ? slot - 1 : 0;
+
+        switch (libinput_event_get_type (li_event)) {
+        case LIBINPUT_EVENT_DEVICE_ADDED: {
+                const bool has_pointer
+                    = libinput_device_has_capability (device, LIBINPUT_DEVICE_CAP_POINTER);
+                const bool has_keyboard
+                    = libinput_device_has_capability (device, LIBINPUT_DEVICE_CAP_KEYBOARD);
+                if (!has_pointer && !has_keyboard) {
+                        return;
+                }
+                const int new_slot = slot_alloc (input);
+                if (new_slot < 0) {
+                        wlr_log (WLR_ERROR,
+                                 "Input thread: too many devices, ignoring %s",
+                                 libinput_device_get_name (device));
+                        return;
+                }
+                /* user_data is offset by one so NULL means "not ours". */
+                libinput_device_set_user_data (device, (void *) (intptr_t) (new_slot + 1));
+                input->devices[new_slot]  = device;
+                event.type                = RECORD_DEVICE_ADD;
+                event.device              = new_slot;
+                event.device_add.pointer  = has_pointer;
+                event.device_add.keyboard = has_keyboard;
+                snprintf (event.device_add.name,
+                          sizeof (event.device_add.name),
+                          "%s",
+                          libinput_device_get_name (device));
+                queue_push (input, &event);
+                return;
+        }
+        case LIBINPUT_EVENT_DEVICE_REMOVED:
+                if (slot == 0) {
+                        return;
+                }
+                input->slots_used[slot - 1] = false;
+                input->devices[slot - 1]    = NULL;
+                libinput_device_set_user_data (device, NULL);
+                event.type = RECORD_DEVICE_REMOVE;
+                queue_push (input, &event);
+                return;
+        default:
+                break;
+        }
+
+        if (slot == 0) {
+                return;
+        }
+
+        switch (libinput_event_get_type (li_event)) {
+        case LIBINPUT_EVENT_POINTER_MOTION:
+                event.type              = RECORD_POINTER_MOTION;
+                event.motion.time_msec  = libinput_event_pointer_get_time_usec (pointer) / 1000;
+                event.motion.delta_x    = libinput_event_pointer_get_dx (pointer);
+                event.motion.delta_y    = libinput_event_pointer_get_dy (pointer);
+                event.motion.unaccel_dx = libinput_event_pointer_get_dx_unaccelerated (pointer);
+                event.motion.unaccel_dy = libinput_event_pointer_get_dy_unaccelerated (pointer);
+                queue_push (input, &event);
+                push_pointer_frame (input, &event);
+                break;
+        case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+                event.type = RECORD_POINTER_MOTION_ABSOLUTE;
+                event.motion_absolute.time_msec
+                    = libinput_event_pointer_get_time_usec (pointer) / 1000;
+                event.motion_absolute.x = libinput_event_pointer_get_absolute_x_transformed (pointer, 1);
+                event.motion_absolute.y = libinput_event_pointer_get_absolute_y_transformed (pointer, 1);
+                queue_push (input, &event);
+                push_pointer_frame (input, &event);
+                break;
+        case LIBINPUT_EVENT_POINTER_BUTTON:
+                event.type             = RECORD_POINTER_BUTTON;
+                event.button.time_msec = libinput_event_pointer_get_time_usec (pointer) / 1000;
+                event.button.button    = libinput_event_pointer_get_button (pointer);
+                event.button.state = libinput_event_pointer_get_button_state (pointer)
+                                             == LIBINPUT_BUTTON_STATE_PRESSED
+                                         ? WL_POINTER_BUTTON_STATE_PRESSED
+                                         : WL_POINTER_BUTTON_STATE_RELEASED;
+                queue_push (input, &event);
+                push_pointer_frame (input, &event);
+                break;
+        case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+                event.axis.time_msec = libinput_event_pointer_get_time_usec (pointer) / 1000;
+                push_scroll (input, &event, pointer, device, WL_POINTER_AXIS_SOURCE_WHEEL);
+                break;
+        case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+                event.axis.time_msec = libinput_event_pointer_get_time_usec (pointer) / 1000;
+                push_scroll (input, &event, pointer, device, WL_POINTER_AXIS_SOURCE_FINGER);
+                break;
+        case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+                event.axis.time_msec = libinput_event_pointer_get_time_usec (pointer) / 1000;
+                push_scroll (input, &event, pointer, device, WL_POINTER_AXIS_SOURCE_CONTINUOUS);
+                break;
+        case LIBINPUT_EVENT_KEYBOARD_KEY: {
+                struct libinput_event_keyboard *keyboard
+                    = libinput_event_get_keyboard_event (li_event);
+                event.type          = RECORD_KEYBOARD_KEY;
+                event.key.time_msec = libinput_event_keyboard_get_time_usec (keyboard) / 1000;
+                event.key.keycode   = libinput_event_keyboard_get_key (keyboard);
+                event.key.state     = libinput_event_keyboard_get_key_state (keyboard)
+                                              == LIBINPUT_KEY_STATE_PRESSED
+                                          ? WL_KEYBOARD_KEY_STATE_PRESSED
+                                          : WL_KEYBOARD_KEY_STATE_RELEASED;
+                queue_push (input, &event);
+                break;
+        }
+        default:
+                /* Touch, tablets, gestures and switches are left out. */
+                break;
+        }
+}
+
+static void input_thread_read (struct comp_input_thread *input) {
+        /* The arrival stamp is taken once per batch, right after the wakeup:
+         * the earliest point userspace knows about the events. */
+        struct timespec arrival;
+        clock_gettime (CLOCK_MONOTONIC, &arrival);
+
+        if (libinput_dispatch (input->libinput) != 0) {
+                wlr_log (WLR_ERROR, "Input thread: libinput_dispatch failed");
+                return;
+        }
+        struct libinput_event *li_event;
+        while ((li_event = libinput_get_event (input->libinput)) != NULL) {
+                handle_event (input, li_event, &arrival);
+                libinput_event_destroy (li_event);
+        }
+        queue_wake (input);
+}
+
+static void input_thread_update_leds (struct comp_input_thread *input) {
+        /* LED changes are handed over by dispatch_led_update, libinput is
+         * only ever touched from this thread. */
+        uint64_t count;
+        if (read (input->led_fd, &count, sizeof (count)) < 0 && errno != EAGAIN) {
+                wlr_log_errno (WLR_ERROR, "Input thread: failed to read LED wakeup");
+        }
+        const uint64_t pending
+            = atomic_exchange_explicit (&input->leds_pending, 0, memory_order_acquire);
+        for (int i = 0; i < INPUT_THREAD_MAX_DEVICES; i++) {
+                if (!(pending & (UINT64_C (1) << i)) || input->devices[i] == NULL) {
+                        continue;
+                }
+                enum libinput_led led  = 0;
+                const uint32_t    leds = atomic_load_explicit (&input->leds[i],
+                                                               memory_order_relaxed);
+                if (leds & WLR_LED_NUM_LOCK) {
+                        led |= LIBINPUT_LED_NUM_LOCK;
+                }
+                if (leds & WLR_LED_CAPS_LOCK) {
+                        led |= LIBINPUT_LED_CAPS_LOCK;
+                }
+                if (leds & WLR_LED_SCROLL_LOCK) {
+                        led |= LIBINPUT_LED_SCROLL_LOCK;
+                }
+                libinput_device_led_update (input->devices[i], led);
+        }
+}
+
+static void input_thread_raise_priority (void) {
+        /* Real-time if we are allowed to, a lower nice value otherwise. The
+         * thread sleeps in poll almost all the time, so either is harmless. */
+        struct sched_param param = { .sched_priority = sched_get_priority_min (SCHED_FIFO) };
+        if (pthread_setschedparam (pthread_self (), SCHED_FIFO, &param) == 0) {
+                wlr_log (WLR_INFO, "Input thread: running with SCHED_FIFO");
+                return;
+        }
+        if (setpriority (PRIO_PROCESS, gettid (), INPUT_THREAD_NICE) == 0) {
+                wlr_log (WLR_INFO, "Input thread: running at nice %d", INPUT_THREAD_NICE);
+                return;
+        }
+        wlr_log (WLR_INFO, "Input thread: no permission to raise priority, running at default");
+}
+
+static void *input_thread_main (void *data) {
+        struct comp_input_thread *input = data;
+        input_thread_raise_priority ();
+
+        struct pollfd fds[] = {
+                { .fd = libinput_get_fd (input->libinput), .events = POLLIN },
+                { .fd = input->stop_fd, .events = POLLIN },
+                { .fd = input->led_fd, .events = POLLIN },
+        };
+        while (true) {
+                if (poll (fds, 3, -1) < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        wlr_log_errno (WLR_ERROR, "Input thread: poll failed");
+                        break;
+                }
+                if (fds[1].revents != 0) {
+                        break;
+                }
+                if (fds[0].revents != 0) {
+                        input_thread_read (input);
+                }
+                if (fds[2].revents != 0) {
+                        input_thread_update_leds (input);
+                }
+        }
+        return NULL;
+}
+
+/// Compositor thread
+
+static void dispatch_led_update (struct wlr_keyboard *keyboard, uint32_t leds, void *data) {
+        /* Passed on to the input thread, which owns the libinput device. */
+        struct comp_input_thread *input = data;
+        for (int i = 0; i < INPUT_THREAD_MAX_DEVICES; i++) {
+                if (input->slots[i].keyboard != keyboard) {
+                        continue;
+                }
+                atomic_store_explicit (&input->leds[i], leds, memory_order_relaxed);
+                atomic_fetch_or_explicit (
+                    &input->leds_pending, UINT64_C (1) << i, memory_order_release);
+                const uint64_t one = 1;
+                if (write (input->led_fd, &one, sizeof (one)) < 0) {
+                        wlr_log_errno (WLR_ERROR, "Input thread: failed to pass on LED update");
+                }
+                return;
+        }
+}
+
+static void dispatch_device_add (struct comp_input_thread        *input,
+                                 const struct input_thread_event *event) {
+        struct comp_server                   *server = input->server;
+        struct input_thread_slot             *slot   = &input->slots[event->device];
+        const struct input_thread_device_add *add    = &event->device_add;
+
+        /* A libinput device with both capabilities shows up as two wlroots
+         * devices, the way the libinput backend does it. */
+        if (add->pointer) {
+                slot->pointer = synthetic_pointer_create (add->name);
+                server_new_input (&server->new_input, &slot->pointer->base);
+        }
+        if (add->keyboard) {
+                slot->keyboard = synthetic_keyboard_create (add->name, dispatch_led_update, input);
+                server_new_input (&server->new_input, &slot->keyboard->base);
+        }
+}
+
+static void dispatch_device_remove (struct input_thread_slot *slot) {
+        if (slot->pointer != NULL) {
+                synthetic_pointer_destroy (slot->pointer);
+                slot->pointer = NULL;
+        }
+        if (slot->keyboard != NULL) {
+                synthetic_keyboard_destroy (slot->keyboard);
+                slot->keyboard = NULL;
+        }
+}
+
+static void dispatch_event (struct comp_input_thread        *input,
+                            const struct input_thread_event *event) {
+        struct input_thread_slot *slot     = &input->slots[event->device];
+        struct wlr_pointer       *pointer  = slot->pointer;
+        struct wlr_keyboard      *keyboard = slot->keyboard;
+
+        switch (event->type) {
+        case RECORD_DEVICE_ADD:
+                dispatch_device_add (input, event);
+                return;
+        case RECORD_DEVICE_REMOVE:
+                dispatch_device_remove (slot);
+                return;
+        default:
+                break;
+        }
+
+        /* While switched to another VT the session is inactive; the kernel
+         * keeps delivering to us since we opened the devices ourselves. */
+        if (input->session != NULL && !input->session->active) {
+                return;
+        }
+
+        switch (event->type) {
+        case RECORD_POINTER_MOTION:
+                if (pointer != NULL) {
+                        struct wlr_pointer_motion_event motion = {
+                                .pointer    = pointer,
+                                .time_msec  = event->motion.time_msec,
+                                .delta_x    = event->motion.delta_x,
+                                .delta_y    = event->motion.delta_y,
+                                .unaccel_dx = event->motion.unaccel_dx,
+                                .unaccel_dy = event->motion.unaccel_dy,
+                        };
+                        wl_signal_emit_mutable (&pointer->events.motion, &motion);
+                }
+                break;
+        case RECORD_POINTER_MOTION_ABSOLUTE:
+                if (pointer != NULL) {
+                        struct wlr_pointer_motion_absolute_event motion = {
+                                .pointer   = pointer,
+                                .time_msec = event->motion_absolute.time_msec,
+                                .x         = event->motion_absolute.x,
+                                .y         = event->motion_absolute.y,
+                        };
+                        wl_signal_emit_mutable (&pointer->events.motion_absolute, &motion);
+                }
+                break;
+        case RECORD_POINTER_BUTTON:
+                if (pointer != NULL) {
+                        struct wlr_pointer_button_event button = {
+                                .pointer   = pointer,
+                                .time_msec = event->button.time_msec,
+                                .button    = event->button.button,
+                                .state     = event->button.state,
+                        };
+                        wl_signal_emit_mutable (&pointer->events.button, &button);
+                }
+                break;
+        case RECORD_POINTER_AXIS:
+                if (pointer != NULL) {
+                        struct wlr_pointer_axis_event axis = {
+                                .pointer            = pointer,
+                                .time_msec          = event->axis.time_msec,
+                                .source             = event->axis.source,
+                                .orientation        = event->axis.orientation,
+                                .relative_direction = event->axis.relative_direction,
+                                .delta              = event->axis.delta,
+                                .delta_discrete     = event->axis.delta_discrete,
+                        };
+                        wl_signal_emit_mutable (&pointer->events.axis, &axis);
+                }
+                break;
+        case RECORD_POINTER_FRAME:
+                if (pointer != NULL) {
+                        wl_signal_emit_mutable (&pointer->events.frame, pointer);
+                }
+                break;
+        case RECORD_KEYBOARD_KEY:
+                if (keyboard != NULL) {
+                        struct wlr_keyboard_key_event key = {
+                                .time_msec    = event->key.time_msec,
+                                .keycode      = event->key.keycode,
+                                .update_state = true,
+                                .state        = event->key.state,
+                        };
+                        wlr_keyboard_notify_key (keyboard, &key);
+                }
+                break;
+        default:
+                break;
+        }
+}
+
+static void input_thread_drain (struct comp_input_thread *input) {
+        struct comp_server *server = input->server;
+        struct input_queue *queue  = input->queue;
+
+        /* Clear the flag before looking at the queue, so an event pushed
+         * while we drain either gets drained now or wakes us up again. */
+        atomic_store (&input->wake_pending, false);
+
+        uint32_t       head = atomic_load_explicit (&queue->head, memory_order_relaxed);
+        const uint32_t tail = atomic_load_explicit (&queue->tail, memory_order_acquire);
+        if (head == tail) {
+                return;
+        }
+        histogram_add (&input->depth, tail - head);
+
+        struct timespec now;
+        for (; head != tail; head++) {
+                const struct input_thread_event *event = &queue->events[head & (INPUT_QUEUE_SIZE - 1)];
+
+                clock_gettime (CLOCK_MONOTONIC, &now);
+                histogram_add (&input->handoff, timespec_diff_usec (&now, &event->arrival));
+
+                /* Latency samples start at the arrival stamp, not here. */
+                server->latency.input_arrival = &event->arrival;
+                dispatch_event (input, event);
+                server->latency.input_arrival = NULL;
+
+                atomic_store_explicit (&queue->head, head + 1, memory_order_release);
+        }
+}
+
+void input_thread_dispatch (struct comp_server *server) {
+        /* Called by server_run every time the loop wakes up. The wake fd is
+         * still read by its own source, which then finds the queue empty. */
+        if (server->input_thread.enabled && server->input_thread.running) {
+                input_thread_drain (&server->input_thread);
+        }
+}
+
+static int input_thread_wake_notify (int fd, uint32_t mask, void *data) {
+        struct comp_server *server = data;
+        uint64_t            count;
+        if (read (fd, &count, sizeof (count)) < 0 && errno != EAGAIN) {
+                wlr_log_errno (WLR_ERROR, "Input thread: failed to read wakeup");
+        }
+        input_thread_drain (&server->input_thread);
+        return 0;
+}
+
+static void input_thread_report (struct comp_input_thread *input) {
+        log_histogram (&input->handoff, "input thread hand-off");
+        if (input->depth.count == 0) {
+                return;
+        }
+        wlr_log (WLR_INFO,
+                 "input thread queue depth: avg=%.1f p50=%lu p99=%lu max=%lu dropped=%lu",
+                 (double) input->depth.sum / input->depth.count,
+                 (unsigned long) histogram_percentile (&input->depth, 50),
+                 (unsigned long) histogram_percentile (&input->depth, 99),
+                 (unsigned long) input->depth.max,
+                 (unsigned long) atomic_load (&input->dropped));
+}
+
+static int input_thread_timer_notify (void *data) {
+        struct comp_server *server = data;
+        input_thread_report (&server->input_thread);
+        wl_event_source_timer_update (server->input_thread.timer, INPUT_THREAD_REPORT_INTERVAL_MS);
+        return 0;
+}
+
+bool input_thread_open (struct comp_server *server) {
+        /* Called before the backend exists. Succeeds only if there is real
+         * hardware we can read ourselves; the libinput backend is then left
+         * out so devices are not read twice. On failure nwm just runs with
+         * the libinput backend as usual. */
+        struct comp_input_thread *input = &server->input_thread;
+        input->server                   = server;
+
+        if (getenv ("WAYLAND_DISPLAY") != NULL || getenv ("DISPLAY") != NULL) {
+                wlr_log (WLR_INFO, "Input thread: nested session, input comes from the parent");
+                input->enabled = false;
+                return false;
+        }
+
+        input->udev = udev_new ();
+        if (input->udev == NULL) {
+                wlr_log (WLR_ERROR, "Input thread: failed to create udev context");
+                input->enabled = false;
+                return false;
+        }
+        input->libinput = libinput_udev_create_context (&libinput_impl, NULL, input->udev);
+        const char *seat = getenv ("XDG_SEAT") != NULL ? getenv ("XDG_SEAT") : "seat0";
+        if (input->libinput == NULL || libinput_udev_assign_seat (input->libinput, seat) != 0) {
+                wlr_log (WLR_ERROR, "Input thread: failed to set up libinput on %s", seat);
+                goto fail;
+        }
+
+        input->queue = aligned_alloc (_Alignof (struct input_queue), sizeof (struct input_queue));
+        atomic_init (&input->queue->head, 0);
+        atomic_init (&input->queue->tail, 0);
+        atomic_init (&input->wake_pending, false);
+        atomic_init (&input->dropped, 0);
+        atomic_init (&input->leds_pending, 0);
+        input->wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+        input->stop_fd = eventfd (0, EFD_CLOEXEC);
+        input->led_fd  = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+
+        /* Initial devices are queued here, before the thread exists, and
+         * created once the event loop runs. */
+        input_thread_read (input);
+        bool have_devices = false;
+        for (int i = 0; i < INPUT_THREAD_MAX_DEVICES; i++) {
+                have_devices |= input->slots_used[i];
+        }
+        if (!have_devices) {
+                wlr_log (WLR_ERROR,
+                         "Input thread: no readable input devices (is the user in the input "
+                         "group?), falling back to the libinput backend");
+                close (input->wake_fd);
+                close (input->stop_fd);
+                close (input->led_fd);
+                free (input->queue);
+                input->queue = NULL;
+                goto fail;
+        }
+
+        return true;
+
+fail:
+        if (input->libinput != NULL) {
+                libinput_unref (input->libinput);
+                input->libinput = NULL;
+        }
+        udev_unref (input->udev);
+        input->udev    = NULL;
+        input->enabled = false;
+        return false;
+}
+
+#define INPUT_THREAD_MAX_GPUS 8
+
+struct wlr_backend *input_thread_backend_create (struct comp_server *server, struct wlr_session **session_out) {
+        /* What wlr_backend_autocreate builds with WLR_BACKENDS=drm, without
+         * setting it: that would be inherited by every client and child, and
+         * a nested compositor started from nwm would then look for a GPU. The
+         * first GPU found is the primary one, the others render through it. */
+        struct wlr_session *session = wlr_session_create (server->wl_event_loop);
+        if (session == NULL) {
+                wlr_log (WLR_ERROR, "Input thread: failed to start a session");
+                return NULL;
+        }
+        struct wlr_device *gpus[INPUT_THREAD_MAX_GPUS];
+        const ssize_t      ngpus = wlr_session_find_gpus (session, INPUT_THREAD_MAX_GPUS, gpus);
+        if (ngpus <= 0) {
+                wlr_log (WLR_ERROR, "Input thread: no GPU found");
+                wlr_session_destroy (session);
+                return NULL;
+        }
+
+        struct wlr_backend *multi   = wlr_multi_backend_create (server->wl_event_loop);
+        struct wlr_backend *primary = NULL;
+        for (ssize_t i = 0; i < ngpus; i++) {
+                struct wlr_backend *drm = wlr_drm_backend_create (session, gpus[i], primary);
+                if (drm == NULL) {
+                        wlr_log (WLR_ERROR, "Input thread: failed to open DRM device %zd", i);
+                        continue;
+                }
+                primary = primary != NULL ? primary : drm;
+                wlr_multi_backend_add (multi, drm);
+        }
+        if (primary == NULL) {
+                wlr_backend_destroy (multi);
+                wlr_session_destroy (session);
+                return NULL;
+        }
+        *session_out = session;
+        return multi;
+}
+
+void input_thread_start (struct comp_server *server, struct wlr_session *session) {
+        struct comp_input_thread *input = &server->input_thread;
+        if (!input->enabled) {
+                return;
+        }
+        input->session     = session;
+        input->wake_source = wl_event_loop_add_fd (
+            server->wl_event_loop, input->wake_fd, WL_EVENT_READABLE, input_thread_wake_notify, server);
+        input->timer = wl_event_loop_add_timer (server->wl_event_loop, input_thread_timer_notify, server);
+        wl_event_source_timer_update (input->timer, INPUT_THREAD_REPORT_INTERVAL_MS);
+
+        if (pthread_create (&input->thread, NULL, input_thread_main, input) != 0) {
+                wlr_log (WLR_ERROR, "Input thread: failed to start, no input will be read");
+                return;
+        }
+        input->running = true;
+        pthread_setname_np (input->thread, "nwm-input");
+
+        /* The devices found in input_thread_open are already queued. */
+        input_thread_drain (input);
+        wlr_log (WLR_INFO, "Input thread started");
+}
+
+void input_thread_finish (struct comp_server *server) {
+        struct comp_input_thread *input = &server->input_thread;
+        if (!input->enabled) {
+                return;
+        }
+        if (input->running) {
+                const uint64_t one = 1;
+                if (write (input->stop_fd, &one, sizeof (one)) < 0) {
+                        wlr_log_errno (WLR_ERROR, "Input thread: failed to signal stop");
+                }
+                pthread_join (input->thread, NULL);
+        }
+
+        wl_event_source_remove (input->timer);
+        wl_event_source_remove (input->wake_source);
+        input_thread_report (input);
+
+        for (int i = 0; i < INPUT_THREAD_MAX_DEVICES; i++) {
+                dispatch_device_remove (&input->slots[i]);
+        }
+        libinput_unref (input->libinput);
+        udev_unref (input->udev);
+        close (input->wake_fd);
+        close (input->stop_fd);
+        close (input->led_fd);
+        free (input->queue);
+}
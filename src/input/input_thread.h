@@ -0,0 +1,109 @@
+#ifndef COMP_INPUT_THREAD_H
+#define COMP_INPUT_THREAD_H
+
+#include "../histogram.h"
+#include "../record.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <wayland-server-core.h>
+
+struct comp_server;
+struct libinput_device;
+struct wlr_backend;
+struct wlr_keyboard;
+struct wlr_pointer;
+struct wlr_session;
+
+#define INPUT_QUEUE_SIZE         1024 // power of two
+#define INPUT_THREAD_MAX_DEVICES 64   // one bit each in comp_input_thread::leds_pending
+
+struct input_thread_device_add
+{
+        bool pointer;
+        bool keyboard;
+        char name[64];
+};
+
+/** One event handed from the input thread to the compositor thread. The
+ * payloads are the ones --record writes, so both paths inject the same way. */
+struct input_thread_event
+{
+        uint8_t         type;    // enum record_type
+        uint8_t         device;  // slot in comp_input_thread::devices
+        struct timespec arrival; // CLOCK_MONOTONIC, when the input thread woke up
+        union
+        {
+                struct input_thread_device_add        device_add;
+                struct record_pointer_motion          motion;
+                struct record_pointer_motion_absolute motion_absolute;
+                struct record_pointer_button          button;
+                struct record_pointer_axis            axis;
+                struct record_keyboard_key            key;
+        };
+};
+
+/** Single producer, single consumer ring. head and tail only ever grow and
+ * sit on their own cache lines, so the two threads never share a written
+ * line except for the events themselves. */
+struct input_queue
+{
+        _Alignas (64) _Atomic uint32_t head; // next event to read, compositor thread
+        _Alignas (64) _Atomic uint32_t tail; // next slot to write, input thread
+        _Alignas (64) struct input_thread_event events[INPUT_QUEUE_SIZE];
+};
+
+struct input_thread_slot
+{
+        struct wlr_pointer  *pointer;
+        struct wlr_keyboard *keyboard;
+};
+
+/** Optional input thread. libinput is read on its own high priority thread,
+ * every batch is timestamped as soon as poll returns and pushed onto a
+ * lock-free queue. The compositor thread is woken through an eventfd and
+ * drains the queue into synthetic devices first thing after every wakeup, see
+ * server_run, so a slow frame or client handler delays input delivery
+ * but no longer its timestamps or its reading off the kernel. */
+struct comp_input_thread
+{
+        bool enabled;
+
+        /* Input thread only. */
+        struct libinput        *libinput;
+        struct udev            *udev;
+        int                     stop_fd;
+        bool                    slots_used[INPUT_THREAD_MAX_DEVICES];
+        struct libinput_device *devices[INPUT_THREAD_MAX_DEVICES];
+
+        /* Shared. */
+        struct input_queue *queue;
+        int                 wake_fd;
+        _Atomic bool        wake_pending;
+        _Atomic uint64_t    dropped;
+        int                 led_fd;       // wakes the input thread for LED updates
+        _Atomic uint64_t    leds_pending; // one bit per slot
+        _Atomic uint32_t    leds[INPUT_THREAD_MAX_DEVICES];
+
+        /* Compositor thread only. */
+        pthread_t                thread;
+        bool                     running;
+        struct comp_server      *server;
+        struct wl_event_source  *wake_source;
+        struct wl_event_source  *timer;
+        struct wlr_session      *session;
+        struct input_thread_slot slots[INPUT_THREAD_MAX_DEVICES];
+        struct histogram         handoff; // arrival -> dispatched to the seat, usec
+        struct histogram         depth;   // queue depth seen at each drain
+};
+
+bool                input_thread_open (struct comp_server *server);
+struct wlr_backend *input_thread_backend_create (struct comp_server *server, struct wlr_session **session);
+void                input_thread_start (struct comp_server *server, struct wlr_session *session);
+void                input_thread_finish (struct comp_server *server);
+void                input_thread_dispatch (struct comp_server *server);
+
+#endif // COMP_INPUT_THREAD_H
@@ -3,6 +3,13 @@
 //
 
 #include "keyboard.h"
+#include "../alloc.h"
+#include "../animation.h"
+#include "../focus.h"
+#include "../idle.h"
+#include "../latency.h"
+#include "../overview.h"
+#include "../record.h"
 #include "../xdg_shell.h"
 
 #include <stdlib.h>
@@ -33,10 +40,15 @@ void keyboard_focus_toplevel (struct toplevel *toplevel, struct wlr_surface *sur
                 }
         }
         struct wlr_keyboard *keyboard = wlr_seat_get_keyboard (seat);
-        /* Move the toplevel to the front */
-        wlr_scene_node_raise_to_top (&toplevel->scene_tree->node);
-        wl_list_remove (&toplevel->link);
-        wl_list_insert (&server->toplevels, &toplevel->link);
+        /* Move the toplevel to the front, easing it in when it was covered.
+         * The front of the MRU list is always on top, so a toplevel that is
+         * already there needs no restacking, and no repaint. */
+        if (focus_raise (toplevel)) {
+                if (prev_surface != NULL) {
+                        animation_opacity (server, &toplevel->scene_tree->node, 0.8f, 1.0f, ANIMATION_FOCUS_MS);
+                }
+                wlr_scene_node_raise_to_top (&toplevel->scene_tree->node);
+        }
         /* Activate the new surface */
         wlr_xdg_toplevel_set_activated (toplevel->xdg_toplevel, true);
         /*
@@ -79,16 +91,18 @@ static bool handle_keybinding (struct comp_server *server, xkb_keysym_t sym) {
          */
         switch (sym) {
         case XKB_KEY_Escape:
-                wl_display_terminate (server->wl_display);
+                server_terminate (server);
                 break;
         case XKB_KEY_F1:
                 /* Cycle to the next toplevel */
-                if (wl_list_length (&server->toplevels) < 2) {
-                        break;
-                }
-                struct toplevel *next_toplevel
-                    = wl_container_of (server->toplevels.prev, next_toplevel, link);
-                keyboard_focus_toplevel (next_toplevel, next_toplevel->xdg_toplevel->base->surface);
+                focus_cycle (server, true);
+                break;
+        case XKB_KEY_F2:
+                /* And back */
+                focus_cycle (server, false);
+                break;
+        case XKB_KEY_F3:
+                overview_set_active (server, !server->overview.active);
                 break;
         default:
                 return false;
@@ -103,6 +117,15 @@ static void keyboard_handle_key (struct wl_listener *listener, void *data) {
         struct wlr_keyboard_key_event *event    = data;
         struct wlr_seat               *seat     = server->seat;
 
+        const struct record_keyboard_key rec = {
+                .time_msec = event->time_msec,
+                .keycode   = event->keycode,
+                .state     = event->state,
+        };
+        record_device_event (
+            server, &keyboard->wlr_keyboard->base, RECORD_KEYBOARD_KEY, &rec, sizeof (rec));
+        idle_notify_activity (server);
+
         /* Translate libinput keycode -> xkbcommon */
         uint32_t            keycode = event->keycode + 8;
         /* Get a list of keysyms based on the keymap for this keyboard */
@@ -123,6 +146,8 @@ static void keyboard_handle_key (struct wl_listener *listener, void *data) {
                 /* Otherwise, we pass it along to the client. */
                 wlr_seat_set_keyboard (seat, keyboard->wlr_keyboard);
                 wlr_seat_keyboard_notify_key (seat, event->time_msec, event->keycode, event->state);
+                latency_input (
+                    server, &keyboard->wlr_keyboard->base, seat->keyboard_state.focused_client);
         }
 }
 
@@ -136,13 +161,13 @@ static void keyboard_handle_destroy (struct wl_listener *listener, void *data) {
         wl_list_remove (&keyboard->key.link);
         wl_list_remove (&keyboard->destroy.link);
         wl_list_remove (&keyboard->link);
-        free (keyboard);
+        nwm_free (keyboard);
 }
 
 void server_new_keyboard (struct comp_server *server, struct wlr_input_device *device) {
         struct wlr_keyboard *wlr_keyboard = wlr_keyboard_from_input_device (device);
 
-        struct keyboard *keyboard = calloc (1, sizeof (*keyboard));
+        struct keyboard *keyboard = nwm_alloc (ALLOC_INPUT, struct keyboard);
         keyboard->server          = server;
         keyboard->wlr_keyboard    = wlr_keyboard;
 
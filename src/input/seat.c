@@ -3,6 +3,7 @@
 //
 
 #include "seat.h"
+#include "cursor.h"
 
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_seat.h>
@@ -19,8 +20,7 @@ void seat_request_cursor (struct wl_listener *listener, void *data) {
                  * provided surface as the cursor image. It will set the hardware cursor
                  * on the output that it's currently on and continue to do so as the
                  * cursor moves between outputs. */
-                wlr_cursor_set_surface (
-                    server->cursor, event->surface, event->hotspot_x, event->hotspot_y);
+                cursor_set_surface (server, event->surface, event->hotspot_x, event->hotspot_y);
         }
 }
 
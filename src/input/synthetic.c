@@ -0,0 +1,57 @@
+#include "synthetic.h"
+#include "../alloc.h"
+
+#include <stdlib.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_pointer.h>
+
+struct synthetic_keyboard
+{
+        struct wlr_keyboard base;
+        synthetic_led_func  led_update; // may be NULL
+        void               *data;
+};
+
+static void synthetic_keyboard_led_update (struct wlr_keyboard *wlr_keyboard, uint32_t leds) {
+        struct synthetic_keyboard *keyboard = wl_container_of (wlr_keyboard, keyboard, base);
+        if (keyboard->led_update != NULL) {
+                keyboard->led_update (wlr_keyboard, leds, keyboard->data);
+        }
+}
+
+static const struct wlr_pointer_impl synthetic_pointer_impl = {
+        .name = "nwm-synthetic-pointer",
+};
+
+static const struct wlr_keyboard_impl synthetic_keyboard_impl = {
+        .name       = "nwm-synthetic-keyboard",
+        .led_update = synthetic_keyboard_led_update,
+};
+
+struct wlr_pointer *synthetic_pointer_create (const char *name) {
+        struct wlr_pointer *pointer = nwm_alloc (ALLOC_INPUT, struct wlr_pointer);
+        wlr_pointer_init (pointer, &synthetic_pointer_impl, name);
+        return pointer;
+}
+
+struct wlr_keyboard *synthetic_keyboard_create (const char        *name,
+                                                synthetic_led_func led_update,
+                                                void              *data) {
+        struct synthetic_keyboard *keyboard = nwm_alloc (ALLOC_INPUT, struct synthetic_keyboard);
+        keyboard->led_update                = led_update;
+        keyboard->data                      = data;
+        wlr_keyboard_init (&keyboard->base, &synthetic_keyboard_impl, name);
+        return &keyboard->base;
+}
+
+void synthetic_pointer_destroy (struct wlr_pointer *pointer) {
+        /* Emits the base device destroy signal, so listeners clean up first. */
+        wlr_pointer_finish (pointer);
+        nwm_free (pointer);
+}
+
+void synthetic_keyboard_destroy (struct wlr_keyboard *wlr_keyboard) {
+        struct synthetic_keyboard *keyboard = wl_container_of (wlr_keyboard, keyboard, base);
+        wlr_keyboard_finish (wlr_keyboard);
+        nwm_free (keyboard);
+}
@@ -0,0 +1,21 @@
+#ifndef SYNTHETIC_H
+#define SYNTHETIC_H
+
+#include <wlr/types/wlr_keyboard.h>
+#include <wlr/types/wlr_pointer.h>
+
+/* Input devices that are not backed by any backend. Events are injected by
+ * emitting on the device's signals directly, exactly like a backend would, so
+ * the rest of nwm cannot tell them apart from real hardware. */
+/* Called when the seat changes a synthetic keyboard's LEDs (enum wlr_keyboard_led),
+ * so they can be passed on to whatever hardware the events come from. */
+typedef void (*synthetic_led_func) (struct wlr_keyboard *keyboard, uint32_t leds, void *data);
+
+struct wlr_pointer  *synthetic_pointer_create (const char *name);
+struct wlr_keyboard *synthetic_keyboard_create (const char        *name,
+                                                synthetic_led_func led_update,
+                                                void              *data);
+void                 synthetic_pointer_destroy (struct wlr_pointer *pointer);
+void                 synthetic_keyboard_destroy (struct wlr_keyboard *keyboard);
+
+#endif // SYNTHETIC_H
@@ -0,0 +1,482 @@
+#define _GNU_SOURCE
+
+#include "ipc.h"
+#include "animation.h"
+#include "damage_vis.h"
+#include "focus.h"
+#include "histogram.h"
+#include "input/keyboard.h"
+#include "log.h"
+#include "nwm_server.h"
+#include "output.h"
+#include "perf_overlay.h"
+#include "virtual_output.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+#define IPC_LINE_MAX 1024
+#define IPC_MAX_ARGS 16
+
+struct ipc_client
+{
+        struct wl_list          link;
+        struct comp_server     *server;
+        int                     fd;
+        struct wl_event_source *source;
+        size_t                  len;
+        char                    buf[IPC_LINE_MAX];
+};
+
+/** Returns false on bad usage; the reply then holds the reason. */
+typedef bool (*ipc_handler) (struct comp_server *server,
+                             int                 argc,
+                             char              **argv,
+                             struct ipc_reply   *reply);
+
+struct ipc_command
+{
+        const char *name;
+        const char *usage;
+        ipc_handler handler;
+};
+
+static bool ipc_help (struct comp_server *server, int argc, char **argv, struct ipc_reply *reply);
+
+static bool ipc_log (struct comp_server *server, int argc, char **argv, struct ipc_reply *reply) {
+        /* log                    list the level of every subsystem
+         * log SUBSYSTEM LEVEL    change one; SUBSYSTEM may be "all" */
+        if (argc == 1) {
+                for (int i = 0; i < LOG_SUBSYSTEM_COUNT; i++) {
+                        ipc_reply_printf (reply,
+                                          "%s %s\n",
+                                          log_subsystem_name (i),
+                                          log_level_name (log_get_level (i)));
+                }
+                return true;
+        }
+        if (argc != 3) {
+                ipc_reply_printf (reply, "expected a subsystem and a level");
+                return false;
+        }
+        if (!log_set_level (argv[1], argv[2])) {
+                ipc_reply_printf (reply, "unknown subsystem or level");
+                return false;
+        }
+        wlr_log (WLR_INFO, "Log level of %s set to %s", argv[1], argv[2]);
+        return true;
+}
+
+static bool parse_toggle (const char *arg, bool current, bool *value) {
+        if (strcmp (arg, "on") == 0) {
+                *value = true;
+        } else if (strcmp (arg, "off") == 0) {
+                *value = false;
+        } else if (strcmp (arg, "toggle") == 0) {
+                *value = !current;
+        } else {
+                return false;
+        }
+        return true;
+}
+
+static bool ipc_animations (struct comp_server *server, int argc, char **argv, struct ipc_reply *reply) {
+        /* animations                 show whether windows animate
+         * animations on|off|toggle   change it */
+        bool enabled = server->animation.enabled;
+        if (argc > 2 || (argc == 2 && !parse_toggle (argv[1], enabled, &enabled))) {
+                ipc_reply_printf (reply, "expected on, off or toggle");
+                return false;
+        }
+        animation_set_enabled (server, enabled);
+        ipc_reply_printf (reply, "animations %s\n", enabled ? "on" : "off");
+        return true;
+}
+
+static bool ipc_damage (struct comp_server *server, int argc, char **argv, struct ipc_reply *reply) {
+        /* damage                 show whether damage is being visualized
+         * damage on|off|toggle   change it */
+        bool enabled = server->damage_vis.enabled;
+        if (argc > 2 || (argc == 2 && !parse_toggle (argv[1], enabled, &enabled))) {
+                ipc_reply_printf (reply, "expected on, off or toggle");
+                return false;
+        }
+        damage_vis_set_enabled (server, enabled);
+        ipc_reply_printf (reply, "damage %s\n", enabled ? "on" : "off");
+        return true;
+}
+
+static bool ipc_focus (struct comp_server *server, int argc, char **argv, struct ipc_reply *reply) {
+        /* focus             show the focused toplevel and how many are mapped
+         * focus next|prev   cycle through them
+         * focus ID          focus the toplevel with that ID
+         * focus @N          focus the Nth most recently used, @0 being the focused one
+         * focus bench N     cycle N times, at most FOCUS_BENCH_MAX, and report what a
+         *                   focus change costs */
+        if (argc == 3 && strcmp (argv[1], "bench") == 0) {
+                struct histogram hist;
+                focus_bench (server, (uint32_t) strtoul (argv[2], NULL, 10), &hist);
+                if (hist.count == 0) {
+                        ipc_reply_printf (reply, "need at least two toplevels");
+                        return false;
+                }
+                ipc_reply_printf (reply,
+                                  "%u toplevels, %lu changes: avg %luns p50 %luns p99 %luns max %luns\n",
+                                  server->focus.count,
+                                  (unsigned long) hist.count,
+                                  (unsigned long) (hist.sum / hist.count),
+                                  (unsigned long) histogram_percentile (&hist, 50),
+                                  (unsigned long) histogram_percentile (&hist, 99),
+                                  (unsigned long) hist.max);
+                return true;
+        }
+        if (argc > 2) {
+                ipc_reply_printf (reply, "expected next, prev, an ID, @N or bench N");
+                return false;
+        }
+
+        if (argc == 2) {
+                struct toplevel *toplevel = NULL;
+                char            *end      = NULL;
+                if (strcmp (argv[1], "next") == 0 || strcmp (argv[1], "prev") == 0) {
+                        focus_cycle (server, strcmp (argv[1], "next") == 0);
+                } else if (argv[1][0] == '@') {
+                        toplevel = focus_toplevel_at (server, (uint32_t) strtoul (argv[1] + 1, &end, 10));
+                } else {
+                        toplevel = focus_toplevel_from_id (server, strtoull (argv[1], &end, 10));
+                }
+                if (end != NULL && (toplevel == NULL || *end != '\0')) {
+                        ipc_reply_printf (reply, "no such toplevel");
+                        return false;
+                }
+                if (toplevel != NULL) {
+                        keyboard_focus_toplevel (toplevel, toplevel->xdg_toplevel->base->surface);
+                }
+        }
+
+        if (wl_list_empty (&server->toplevels)) {
+                ipc_reply_printf (reply, "no toplevels\n");
+                return true;
+        }
+        struct toplevel *focused = wl_container_of (server->toplevels.next, focused, link);
+        ipc_reply_printf (reply,
+                          "focused %lu %s, %u toplevels\n",
+                          (unsigned long) focused->id,
+                          focused->xdg_toplevel->app_id != NULL ? focused->xdg_toplevel->app_id : "-",
+                          server->focus.count);
+        return true;
+}
+
+static bool ipc_output (struct comp_server *server, int argc, char **argv, struct ipc_reply *reply) {
+        /* output                    list outputs, and frames streamed by the virtual ones
+         * output add WxH[@HZ]       add a virtual output, 60Hz unless given
+         * output remove NAME        remove a virtual output
+         * output export NAME        pass the frame ring of a virtual output, see comp_virtual */
+        if (argc == 3 && strcmp (argv[1], "add") == 0) {
+                int    width, height, consumed = 0;
+                double hz = 60;
+                if (sscanf (argv[2], "%dx%d%n", &width, &height, &consumed) != 2
+                    || (argv[2][consumed] == '@' && sscanf (argv[2] + consumed, "@%lf", &hz) != 1)
+                    || (argv[2][consumed] != '\0' && argv[2][consumed] != '@') || width <= 0 || height <= 0
+                    || width > 16384 || height > 16384 || hz <= 0 || hz > 1000) {
+                        ipc_reply_printf (reply, "expected a mode like 1920x1080 or 2560x1440@59.94");
+                        return false;
+                }
+                const struct comp_output *output = virtual_output_add (server, width, height, (int) (hz * 1000 + 0.5));
+                if (output == NULL) {
+                        ipc_reply_printf (reply, "cannot add a virtual output, see the log");
+                        return false;
+                }
+                ipc_reply_printf (reply, "%s\n", output->wlr_output->name);
+                return true;
+        }
+        if (argc == 3 && (strcmp (argv[1], "remove") == 0 || strcmp (argv[1], "export") == 0)) {
+                struct comp_output *output, *found = NULL;
+                wl_list_for_each (output, &server->outputs, link) {
+                        if (strcmp (output->wlr_output->name, argv[2]) == 0 && output->virtual_ring != NULL) {
+                                found = output;
+                        }
+                }
+                if (found == NULL) {
+                        ipc_reply_printf (reply, "no virtual output %s", argv[2]);
+                        return false;
+                }
+                if (strcmp (argv[1], "remove") == 0) {
+                        virtual_output_remove (found);
+                } else {
+                        reply->fd = virtual_output_ring_fd (found);
+                }
+                return true;
+        }
+        if (argc != 1) {
+                ipc_reply_printf (reply, "expected add WxH[@HZ], remove NAME or export NAME");
+                return false;
+        }
+
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                const struct wlr_output *wlr_output = output->wlr_output;
+                ipc_reply_printf (reply,
+                                  "%s %dx%d@%.3fHz%s%s",
+                                  wlr_output->name,
+                                  wlr_output->width,
+                                  wlr_output->height,
+                                  wlr_output->refresh / 1000.0,
+                                  wlr_output->enabled ? "" : " disabled",
+                                  output->mirror ? " mirror" : "");
+                if (output->virtual_ring != NULL) {
+                        ipc_reply_printf (reply, " virtual, %lu frames", (unsigned long) virtual_output_frames (output));
+                }
+                ipc_reply_printf (reply, "\n");
+        }
+        return true;
+}
+
+static bool ipc_overlay (struct comp_server *server, int argc, char **argv, struct ipc_reply *reply) {
+        /* overlay                 show whether the performance overlay is up
+         * overlay on|off|toggle   change it */
+        bool enabled = server->perf_overlay.enabled;
+        if (argc > 2 || (argc == 2 && !parse_toggle (argv[1], enabled, &enabled))) {
+                ipc_reply_printf (reply, "expected on, off or toggle");
+                return false;
+        }
+        perf_overlay_set_enabled (server, enabled);
+        ipc_reply_printf (reply, "overlay %s\n", enabled ? "on" : "off");
+        return true;
+}
+
+static bool ipc_overview (struct comp_server *server, int argc, char **argv, struct ipc_reply *reply) {
+        /* overview                 show whether the overview is up and the cache use
+         * overview on|off|toggle   change it */
+        bool enabled = server->overview.active;
+        if (argc > 2 || (argc == 2 && !parse_toggle (argv[1], enabled, &enabled))) {
+                ipc_reply_printf (reply, "expected on, off or toggle");
+                return false;
+        }
+        overview_set_active (server, enabled);
+        ipc_reply_printf (reply,
+                          "overview %s, thumbnails %zu of %zu KiB\n",
+                          enabled ? "on" : "off",
+                          server->overview.used / 1024,
+                          server->overview.budget / 1024);
+        return true;
+}
+
+static const struct ipc_command commands[] = {
+        { "help", "", ipc_help },
+        { "log", "[SUBSYSTEM|all silent|error|info|debug]", ipc_log },
+        { "animations", "[on|off|toggle]", ipc_animations },
+        { "damage", "[on|off|toggle]", ipc_damage },
+        { "focus", "[next|prev|ID|@N|bench N]", ipc_focus },
+        { "output", "[add WxH[@HZ]|remove NAME|export NAME]", ipc_output },
+        { "overlay", "[on|off|toggle]", ipc_overlay },
+        { "overview", "[on|off|toggle]", ipc_overview },
+};
+
+static bool ipc_help (struct comp_server *server, int argc, char **argv, struct ipc_reply *reply) {
+        for (size_t i = 0; i < sizeof (commands) / sizeof (commands[0]); i++) {
+                ipc_reply_printf (reply, "%s %s\n", commands[i].name, commands[i].usage);
+        }
+        return true;
+}
+
+void ipc_reply_printf (struct ipc_reply *reply, const char *fmt, ...) {
+        if (reply->len >= sizeof (reply->text)) {
+                return;
+        }
+        va_list args;
+        va_start (args, fmt);
+        const int len = vsnprintf (reply->text + reply->len, sizeof (reply->text) - reply->len, fmt, args);
+        va_end (args);
+        if (len > 0) {
+                reply->len += (size_t) len;
+                if (reply->len > sizeof (reply->text)) {
+                        reply->len = sizeof (reply->text);
+                }
+        }
+}
+
+static ssize_t ipc_send_status (int fd, const char *status, int pass_fd) {
+        if (pass_fd < 0) {
+                return send (fd, status, strlen (status), MSG_NOSIGNAL | MSG_DONTWAIT);
+        }
+        union
+        {
+                char           buf[CMSG_SPACE (sizeof (int))];
+                struct cmsghdr align;
+        } control;
+        struct iovec  iov = { .iov_base = (void *) status, .iov_len = strlen (status) };
+        struct msghdr msg = {
+                .msg_iov        = &iov,
+                .msg_iovlen     = 1,
+                .msg_control    = control.buf,
+                .msg_controllen = sizeof (control.buf),
+        };
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR (&msg);
+        cmsg->cmsg_level     = SOL_SOCKET;
+        cmsg->cmsg_type      = SCM_RIGHTS;
+        cmsg->cmsg_len       = CMSG_LEN (sizeof (int));
+        memcpy (CMSG_DATA (cmsg), &pass_fd, sizeof (int));
+        return sendmsg (fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+}
+
+static void ipc_execute (struct ipc_client *client, char *line) {
+        char *argv[IPC_MAX_ARGS];
+        int   argc = 0;
+        char *save = NULL;
+        for (char *arg = strtok_r (line, " \t", &save); arg != NULL && argc < IPC_MAX_ARGS;
+             arg       = strtok_r (NULL, " \t", &save)) {
+                argv[argc++] = arg;
+        }
+        if (argc == 0) {
+                return;
+        }
+
+        /* Static: replies can be large and only one command runs at a time. */
+        static struct ipc_reply reply;
+        reply.len = 0;
+        reply.fd  = -1;
+
+        const struct ipc_command *command = NULL;
+        for (size_t i = 0; i < sizeof (commands) / sizeof (commands[0]); i++) {
+                if (strcmp (argv[0], commands[i].name) == 0) {
+                        command = &commands[i];
+                }
+        }
+
+        char status[512];
+        if (command == NULL) {
+                snprintf (status, sizeof (status), "error: unknown command %s\n", argv[0]);
+        } else if (!command->handler (client->server, argc, argv, &reply)) {
+                /* The handler wrote the reason into the reply. */
+                snprintf (status,
+                          sizeof (status),
+                          "error: %.*s\nusage: %s %s\n",
+                          (int) reply.len,
+                          reply.text,
+                          command->name,
+                          command->usage);
+                reply.len = 0;
+        } else {
+                snprintf (status, sizeof (status), "ok\n");
+        }
+
+        /* Replies are small next to the socket buffer; a client that does not
+         * read them just loses them. A file descriptor rides along with the
+         * status line, and is closed on the client side unless it asks for
+         * it with recvmsg. */
+        if (send (client->fd, reply.text, reply.len, MSG_NOSIGNAL | MSG_DONTWAIT) < 0
+            || ipc_send_status (client->fd, status, reply.fd) < 0) {
+                wlr_log (WLR_DEBUG, "IPC: dropped reply to %s", argv[0]);
+        }
+}
+
+static void ipc_client_destroy (struct ipc_client *client) {
+        wl_event_source_remove (client->source);
+        wl_list_remove (&client->link);
+        close (client->fd);
+        free (client);
+}
+
+static int ipc_client_readable (int fd, uint32_t mask, void *data) {
+        /* Read even on hangup: a client may send a command and close right
+         * away. End of file or an error then shows up as a read <= 0. */
+        struct ipc_client *client = data;
+        const ssize_t n = read (fd, client->buf + client->len, sizeof (client->buf) - client->len);
+        if (n <= 0) {
+                if (n < 0 && errno == EAGAIN) {
+                        return 0;
+                }
+                ipc_client_destroy (client);
+                return 0;
+        }
+        client->len += (size_t) n;
+
+        char *line = client->buf, *newline;
+        while ((newline = memchr (line, '\n', client->buf + client->len - line)) != NULL) {
+                *newline = '\0';
+                ipc_execute (client, line);
+                line = newline + 1;
+        }
+        client->len -= line - client->buf;
+        memmove (client->buf, line, client->len);
+        if (client->len == sizeof (client->buf)) {
+                wlr_log (WLR_ERROR, "IPC: command too long, dropping client");
+                ipc_client_destroy (client);
+        }
+        return 0;
+}
+
+static int ipc_accept (int fd, uint32_t mask, void *data) {
+        struct comp_server *server    = data;
+        const int           client_fd = accept4 (fd, NULL, NULL, SOCK_CLOEXEC | SOCK_NONBLOCK);
+        if (client_fd < 0) {
+                wlr_log_errno (WLR_ERROR, "IPC: accept failed");
+                return 0;
+        }
+
+        struct ipc_client *client = calloc (1, sizeof (*client));
+        client->server            = server;
+        client->fd                = client_fd;
+        client->source            = wl_event_loop_add_fd (
+            server->wl_event_loop, client_fd, WL_EVENT_READABLE, ipc_client_readable, client);
+        wl_list_insert (&server->ipc.clients, &client->link);
+        return 0;
+}
+
+void ipc_init (struct comp_server *server, const char *wayland_socket) {
+        struct comp_ipc *ipc = &server->ipc;
+        ipc->fd              = -1;
+        wl_list_init (&ipc->clients);
+
+        const char *runtime_dir = getenv ("XDG_RUNTIME_DIR");
+        if (runtime_dir == NULL) {
+                wlr_log (WLR_ERROR, "IPC: XDG_RUNTIME_DIR is not set, no control socket");
+                return;
+        }
+
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        if (snprintf (addr.sun_path, sizeof (addr.sun_path), "%s/nwm-%s.sock", runtime_dir, wayland_socket)
+            >= (int) sizeof (addr.sun_path)) {
+                wlr_log (WLR_ERROR, "IPC: socket path too long");
+                return;
+        }
+
+        ipc->fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+        unlink (addr.sun_path);
+        if (ipc->fd < 0 || bind (ipc->fd, (struct sockaddr *) &addr, sizeof (addr)) < 0
+            || listen (ipc->fd, 8) < 0) {
+                wlr_log_errno (WLR_ERROR, "IPC: cannot listen on %s", addr.sun_path);
+                if (ipc->fd >= 0) {
+                        close (ipc->fd);
+                        ipc->fd = -1;
+                }
+                return;
+        }
+
+        snprintf (ipc->path, sizeof (ipc->path), "%s", addr.sun_path);
+        ipc->source = wl_event_loop_add_fd (
+            server->wl_event_loop, ipc->fd, WL_EVENT_READABLE, ipc_accept, server);
+        setenv ("NWM_SOCK", ipc->path, true);
+        wlr_log (WLR_INFO, "IPC listening on %s", ipc->path);
+}
+
+void ipc_finish (struct comp_server *server) {
+        struct comp_ipc *ipc = &server->ipc;
+        if (ipc->fd < 0) {
+                return;
+        }
+        struct ipc_client *client, *tmp;
+        wl_list_for_each_safe (client, tmp, &ipc->clients, link) {
+                ipc_client_destroy (client);
+        }
+        wl_event_source_remove (ipc->source);
+        close (ipc->fd);
+        unlink (ipc->path);
+}
@@ -0,0 +1,36 @@
+#ifndef COMP_IPC_H
+#define COMP_IPC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/un.h>
+#include <wayland-server-core.h>
+
+struct comp_server;
+
+#define IPC_REPLY_MAX 8192
+
+/** Control socket. Line based: each line is a command and its arguments
+ * separated by spaces; the reply is any number of lines followed by "ok" or
+ * "error: <reason>". The path is exported as NWM_SOCK, nwm-msg talks to it. */
+struct comp_ipc
+{
+        int                     fd;
+        char                    path[sizeof (((struct sockaddr_un *) 0)->sun_path)];
+        struct wl_event_source *source;
+        struct wl_list          clients; // ipc_client::link
+};
+
+struct ipc_reply
+{
+        size_t len;
+        char   text[IPC_REPLY_MAX];
+        int    fd; // passed along with the status line if >= 0, not owned
+};
+
+void ipc_init (struct comp_server *server, const char *wayland_socket);
+void ipc_finish (struct comp_server *server);
+void ipc_reply_printf (struct ipc_reply *reply, const char *fmt, ...)
+    __attribute__ ((format (printf, 2, 3)));
+
+#endif // COMP_IPC_H
@@ -0,0 +1,354 @@
+#include "latency.h"
+#include "log.h"
+#include "nwm_server.h"
+#include "timespec.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/util/log.h>
+
+#define LATENCY_REPORT_INTERVAL_MS 10000
+#define LATENCY_INPUT_TIMEOUT_MS   1000
+
+enum latency_stage
+{
+        LATENCY_STAGE_INPUT,     // delivered to the client, waiting for a commit
+        LATENCY_STAGE_COMMITTED, // client committed, waiting for an output commit
+        LATENCY_STAGE_SCANOUT,   // output committed, waiting for present
+};
+
+struct latency_device
+{
+        struct wl_list   link;
+        char             name[64];
+        struct histogram total;
+};
+
+struct latency_client
+{
+        struct wl_list         link;
+        struct comp_server    *server;
+        struct wl_client      *client;
+        char                   name[32];
+        struct histogram       total;
+        struct latency_sample *pending_input;
+        struct wl_listener     destroy;
+};
+
+struct latency_sample
+{
+        struct wl_list         link;
+        enum latency_stage     stage;
+        struct latency_client *client;
+        struct latency_device *device;
+        struct wlr_output     *output; // NULL until known
+        struct timespec        input;
+        struct timespec        commit;
+        struct timespec        output_commit;
+};
+
+static bool sample_expired (const struct latency_sample *sample) {
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        return timespec_diff_usec (&now, &sample->input) > LATENCY_INPUT_TIMEOUT_MS * 1000;
+}
+
+static void sample_destroy (struct latency_sample *sample) {
+        if (sample->client->pending_input == sample) {
+                sample->client->pending_input = NULL;
+        }
+        wl_list_remove (&sample->link);
+        free (sample);
+}
+
+static void log_client (struct latency_client *client) {
+        char label[64];
+        snprintf (label, sizeof (label), "latency client %s", client->name);
+        log_histogram (&client->total, label);
+}
+
+static void latency_client_destroy (struct wl_listener *listener, void *data) {
+        /* Report what we gathered for this client before it disappears. */
+        struct latency_client *client = wl_container_of (listener, client, destroy);
+        struct comp_latency   *latency = &client->server->latency;
+
+        struct latency_sample *sample, *tmp;
+        wl_list_for_each_safe (sample, tmp, &latency->samples, link) {
+                if (sample->client == client) {
+                        sample_destroy (sample);
+                }
+        }
+        if (client->total.count > 0) {
+                log_client (client);
+        }
+
+        wl_list_remove (&client->destroy.link);
+        wl_list_remove (&client->link);
+        free (client);
+}
+
+static struct latency_client *latency_client_get (struct comp_server *server,
+                                                  struct wl_client   *wl_client) {
+        struct comp_latency   *latency = &server->latency;
+        struct latency_client *client;
+        wl_list_for_each (client, &latency->clients, link) {
+                if (client->client == wl_client) {
+                        return client;
+                }
+        }
+
+        client         = calloc (1, sizeof (*client));
+        client->server = server;
+        client->client = wl_client;
+
+        /* Name clients after their process, which is what people will look for
+         * in the report. */
+        pid_t pid;
+        wl_client_get_credentials (wl_client, &pid, NULL, NULL);
+        snprintf (client->name, sizeof (client->name), "pid %d", (int) pid);
+        char path[64];
+        snprintf (path, sizeof (path), "/proc/%d/comm", (int) pid);
+        FILE *comm = fopen (path, "r");
+        if (comm != NULL) {
+                char name[16] = { 0 };
+                if (fgets (name, sizeof (name), comm) != NULL) {
+                        name[strcspn (name, "\n")] = '\0';
+                        snprintf (client->name, sizeof (client->name), "%s[%d]", name, (int) pid);
+                }
+                fclose (comm);
+        }
+
+        client->destroy.notify = latency_client_destroy;
+        wl_client_add_destroy_listener (wl_client, &client->destroy);
+        wl_list_insert (&latency->clients, &client->link);
+        return client;
+}
+
+static struct latency_device *latency_device_get (struct comp_latency     *latency,
+                                                  struct wlr_input_device *input_device) {
+        /* Devices are keyed by name so a replugged mouse keeps its history. */
+        const char            *name = input_device->name != NULL ? input_device->name : "unknown";
+        struct latency_device *device;
+        wl_list_for_each (device, &latency->devices, link) {
+                if (strcmp (device->name, name) == 0) {
+                        return device;
+                }
+        }
+
+        device = calloc (1, sizeof (*device));
+        snprintf (device->name, sizeof (device->name), "%s", name);
+        wl_list_insert (&latency->devices, &device->link);
+        return device;
+}
+
+void latency_input (struct comp_server      *server,
+                    struct wlr_input_device *device,
+                    struct wlr_seat_client  *seat_client) {
+        /* Called right after an input event was handed to the seat. */
+        struct comp_latency *latency = &server->latency;
+        if (!latency->enabled || seat_client == NULL) {
+                return;
+        }
+
+        struct latency_client *client = latency_client_get (server, seat_client->client);
+        if (client->pending_input != NULL) {
+                /* The client hasn't reacted to earlier input yet; the oldest
+                 * unanswered event is what the user is waiting on, unless it
+                 * has been waiting so long that the client ignored it. */
+                if (!sample_expired (client->pending_input)) {
+                        return;
+                }
+                sample_destroy (client->pending_input);
+                latency->expired++;
+        }
+
+        struct latency_sample *sample = calloc (1, sizeof (*sample));
+        sample->stage                 = LATENCY_STAGE_INPUT;
+        sample->client                = client;
+        sample->device                = latency_device_get (latency, device);
+        if (latency->input_arrival != NULL) {
+                sample->input = *latency->input_arrival;
+        } else {
+                clock_gettime (CLOCK_MONOTONIC, &sample->input);
+        }
+        client->pending_input = sample;
+        wl_list_insert (latency->samples.prev, &sample->link);
+}
+
+void latency_surface_commit (struct comp_server *server, struct wlr_surface *surface) {
+        /* Only commits that attach a new buffer can be a reaction to input. */
+        struct comp_latency *latency = &server->latency;
+        if (!latency->enabled || !(surface->current.committed & WLR_SURFACE_STATE_BUFFER)) {
+                return;
+        }
+
+        struct wl_client      *wl_client = wl_resource_get_client (surface->resource);
+        struct latency_client *client;
+        struct latency_sample *sample = NULL;
+        wl_list_for_each (client, &latency->clients, link) {
+                if (client->client == wl_client) {
+                        sample = client->pending_input;
+                        break;
+                }
+        }
+        if (sample == NULL) {
+                return;
+        }
+        if (sample_expired (sample)) {
+                sample_destroy (sample);
+                latency->expired++;
+                return;
+        }
+
+        struct wlr_surface_output *surface_output;
+        wl_list_for_each (surface_output, &surface->current_outputs, link) {
+                sample->output = surface_output->output;
+                break;
+        }
+        sample->stage = LATENCY_STAGE_COMMITTED;
+        clock_gettime (CLOCK_MONOTONIC, &sample->commit);
+        sample->client->pending_input = NULL;
+}
+
+void latency_output_commit (struct comp_server *server, struct wlr_output_event_commit *event) {
+        /* The scene output picked up every buffer committed so far. Commits
+         * that only change modes, gamma or the like show no new frame. */
+        struct comp_latency *latency = &server->latency;
+        if (!latency->enabled || !(event->state->committed & WLR_OUTPUT_STATE_BUFFER)) {
+                return;
+        }
+        struct wlr_output *output = event->output;
+
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+
+        struct latency_sample *sample;
+        wl_list_for_each (sample, &latency->samples, link) {
+                if (sample->stage != LATENCY_STAGE_COMMITTED
+                    || (sample->output != NULL && sample->output != output)) {
+                        continue;
+                }
+                sample->stage         = LATENCY_STAGE_SCANOUT;
+                sample->output        = output;
+                sample->output_commit = now;
+        }
+}
+
+void latency_output_present (struct comp_server *server, struct wlr_output_event_present *event) {
+        struct comp_latency *latency = &server->latency;
+        if (!latency->enabled) {
+                return;
+        }
+
+        /* Backends without presentation feedback (e.g. headless) report the
+         * commit as not presented; count it as presented now. */
+        struct timespec presented;
+        if (event->presented && event->when != NULL) {
+                presented = *event->when;
+        } else {
+                clock_gettime (CLOCK_MONOTONIC, &presented);
+        }
+
+        struct latency_sample *sample, *tmp;
+        wl_list_for_each_safe (sample, tmp, &latency->samples, link) {
+                if (sample->stage != LATENCY_STAGE_SCANOUT || sample->output != event->output) {
+                        continue;
+                }
+                const uint64_t total = timespec_diff_usec (&presented, &sample->input);
+                histogram_add (&latency->input_to_commit,
+                               timespec_diff_usec (&sample->commit, &sample->input));
+                histogram_add (&latency->commit_to_output,
+                               timespec_diff_usec (&sample->output_commit, &sample->commit));
+                histogram_add (&latency->output_to_present,
+                               timespec_diff_usec (&presented, &sample->output_commit));
+                histogram_add (&latency->total, total);
+                histogram_add (&sample->device->total, total);
+                histogram_add (&sample->client->total, total);
+                sample_destroy (sample);
+        }
+}
+
+void latency_output_destroy (struct comp_server *server, struct wlr_output *output) {
+        struct comp_latency *latency = &server->latency;
+        if (!latency->enabled) {
+                return;
+        }
+
+        struct latency_sample *sample, *tmp;
+        wl_list_for_each_safe (sample, tmp, &latency->samples, link) {
+                if (sample->output == output) {
+                        sample_destroy (sample);
+                }
+        }
+}
+
+static void latency_report (struct comp_latency *latency) {
+        log_histogram (&latency->input_to_commit, "latency input -> client commit");
+        log_histogram (&latency->commit_to_output, "latency client commit -> output commit");
+        log_histogram (&latency->output_to_present, "latency output commit -> present");
+        log_histogram (&latency->total, "latency input -> present");
+        if (latency->expired > 0) {
+                wlr_log (WLR_INFO,
+                         "latency: %lu inputs left unanswered for over %d ms",
+                         (unsigned long) latency->expired,
+                         LATENCY_INPUT_TIMEOUT_MS);
+        }
+
+        char                   label[96];
+        struct latency_device *device;
+        wl_list_for_each (device, &latency->devices, link) {
+                snprintf (label, sizeof (label), "latency device %s", device->name);
+                log_histogram (&device->total, label);
+        }
+        struct latency_client *client;
+        wl_list_for_each (client, &latency->clients, link) {
+                log_client (client);
+        }
+}
+
+static int latency_timer_notify (void *data) {
+        struct comp_server *server = data;
+        latency_report (&server->latency);
+        wl_event_source_timer_update (server->latency.timer, LATENCY_REPORT_INTERVAL_MS);
+        return 0;
+}
+
+void latency_init (struct comp_server *server) {
+        struct comp_latency *latency = &server->latency;
+        wl_list_init (&latency->samples);
+        wl_list_init (&latency->clients);
+        wl_list_init (&latency->devices);
+        if (!latency->enabled) {
+                return;
+        }
+        latency->timer = wl_event_loop_add_timer (server->wl_event_loop, latency_timer_notify, server);
+        wl_event_source_timer_update (latency->timer, LATENCY_REPORT_INTERVAL_MS);
+        wlr_log (WLR_INFO, "Input-to-present latency instrumentation enabled");
+}
+
+void latency_finish (struct comp_server *server) {
+        /* Called once clients are gone, so only the devices are left to free.
+         * The distributions are reported one last time first. */
+        struct comp_latency *latency = &server->latency;
+        if (!latency->enabled) {
+                return;
+        }
+        wl_event_source_remove (latency->timer);
+        latency_report (latency);
+
+        struct latency_sample *sample, *sample_tmp;
+        wl_list_for_each_safe (sample, sample_tmp, &latency->samples, link) {
+                sample_destroy (sample);
+        }
+        struct latency_device *device, *device_tmp;
+        wl_list_for_each_safe (device, device_tmp, &latency->devices, link) {
+                wl_list_remove (&device->link);
+                free (device);
+        }
+}
@@ -0,0 +1,58 @@
+#ifndef COMP_LATENCY_H
+#define COMP_LATENCY_H
+
+#include "histogram.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <wayland-server-core.h>
+
+struct comp_server;
+struct wlr_input_device;
+struct wlr_output;
+struct wlr_output_event_commit;
+struct wlr_output_event_present;
+struct wlr_seat_client;
+struct wlr_surface;
+
+/** Input-to-present latency instrumentation.
+ *
+ * Every input event delivered to a client opens a sample for that client
+ * (further input before the client reacts is coalesced into it). The sample is
+ * then stamped at the client's next buffer commit, at the scene output commit
+ * that picks the new buffer up and finally at the output's present event.
+ * Input the client does not answer within LATENCY_INPUT_TIMEOUT_MS is
+ * dropped: whatever it commits later, a blinking caret say, is no answer. */
+struct comp_latency
+{
+        bool                    enabled;
+        struct wl_event_source *timer;
+
+        struct wl_list samples; // latency_sample::link
+        struct wl_list clients; // latency_client::link
+        struct wl_list devices; // latency_device::link
+
+        struct histogram input_to_commit;   // input arrival -> client commit
+        struct histogram commit_to_output;  // client commit -> output commit
+        struct histogram output_to_present; // output commit -> present
+        struct histogram total;             // input arrival -> present
+        uint64_t         expired;           // inputs dropped unanswered
+
+        /* Set while the input thread dispatches an event it stamped earlier. */
+        const struct timespec *input_arrival;
+};
+
+void latency_init (struct comp_server *server);
+void latency_finish (struct comp_server *server);
+
+void latency_input (struct comp_server      *server,
+                    struct wlr_input_device *device,
+                    struct wlr_seat_client  *seat_client);
+void latency_surface_commit (struct comp_server *server, struct wlr_surface *surface);
+void latency_output_commit (struct comp_server *server, struct wlr_output_event_commit *event);
+void latency_output_present (struct comp_server              *server,
+                             struct wlr_output_event_present *event);
+void latency_output_destroy (struct comp_server *server, struct wlr_output *output);
+
+#endif // COMP_LATENCY_H
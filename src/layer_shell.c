@@ -0,0 +1,249 @@
+#include "layer_shell.h"
+#include "alloc.h"
+#include "input/keyboard.h"
+#include "latency.h"
+#include "output.h"
+
+#include <stdlib.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_seat.h>
+#include <wlr/types/wlr_xdg_shell.h>
+#include <wlr/util/box.h>
+#include <wlr/util/log.h>
+
+static struct wlr_scene_tree *layer_tree (struct comp_server             *server,
+                                          enum zwlr_layer_shell_v1_layer layer) {
+        switch (layer) {
+        case ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND:
+                return server->layers[SCENE_LAYER_BACKGROUND];
+        case ZWLR_LAYER_SHELL_V1_LAYER_BOTTOM:
+                return server->layers[SCENE_LAYER_BOTTOM];
+        case ZWLR_LAYER_SHELL_V1_LAYER_TOP:
+                return server->layers[SCENE_LAYER_TOP];
+        case ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY:
+                return server->layers[SCENE_LAYER_OVERLAY];
+        }
+        return server->layers[SCENE_LAYER_TOP];
+}
+
+static void layer_surface_focus (struct layer_surface *surface) {
+        /* Same as keyboard_focus_toplevel, minus the raise: stacking inside a
+         * layer is left alone. */
+        struct wlr_seat    *seat         = surface->server->seat;
+        struct wlr_surface *wlr_surface  = surface->layer_surface->surface;
+        struct wlr_surface *prev_surface = seat->keyboard_state.focused_surface;
+        if (prev_surface == wlr_surface) {
+                return;
+        }
+        if (prev_surface) {
+                struct wlr_xdg_toplevel *prev_toplevel
+                    = wlr_xdg_toplevel_try_from_wlr_surface (prev_surface);
+                if (prev_toplevel != NULL) {
+                        wlr_xdg_toplevel_set_activated (prev_toplevel, false);
+                }
+        }
+        struct wlr_keyboard *keyboard = wlr_seat_get_keyboard (seat);
+        if (keyboard != NULL) {
+                wlr_seat_keyboard_notify_enter (seat,
+                                                wlr_surface,
+                                                keyboard->keycodes,
+                                                keyboard->num_keycodes,
+                                                &keyboard->modifiers);
+        }
+}
+
+static void arrange_pass (struct comp_output   *output,
+                          const struct wlr_box *full_area,
+                          struct wlr_box       *usable_area,
+                          bool                  exclusive) {
+        for (int layer = ZWLR_LAYER_SHELL_V1_LAYER_OVERLAY;
+             layer >= ZWLR_LAYER_SHELL_V1_LAYER_BACKGROUND;
+             layer--) {
+                struct layer_surface *surface;
+                wl_list_for_each (surface, &output->layer_surfaces, link) {
+                        const struct wlr_layer_surface_v1 *layer_surface = surface->layer_surface;
+                        if (!layer_surface->initialized
+                            || layer_surface->current.layer != (enum zwlr_layer_shell_v1_layer) layer
+                            || (layer_surface->current.exclusive_zone > 0) != exclusive) {
+                                continue;
+                        }
+                        wlr_scene_layer_surface_v1_configure (surface->scene, full_area, usable_area);
+                }
+        }
+}
+
+void layers_arrange (struct comp_output *output) {
+        /* Positions every layer surface on the output and works out the area
+         * left for toplevels. Runs on layout changes and on layer surface
+         * commits that change their layer state, never per frame. */
+        struct comp_server *server = output->server;
+        struct wlr_box      full_area;
+        wlr_output_layout_get_box (server->output_layout, output->wlr_output, &full_area);
+        if (wlr_box_empty (&full_area)) {
+                return;
+        }
+
+        /* Surfaces with an exclusive zone go first, top-most layer down, each
+         * one shrinking the usable area for those after it. The rest are then
+         * fitted into whatever is left. */
+        struct wlr_box usable_area = full_area;
+        arrange_pass (output, &full_area, &usable_area, true);
+        arrange_pass (output, &full_area, &usable_area, false);
+
+        if (!wlr_box_equal (&usable_area, &output->usable_area)) {
+                wlr_log (WLR_DEBUG,
+                         "Output %s usable area %d,%d %dx%d",
+                         output->wlr_output->name,
+                         usable_area.x,
+                         usable_area.y,
+                         usable_area.width,
+                         usable_area.height);
+                output->usable_area = usable_area;
+        }
+}
+
+void layers_output_destroy (struct comp_output *output) {
+        /* Layer surfaces are bound to one output; tell their clients they are
+         * closed. Each destroy handler unlinks itself. */
+        struct layer_surface *surface, *tmp;
+        wl_list_for_each_safe (surface, tmp, &output->layer_surfaces, link) {
+                wlr_layer_surface_v1_destroy (surface->layer_surface);
+        }
+}
+
+void layer_surface_focus_on_click (struct comp_server *server, struct wlr_surface *surface) {
+        struct wlr_layer_surface_v1 *layer_surface
+            = wlr_layer_surface_v1_try_from_wlr_surface (wlr_surface_get_root_surface (surface));
+        if (layer_surface == NULL
+            || layer_surface->current.keyboard_interactive
+                   == ZWLR_LAYER_SURFACE_V1_KEYBOARD_INTERACTIVITY_NONE) {
+                return;
+        }
+        layer_surface_focus (layer_surface->data);
+}
+
+static void layer_surface_map (struct wl_listener *listener, void *data) {
+        struct layer_surface        *surface       = wl_container_of (listener, surface, map);
+        struct wlr_layer_surface_v1 *layer_surface = surface->layer_surface;
+
+        layers_arrange (surface->output);
+
+        /* Lock screens and launchers above the toplevels ask for the keyboard
+         * as soon as they show up. */
+        if (layer_surface->current.keyboard_interactive
+                == ZWLR_LAYER_SURFACE_V1_KEYBOARD_INTERACTIVITY_EXCLUSIVE
+            && layer_surface->current.layer >= ZWLR_LAYER_SHELL_V1_LAYER_TOP) {
+                layer_surface_focus (surface);
+        }
+}
+
+static void layer_surface_unmap (struct wl_listener *listener, void *data) {
+        struct layer_surface *surface = wl_container_of (listener, surface, unmap);
+        struct comp_server   *server  = surface->server;
+        struct wlr_seat      *seat    = server->seat;
+
+        layers_arrange (surface->output);
+
+        /* Hand the keyboard back to the top-most toplevel. */
+        if (seat->keyboard_state.focused_surface == surface->layer_surface->surface) {
+                wlr_seat_keyboard_clear_focus (seat);
+                if (!wl_list_empty (&server->toplevels)) {
+                        struct toplevel *toplevel
+                            = wl_container_of (server->toplevels.next, toplevel, link);
+                        /* It is at the front of the MRU list already, so
+                         * keyboard_focus_toplevel would not restack it. */
+                        wlr_scene_node_raise_to_top (&toplevel->scene_tree->node);
+                        keyboard_focus_toplevel (toplevel, toplevel->xdg_toplevel->base->surface);
+                }
+        }
+}
+
+static void layer_surface_commit (struct wl_listener *listener, void *data) {
+        struct layer_surface        *surface       = wl_container_of (listener, surface, commit);
+        struct wlr_layer_surface_v1 *layer_surface = surface->layer_surface;
+        const uint32_t               committed     = layer_surface->current.committed;
+
+        if (committed & WLR_LAYER_SURFACE_V1_STATE_LAYER) {
+                wlr_scene_node_reparent (&surface->scene->tree->node,
+                                         layer_tree (surface->server, layer_surface->current.layer));
+        }
+
+        /* The initial commit needs a configure reply. After that, commits that
+         * only carry a new buffer, by far the most common kind, leave the
+         * layout alone. */
+        if (layer_surface->initial_commit || committed != 0) {
+                layers_arrange (surface->output);
+        }
+
+        latency_surface_commit (surface->server, layer_surface->surface);
+}
+
+static void layer_surface_new_popup (struct wl_listener *listener, void *data) {
+        /* Popups go in the layer surface's own tree, so a panel menu stacks
+         * with its panel. Nested popups find their parent through the data
+         * field like toplevel popups do. */
+        struct layer_surface *surface   = wl_container_of (listener, surface, new_popup);
+        struct wlr_xdg_popup *xdg_popup = data;
+        xdg_popup->base->data = wlr_scene_xdg_surface_create (surface->scene->tree, xdg_popup->base);
+}
+
+static void layer_surface_destroy (struct wl_listener *listener, void *data) {
+        /* The scene helper tears down its own tree. */
+        struct layer_surface *surface = wl_container_of (listener, surface, destroy);
+
+        wlr_log (WLR_INFO, "Layer surface %s Destroyed", surface->layer_surface->namespace);
+
+        wl_list_remove (&surface->link);
+        wl_list_remove (&surface->map.link);
+        wl_list_remove (&surface->unmap.link);
+        wl_list_remove (&surface->commit.link);
+        wl_list_remove (&surface->new_popup.link);
+        wl_list_remove (&surface->destroy.link);
+
+        nwm_free (surface);
+}
+
+void new_layer_surface_notify (struct wl_listener *listener, void *data) {
+        /* This event is raised when a client creates a panel, wallpaper, or
+         * other layer shell surface. */
+        struct comp_server          *server = wl_container_of (listener, server, new_layer_surface);
+        struct wlr_layer_surface_v1 *layer_surface = data;
+
+        /* Clients may leave the choice of output to us; use the one under the
+         * cursor. */
+        if (layer_surface->output == NULL) {
+                layer_surface->output = wlr_output_layout_output_at (
+                    server->output_layout, server->cursor->x, server->cursor->y);
+        }
+        if (layer_surface->output == NULL) {
+                wlr_log (WLR_ERROR, "No output for layer surface %s", layer_surface->namespace);
+                wlr_layer_surface_v1_destroy (layer_surface);
+                return;
+        }
+
+        struct layer_surface *surface = nwm_alloc (ALLOC_LAYER_SHELL, struct layer_surface);
+        surface->server               = server;
+        surface->output               = layer_surface->output->data;
+        surface->layer_surface        = layer_surface;
+        surface->scene                = wlr_scene_layer_surface_v1_create (
+            layer_tree (server, layer_surface->pending.layer), layer_surface);
+        layer_surface->data = surface;
+        wl_list_insert (&surface->output->layer_surfaces, &surface->link);
+
+        surface->map.notify       = layer_surface_map;
+        surface->unmap.notify     = layer_surface_unmap;
+        surface->commit.notify    = layer_surface_commit;
+        surface->new_popup.notify = layer_surface_new_popup;
+        surface->destroy.notify   = layer_surface_destroy;
+
+        wl_signal_add (&layer_surface->surface->events.map, &surface->map);
+        wl_signal_add (&layer_surface->surface->events.unmap, &surface->unmap);
+        wl_signal_add (&layer_surface->surface->events.commit, &surface->commit);
+        wl_signal_add (&layer_surface->events.new_popup, &surface->new_popup);
+        wl_signal_add (&layer_surface->events.destroy, &surface->destroy);
+
+        wlr_log (WLR_INFO,
+                 "New layer surface %s on %s",
+                 layer_surface->namespace,
+                 layer_surface->output->name);
+}
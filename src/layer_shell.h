@@ -0,0 +1,34 @@
+#ifndef COMP_LAYER_SHELL_H
+#define COMP_LAYER_SHELL_H
+
+#include "nwm_server.h"
+
+#include <wlr/types/wlr_layer_shell_v1.h>
+#include <wlr/types/wlr_scene.h>
+
+struct comp_output;
+
+/** A wlr-layer-shell surface: panels, docks, wallpapers, lock screens and
+ * notifications. It lives in one of the fixed scene layers and belongs to a
+ * single output, whose usable area it may shrink with an exclusive zone. */
+struct layer_surface
+{
+        struct wl_list                     link; // comp_output::layer_surfaces
+        struct comp_server                *server;
+        struct comp_output                *output;
+        struct wlr_layer_surface_v1       *layer_surface;
+        struct wlr_scene_layer_surface_v1 *scene;
+
+        struct wl_listener map;
+        struct wl_listener unmap;
+        struct wl_listener commit;
+        struct wl_listener new_popup;
+        struct wl_listener destroy;
+};
+
+void new_layer_surface_notify (struct wl_listener *listener, void *data);
+void layers_arrange (struct comp_output *output);
+void layers_output_destroy (struct comp_output *output);
+void layer_surface_focus_on_click (struct comp_server *server, struct wlr_surface *surface);
+
+#endif // COMP_LAYER_SHELL_H
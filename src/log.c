@@ -0,0 +1,401 @@
+#define _GNU_SOURCE
+
+#include "log.h"
+#include "histogram.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/eventfd.h>
+#include <time.h>
+#include <unistd.h>
+
+#define LOG_RING_SIZE  4096 // records, power of two
+#define LOG_LINE_MAX   248  // bytes per record, newline included
+#define LOG_FLUSH_MS   20   // longest a message waits in the ring once the thread is up
+#define LOG_FILE_CACHE 64
+
+struct log_record
+{
+        _Atomic uint64_t seq; // stream position + 1 once complete, 0 while being written
+        uint32_t         len;
+        char             text[LOG_LINE_MAX];
+};
+
+/* Global, as wlr_log's callback gets no user data. Any thread may log. */
+static struct log_record               ring[LOG_RING_SIZE];
+static _Atomic uint64_t                head; // next stream position to write
+static uint64_t                        tail; // next position to print, log thread only
+static uint64_t                        lost; // log thread only
+static _Atomic enum wlr_log_importance levels[LOG_SUBSYSTEM_COUNT];
+static struct timespec                 start;
+static int                             wake_fd = -1;
+static _Atomic bool                    stopping;
+static _Atomic bool                    sleeping; // log thread blocked on an empty ring
+static pthread_t                       thread;
+static bool                            running;
+
+/* Per thread, so the input thread can log without sharing it. */
+static _Thread_local struct
+{
+        const char        *file;
+        enum log_subsystem subsystem;
+} file_cache[LOG_FILE_CACHE];
+
+static const char *const subsystem_names[LOG_SUBSYSTEM_COUNT] = {
+        [LOG_CORE]    = "core",
+        [LOG_SHELL]   = "shell",
+        [LOG_OUTPUT]  = "output",
+        [LOG_INPUT]   = "input",
+        [LOG_PERF]    = "perf",
+        [LOG_WLROOTS] = "wlroots",
+};
+
+static const char *const level_names[WLR_LOG_IMPORTANCE_LAST] = {
+        [WLR_SILENT] = "silent",
+        [WLR_ERROR]  = "error",
+        [WLR_INFO]   = "info",
+        [WLR_DEBUG]  = "debug",
+};
+
+/* Files under src/ that are not CORE. Anything in src/input/ is INPUT. */
+static const struct
+{
+        const char        *file;
+        enum log_subsystem subsystem;
+} files[] = {
+        {     "xdg_shell.c",  LOG_SHELL},
+        {   "layer_shell.c",  LOG_SHELL},
+        {      "overview.c",  LOG_SHELL},
+        {         "focus.c",  LOG_SHELL},
+        {        "output.c", LOG_OUTPUT},
+        {        "mirror.c", LOG_OUTPUT},
+        {    "damage_vis.c", LOG_OUTPUT},
+        {          "idle.c", LOG_OUTPUT},
+        {        "pacing.c", LOG_OUTPUT},
+        {       "capture.c", LOG_OUTPUT},
+        {     "animation.c", LOG_OUTPUT},
+        {"virtual_output.c", LOG_OUTPUT},
+        {         "alloc.c",   LOG_PERF},
+        {       "latency.c",   LOG_PERF},
+        {  "perf_overlay.c",   LOG_PERF},
+        {      "realtime.c",   LOG_PERF},
+        {        "record.c",   LOG_PERF},
+        {        "replay.c",   LOG_PERF},
+        {         "stats.c",   LOG_PERF},
+};
+
+static enum log_subsystem subsystem_for_file (const char *file) {
+        /* wlroots strips its source directory from file names, ours keep a
+         * path relative to the build directory, which always has src/ in it. */
+        const char *src = strstr (file, "src/");
+        if (src == NULL) {
+                return LOG_WLROOTS;
+        }
+        src += strlen ("src/");
+        if (strncmp (src, "input/", strlen ("input/")) == 0) {
+                return LOG_INPUT;
+        }
+        for (size_t i = 0; i < sizeof (files) / sizeof (files[0]); i++) {
+                if (strcmp (src, files[i].file) == 0) {
+                        return files[i].subsystem;
+                }
+        }
+        return LOG_CORE;
+}
+
+static enum log_subsystem subsystem_cached (const char *file) {
+        /* File names are string literals, so their address identifies them;
+         * the strstr/strcmp above runs once per call site and thread. */
+        const size_t slot = ((uintptr_t) file >> 3) & (LOG_FILE_CACHE - 1);
+        if (file_cache[slot].file != file) {
+                file_cache[slot].file      = file;
+                file_cache[slot].subsystem = subsystem_for_file (file);
+        }
+        return file_cache[slot].subsystem;
+}
+
+static void log_wake (void) {
+        const uint64_t one = 1;
+        if (write (wake_fd, &one, sizeof (one)) < 0) {
+                /* Nothing sensible to do, the thread wakes up on its own. */
+        }
+}
+
+static void log_callback (enum wlr_log_importance importance, const char *fmt, va_list args) {
+        /* wlr_log prefixes every format with "[%s:%d] " and passes the file
+         * name first; that is what tells us the subsystem. */
+        enum log_subsystem subsystem = LOG_WLROOTS;
+        if (strncmp (fmt, "[%s:%d] ", strlen ("[%s:%d] ")) == 0) {
+                va_list copy;
+                va_copy (copy, args);
+                subsystem = subsystem_cached (va_arg (copy, const char *));
+                va_end (copy);
+        }
+        if (importance > atomic_load_explicit (&levels[subsystem], memory_order_relaxed)) {
+                return;
+        }
+
+        /* Claim a slot and mark it incomplete before touching it. When the
+         * ring is full this overwrites the oldest record, the log thread
+         * notices and counts it as lost. */
+        const uint64_t     pos    = atomic_fetch_add_explicit (&head, 1, memory_order_relaxed);
+        struct log_record *record = &ring[pos & (LOG_RING_SIZE - 1)];
+        atomic_store_explicit (&record->seq, 0, memory_order_relaxed);
+        atomic_thread_fence (memory_order_release);
+
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        long elapsed_ms = (now.tv_sec - start.tv_sec) * 1000 + (now.tv_nsec - start.tv_nsec) / 1000000;
+
+        /* Leave room for the newline. */
+        const int room = LOG_LINE_MAX - 1;
+        int       len  = snprintf (record->text,
+                            room,
+                            "%02ld:%02ld:%02ld.%03ld [%s] ",
+                            elapsed_ms / 3600000,
+                            elapsed_ms / 60000 % 60,
+                            elapsed_ms / 1000 % 60,
+                            elapsed_ms % 1000,
+                            level_names[importance]);
+        if (len < room) {
+                len += vsnprintf (record->text + len, room - len, fmt, args);
+        }
+        if (len > room - 1) {
+                len = room - 1;
+        }
+        record->text[len++] = '\n';
+        record->len         = len;
+        atomic_store_explicit (&record->seq, pos + 1, memory_order_release);
+
+        /* Pairs with the fence in log_thread_main: either the thread sees
+         * this record before going to sleep, or we see it asleep. */
+        atomic_thread_fence (memory_order_seq_cst);
+        if (atomic_exchange_explicit (&sleeping, false, memory_order_relaxed) || importance == WLR_ERROR) {
+                log_wake ();
+        }
+}
+
+static void log_drain (void) {
+        /* Copies every complete record into one buffer and writes it with a
+         * single call. Stops at the first record still being written. */
+        static char    out[64 * 1024];
+        size_t         out_len = 0;
+        const uint64_t end     = atomic_load_explicit (&head, memory_order_acquire);
+        if (end - tail > LOG_RING_SIZE) {
+                lost += end - tail - LOG_RING_SIZE;
+                tail = end - LOG_RING_SIZE;
+        }
+
+        while (tail < end) {
+                struct log_record *record = &ring[tail & (LOG_RING_SIZE - 1)];
+                const uint64_t     seq = atomic_load_explicit (&record->seq, memory_order_acquire);
+                if (seq > tail + 1) {
+                        /* Overwritten by a newer record before we got to it. */
+                        lost++;
+                        tail++;
+                        continue;
+                }
+                if (seq != tail + 1) {
+                        break;
+                }
+                if (out_len + LOG_LINE_MAX > sizeof (out)) {
+                        if (write (STDERR_FILENO, out, out_len) < 0) {
+                                return;
+                        }
+                        out_len = 0;
+                }
+                const uint32_t len = record->len;
+                memcpy (out + out_len, record->text, len);
+                atomic_thread_fence (memory_order_acquire);
+                if (atomic_load_explicit (&record->seq, memory_order_relaxed) == seq) {
+                        out_len += len;
+                } else {
+                        lost++;
+                }
+                tail++;
+        }
+
+        if (lost > 0) {
+                /* Make room first, snprintf returns the length it wanted. */
+                if (out_len + LOG_LINE_MAX > sizeof (out)) {
+                        if (write (STDERR_FILENO, out, out_len) < 0) {
+                                return;
+                        }
+                        out_len = 0;
+                }
+                out_len += snprintf (out + out_len,
+                                     sizeof (out) - out_len,
+                                     "[log] %lu messages lost, ring full\n",
+                                     (unsigned long) lost);
+                lost = 0;
+        }
+        if (out_len > 0 && write (STDERR_FILENO, out, out_len) < 0) {
+                return;
+        }
+}
+
+static void *log_thread_main (void *data) {
+        /* Batches writes while messages keep coming, and blocks without a
+         * timeout once the ring is empty: an idle nwm does not wake up just
+         * to find nothing to log. The first message after that wakes us. */
+        struct pollfd pfd = { .fd = wake_fd, .events = POLLIN };
+        while (!atomic_load (&stopping)) {
+                int timeout = LOG_FLUSH_MS;
+                if (tail == atomic_load_explicit (&head, memory_order_relaxed)) {
+                        atomic_store_explicit (&sleeping, true, memory_order_relaxed);
+                        atomic_thread_fence (memory_order_seq_cst);
+                        if (tail == atomic_load_explicit (&head, memory_order_relaxed)) {
+                                timeout = -1;
+                        } else {
+                                atomic_store_explicit (&sleeping, false, memory_order_relaxed);
+                        }
+                }
+                if (poll (&pfd, 1, timeout) > 0) {
+                        uint64_t count;
+                        if (read (wake_fd, &count, sizeof (count)) < 0 && errno != EAGAIN) {
+                                break;
+                        }
+                }
+                log_drain ();
+        }
+        log_drain ();
+        return NULL;
+}
+
+static void log_crash_handler (int sig) {
+        /* Only async-signal-safe calls from here on. Everything still in the
+         * ring is written out, including records already printed, since
+         * whatever stderr pointed at may be gone. */
+        static const char header[] = "--- nwm: fatal signal, dumping log ring ---\n";
+        static const char footer[] = "--- nwm: end of log ring ---\n";
+        if (write (STDERR_FILENO, header, sizeof (header) - 1) < 0) {
+                raise (sig);
+                return;
+        }
+
+        const uint64_t end = atomic_load (&head);
+        for (uint64_t pos = end > LOG_RING_SIZE ? end - LOG_RING_SIZE : 0; pos < end; pos++) {
+                const struct log_record *record = &ring[pos & (LOG_RING_SIZE - 1)];
+                if (atomic_load (&record->seq) == pos + 1
+                    && write (STDERR_FILENO, record->text, record->len) < 0) {
+                        break;
+                }
+        }
+        if (write (STDERR_FILENO, footer, sizeof (footer) - 1) < 0) {
+                /* Dying anyway. */
+        }
+        /* The handler was reset on entry; this time the default action runs. */
+        raise (sig);
+}
+
+static void log_update_verbosity (void) {
+        /* wlroots skips work for messages below its own verbosity, so keep it
+         * at the most verbose of our levels. */
+        enum wlr_log_importance max = WLR_SILENT;
+        for (int i = 0; i < LOG_SUBSYSTEM_COUNT; i++) {
+                const enum wlr_log_importance level = atomic_load (&levels[i]);
+                if (level > max) {
+                        max = level;
+                }
+        }
+        wlr_log_init (max, running ? log_callback : NULL);
+}
+
+void log_init (enum wlr_log_importance level) {
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        for (int i = 0; i < LOG_SUBSYSTEM_COUNT; i++) {
+                atomic_init (&levels[i], level);
+        }
+
+        wake_fd = eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if (wake_fd < 0 || pthread_create (&thread, NULL, log_thread_main, NULL) != 0) {
+                /* Plain synchronous wlroots logging then. */
+                wlr_log_init (level, NULL);
+                wlr_log (WLR_ERROR, "Failed to start log thread, logging synchronously");
+                return;
+        }
+        pthread_setname_np (thread, "nwm-log");
+        running = true;
+        /* Early returns from main still get their last messages out. */
+        atexit (log_finish);
+
+        const struct sigaction action = {
+                .sa_handler = log_crash_handler,
+                .sa_flags   = SA_RESETHAND | SA_NODEFER,
+        };
+        const int fatal[] = { SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT };
+        for (size_t i = 0; i < sizeof (fatal) / sizeof (fatal[0]); i++) {
+                sigaction (fatal[i], &action, NULL);
+        }
+
+        log_update_verbosity ();
+}
+
+void log_finish (void) {
+        /* Flushes the ring and goes back to synchronous logging for whatever
+         * comes after. */
+        if (!running) {
+                return;
+        }
+        atomic_store (&stopping, true);
+        log_wake ();
+        pthread_join (thread, NULL);
+        running = false;
+        close (wake_fd);
+        log_update_verbosity ();
+}
+
+const char *log_subsystem_name (enum log_subsystem subsystem) {
+        return subsystem_names[subsystem];
+}
+
+const char *log_level_name (enum wlr_log_importance level) {
+        return level_names[level];
+}
+
+enum wlr_log_importance log_get_level (enum log_subsystem subsystem) {
+        return atomic_load (&levels[subsystem]);
+}
+
+bool log_parse_level (const char *name, enum wlr_log_importance *level) {
+        for (int i = 0; i < WLR_LOG_IMPORTANCE_LAST; i++) {
+                if (strcasecmp (name, level_names[i]) == 0) {
+                        *level = i;
+                        return true;
+                }
+        }
+        return false;
+}
+
+bool log_set_level (const char *subsystem, const char *level_name) {
+        /* subsystem may be "all". */
+        enum wlr_log_importance level;
+        if (!log_parse_level (level_name, &level)) {
+                return false;
+        }
+        bool found = false;
+        for (int i = 0; i < LOG_SUBSYSTEM_COUNT; i++) {
+                if (strcmp (subsystem, "all") == 0 || strcmp (subsystem, subsystem_names[i]) == 0) {
+                        atomic_store (&levels[i], level);
+                        found = true;
+                }
+        }
+        if (found) {
+                log_update_verbosity ();
+        }
+        return found;
+}
+
+void log_histogram (const struct histogram *hist, const char *label) {
+        char line[256];
+        histogram_format (hist, label, line, sizeof (line));
+        wlr_log (WLR_INFO, "%s", line);
+}
@@ -0,0 +1,40 @@
+#ifndef COMP_LOG_H
+#define COMP_LOG_H
+
+#include <stdbool.h>
+#include <wlr/util/log.h>
+
+struct histogram;
+
+/** Subsystems with their own log level. A message belongs to the subsystem
+ * of the file it is logged from; everything from wlroots is WLROOTS. */
+enum log_subsystem
+{
+        LOG_CORE,
+        LOG_SHELL,
+        LOG_OUTPUT,
+        LOG_INPUT,
+        LOG_PERF,
+        LOG_WLROOTS,
+        LOG_SUBSYSTEM_COUNT,
+};
+
+/* Asynchronous logging backend for wlr_log. Messages below their
+ * subsystem's level are dropped before being formatted. The rest are
+ * formatted into a fixed-size slot of an in-memory ring, lines longer than a
+ * slot are truncated, and a background thread writes them to stderr, so the
+ * compositor thread never blocks on the terminal. Fatal signals dump the
+ * ring before the process dies. */
+void log_init (enum wlr_log_importance level);
+void log_finish (void);
+
+bool                    log_set_level (const char *subsystem, const char *level);
+enum wlr_log_importance log_get_level (enum log_subsystem subsystem);
+const char             *log_subsystem_name (enum log_subsystem subsystem);
+const char             *log_level_name (enum wlr_log_importance level);
+bool                    log_parse_level (const char *name, enum wlr_log_importance *level);
+
+/* Logs a one-line summary of the histogram at info level. */
+void log_histogram (const struct histogram *hist, const char *label);
+
+#endif // COMP_LOG_H
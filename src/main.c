@@ -2,45 +2,255 @@
 #include "xdg-shell-protocol.h"
 
 #include "nwm_server.h"
+#include "alloc.h"
+#include "animation.h"
+#include "capture.h"
+#include "damage_vis.h"
+#include "focus.h"
+#include "input/constraint.h"
 #include "input/cursor.h"
 #include "input/input.h"
+#include "input/input_thread.h"
 #include "input/seat.h"
+#include "idle.h"
+#include "ipc.h"
+#include "latency.h"
+#include "layer_shell.h"
+#include "log.h"
 #include "output.h"
+#include "overview.h"
+#include "pacing.h"
+#include "perf_overlay.h"
+#include "realtime.h"
+#include "record.h"
+#include "replay.h"
+#include "stats.h"
 #include "xdg_shell.h"
 
 #include <getopt.h>
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
+#include <wlr/backend/headless.h>
 #include <wlr/render/allocator.h>
 #include <wlr/render/wlr_renderer.h>
 #include <wlr/types/wlr_data_device.h>
+#include <wlr/types/wlr_ext_foreign_toplevel_list_v1.h>
+#include <wlr/types/wlr_fractional_scale_v1.h>
 #include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_pointer_constraints_v1.h>
+#include <wlr/types/wlr_relative_pointer_v1.h>
 #include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_single_pixel_buffer_v1.h>
 #include <wlr/types/wlr_subcompositor.h>
+#include <wlr/types/wlr_viewporter.h>
 #include <wlr/types/wlr_xcursor_manager.h>
 #include <wlr/util/log.h>
 
+static const char usage[] = "Usage: %s [options]\n"
+                            "  -s, --stats    log cursor and output counters every second\n"
+                            "  -l, --latency  measure input-to-present latency per device and client\n"
+                            "  -r, --record FILE\n"
+                            "                 record input and output events to FILE\n"
+                            "  -R, --replay FILE\n"
+                            "                 replay FILE on a headless backend, then exit\n"
+                            "  -F, --replay-fast\n"
+                            "                 replay as fast as possible instead of in real time\n"
+                            "  -i, --idle-timeout SEC\n"
+                            "                 power outputs down after SEC seconds without input\n"
+                            "  -S, --scale [OUTPUT=]SCALE\n"
+                            "                 output scale, may be fractional (e.g. 1.5); repeatable\n"
+                            "  -M, --mirror OUTPUT\n"
+                            "                 make every other output a mirror of OUTPUT\n"
+                            "  -D, --damage-vis\n"
+                            "                 tint repainted regions and log how much of each output\n"
+                            "                 is repainted; toggle at runtime with nwm-msg damage\n"
+                            "  -P, --perf-overlay\n"
+                            "                 show frame timing on every output; toggle at runtime\n"
+                            "                 with nwm-msg overlay\n"
+                            "  -T, --thumbnail-budget MIB\n"
+                            "                 memory for cached overview thumbnails (default 64)\n"
+                            "  -t, --input-thread\n"
+                            "                 read input devices on a dedicated thread\n"
+                            "  -L, --low-latency\n"
+                            "                 run the compositor thread at real-time (or raised)\n"
+                            "                 priority with its memory locked\n"
+                            "  -v, --log-level [SUBSYSTEM=]LEVEL\n"
+                            "                 silent, error, info or debug; subsystems are core, shell,\n"
+                            "                 output, input, perf and wlroots; repeatable\n"
+                            "  -h, --help     show this help\n";
+
 int main (int argc, char *argv[]) {
-        wlr_log_init (WLR_DEBUG, NULL);
+        log_init (WLR_DEBUG);
 
         struct comp_server server = { 0 };
         server.name               = "REAL";
-        server.wl_display         = wl_display_create();
+        server.overview.budget    = (size_t) OVERVIEW_DEFAULT_BUDGET_MIB << 20;
+        server.animation.enabled  = true;
+
+        static const struct option long_options[] = {
+                {           "stats",       no_argument, NULL, 's'},
+                {         "latency",       no_argument, NULL, 'l'},
+                {          "record", required_argument, NULL, 'r'},
+                {          "replay", required_argument, NULL, 'R'},
+                {     "replay-fast",       no_argument, NULL, 'F'},
+                {    "idle-timeout", required_argument, NULL, 'i'},
+                {           "scale", required_argument, NULL, 'S'},
+                {          "mirror", required_argument, NULL, 'M'},
+                {      "damage-vis",       no_argument, NULL, 'D'},
+                {    "perf-overlay",       no_argument, NULL, 'P'},
+                {"thumbnail-budget", required_argument, NULL, 'T'},
+                {    "input-thread",       no_argument, NULL, 't'},
+                {     "low-latency",       no_argument, NULL, 'L'},
+                {       "log-level", required_argument, NULL, 'v'},
+                {            "help",       no_argument, NULL, 'h'},
+                {                 0,                 0,    0,   0},
+        };
+        const char *record_path = NULL;
+        const char *replay_path = NULL;
+        int         opt;
+        while ((opt = getopt_long (argc, argv, "slr:R:Fi:S:M:DPT:tLv:h", long_options, NULL)) != -1) {
+                switch (opt) {
+                case 's':
+                        server.stats.enabled = true;
+                        break;
+                case 'l':
+                        server.latency.enabled = true;
+                        break;
+                case 'r':
+                        record_path = optarg;
+                        break;
+                case 'R':
+                        replay_path = optarg;
+                        break;
+                case 'F':
+                        server.replay.max_speed = true;
+                        break;
+                case 'i': {
+                        char      *end;
+                        errno          = 0;
+                        const long sec = strtol (optarg, &end, 10);
+                        if (errno != 0 || end == optarg || *end != '\0' || sec < 0
+                            || sec > INT_MAX / 1000) {
+                                fprintf (stderr, usage, argv[0]);
+                                return 1;
+                        }
+                        server.idle.timeout_ms = (int) sec * 1000;
+                        break;
+                }
+                case 'S':
+                        if (server.num_output_scales == MAX_OUTPUT_SCALES) {
+                                fprintf (stderr, "Too many --scale options\n");
+                                return 1;
+                        }
+                        struct output_scale *rule = &server.output_scales[server.num_output_scales++];
+                        char                *sep  = strchr (optarg, '=');
+                        char                *end;
+                        if (sep != NULL) {
+                                *sep       = '\0';
+                                rule->name = optarg;
+                                optarg     = sep + 1;
+                        }
+                        rule->scale = strtof (optarg, &end);
+                        if (end == optarg || *end != '\0' || !isfinite (rule->scale)
+                            || rule->scale <= 0) {
+                                fprintf (stderr, usage, argv[0]);
+                                return 1;
+                        }
+                        break;
+                case 'M':
+                        server.mirror.source_name = optarg;
+                        break;
+                case 'D':
+                        server.damage_vis.enabled = true;
+                        break;
+                case 'P':
+                        server.perf_overlay.enabled = true;
+                        break;
+                case 'T': {
+                        /* strtoul accepts "-1" as ULONG_MAX, so reject a minus sign first. */
+                        char               *end;
+                        errno                   = 0;
+                        const unsigned long mib = strtoul (optarg, &end, 10);
+                        if (errno != 0 || end == optarg || *end != '\0' || strchr (optarg, '-') != NULL
+                            || mib > SIZE_MAX >> 20) {
+                                fprintf (stderr, usage, argv[0]);
+                                return 1;
+                        }
+                        server.overview.budget = (size_t) mib << 20;
+                        break;
+                }
+                case 't':
+                        server.input_thread.enabled = true;
+                        break;
+                case 'L':
+                        server.realtime.enabled = true;
+                        break;
+                case 'v': {
+                        const char *subsystem = "all";
+                        char       *sep       = strchr (optarg, '=');
+                        if (sep != NULL) {
+                                *sep      = '\0';
+                                subsystem = optarg;
+                                optarg    = sep + 1;
+                        }
+                        if (!log_set_level (subsystem, optarg)) {
+                                fprintf (stderr, usage, argv[0]);
+                                return 1;
+                        }
+                        break;
+                }
+                case 'h':
+                        printf (usage, argv[0]);
+                        return 0;
+                default:
+                        fprintf (stderr, usage, argv[0]);
+                        return 1;
+                }
+        }
+
+        server.wl_display = wl_display_create();
         assert (server.wl_display);
 
         server.wl_event_loop = wl_display_get_event_loop (server.wl_display);
         assert (server.wl_event_loop);
+        alloc_tracking_init (server.wl_event_loop);
 
-        server.backend = wlr_backend_autocreate (server.wl_event_loop, NULL);
+        struct wlr_session *session = NULL;
+        if (replay_path != NULL) {
+                /* Replays run without any real hardware: input comes from the
+                 * recording and outputs are recreated as headless ones. */
+                if (!replay_open (&server, replay_path)) {
+                        return 1;
+                }
+                server.input_thread.enabled = false;
+                server.backend              = wlr_headless_backend_create (server.wl_event_loop);
+        } else {
+                /* Must run first: when it takes over the input devices, the
+                 * libinput backend is left out and only DRM is set up. */
+                if (server.input_thread.enabled && input_thread_open (&server)) {
+                        server.backend = input_thread_backend_create (&server, &session);
+                } else {
+                        server.backend = wlr_backend_autocreate (server.wl_event_loop, &session);
+                }
+        }
         assert (server.backend);
 
+        if (record_path != NULL && !record_open (&server, record_path)) {
+                return 1;
+        }
+
         server.renderer = wlr_renderer_autocreate (server.backend);
         assert (server.renderer);
 
@@ -56,11 +266,28 @@ int main (int argc, char *argv[]) {
          * to dig your fingers in and play with their behavior if you want. Note that
          * the clients cannot set the selection directly without compositor approval,
          * see the handling of the request_set_selection event below.*/
-        wlr_compositor_create (server.wl_display, 5, server.renderer);
+        wlr_compositor_create (server.wl_display, 6, server.renderer);
         wlr_subcompositor_create (server.wl_display);
         wlr_data_device_manager_create (server.wl_display);
 
-        server.output_layout = wlr_output_layout_create (server.wl_display);
+        /* Fractional scale tells clients the exact output scale, viewporter lets
+         * them attach buffers at that physical size. Compositor version 6 above
+         * adds the integer preferred buffer scale for clients without either. */
+        wlr_fractional_scale_manager_v1_create (server.wl_display, 1);
+        wlr_viewporter_create (server.wl_display);
+
+        /* Solid colour surfaces (backgrounds, dimming layers, letterboxing) can
+         * attach a 1x1 single-pixel buffer and stretch it with a viewport. The
+         * scene draws those as plain rects: nothing to upload or sample. */
+        wlr_single_pixel_buffer_manager_v1_create (server.wl_display);
+
+        /* FIFO and commit timing let clients queue frames for a given refresh
+         * cycle or presentation time instead of pacing on frame callbacks. */
+        pacing_init (&server);
+
+        server.output_layout               = wlr_output_layout_create (server.wl_display);
+        server.output_layout_change.notify = output_layout_change_notify;
+        wl_signal_add (&server.output_layout->events.change, &server.output_layout_change);
 
         // Listening for new backend outputs
         wl_list_init (&server.outputs);
@@ -70,13 +297,33 @@ int main (int argc, char *argv[]) {
         server.scene        = wlr_scene_create();
         server.scene_layout = wlr_scene_attach_output_layout (server.scene, server.output_layout);
 
-        wl_list_init (&server.toplevels);
+        /* One tree per layer, created bottom-most first. Their order never
+         * changes, everything else is stacked inside them. */
+        for (int i = 0; i < SCENE_LAYER_COUNT; i++) {
+                server.layers[i] = wlr_scene_tree_create (&server.scene->tree);
+        }
+        animation_init (&server);
+        damage_vis_init (&server);
+        overview_init (&server);
+        perf_overlay_init (&server);
+
+        /* Windows are listed for clients that pick one to capture, screen
+         * recorders and the like. */
+        server.foreign_toplevel_list = wlr_ext_foreign_toplevel_list_v1_create (server.wl_display, 1);
+        capture_init (&server);
+
+        focus_init (&server);
         server.xdg_shell               = wlr_xdg_shell_create (server.wl_display, 3);
         server.new_xdg_toplevel.notify = new_xdg_toplevel_notify;
         server.new_xdg_popup.notify    = new_xdg_popup_notify;
         wl_signal_add (&server.xdg_shell->events.new_toplevel, &server.new_xdg_toplevel);
         wl_signal_add (&server.xdg_shell->events.new_popup, &server.new_xdg_popup);
 
+        /* Panels, docks, wallpapers and lock screens. */
+        server.layer_shell              = wlr_layer_shell_v1_create (server.wl_display, 4);
+        server.new_layer_surface.notify = new_layer_surface_notify;
+        wl_signal_add (&server.layer_shell->events.new_surface, &server.new_layer_surface);
+
         /*
          * Creates a cursor, which is a wlroots utility for tracking the cursor
          * image shown on screen.
@@ -103,6 +350,7 @@ int main (int argc, char *argv[]) {
         server.cursor_button.notify          = server_cursor_button;
         server.cursor_axis.notify            = server_cursor_axis;
         server.cursor_frame.notify           = server_cursor_frame;
+        wl_list_init (&server.cursor_image_surface_destroy.link);
 
         wl_signal_add (&server.cursor->events.motion, &server.cursor_motion);
         wl_signal_add (&server.cursor->events.motion_absolute, &server.cursor_motion_absolute);
@@ -110,6 +358,15 @@ int main (int argc, char *argv[]) {
         wl_signal_add (&server.cursor->events.axis, &server.cursor_axis);
         wl_signal_add (&server.cursor->events.frame, &server.cursor_frame);
 
+        /* Relative pointer and pointer constraints let games and 3D tools receive
+         * raw motion deltas and lock or confine the pointer to their surface,
+         * instead of warping the cursor back every frame. */
+        server.relative_pointer_mgr          = wlr_relative_pointer_manager_v1_create (server.wl_display);
+        server.pointer_constraints           = wlr_pointer_constraints_v1_create (server.wl_display);
+        server.new_pointer_constraint.notify = server_new_pointer_constraint;
+        wl_signal_add (&server.pointer_constraints->events.new_constraint,
+                       &server.new_pointer_constraint);
+
         // Listen for new inputs and seat setup
         wl_list_init (&server.keyboards);
         server.new_input.notify             = server_new_input;
@@ -122,6 +379,17 @@ int main (int argc, char *argv[]) {
         wl_signal_add (&server.seat->events.request_set_cursor, &server.request_cursor);
         wl_signal_add (&server.seat->events.request_set_selection, &server.request_set_selection);
 
+        /* Pointer constraints also follow keyboard focus. */
+        server.keyboard_focus_change.notify = seat_keyboard_focus_change;
+        wl_signal_add (&server.seat->keyboard_state.events.focus_change,
+                       &server.keyboard_focus_change);
+
+        /* Instrumentation has to be ready before the backend starts, since the
+         * first output commits happen during wlr_backend_start. */
+        stats_init (&server);
+        latency_init (&server);
+        idle_init (&server);
+
         // Create wayland socket
         const char *socket = wl_display_add_socket_auto (server.wl_display);
         if (socket == NULL) {
@@ -139,12 +407,32 @@ int main (int argc, char *argv[]) {
 
         printf ("Running compositor on wayland display '%s'\n", socket);
         setenv ("WAYLAND_DISPLAY", socket, true);
+        ipc_init (&server, socket);
+
+        if (replay_path != NULL) {
+                replay_start (&server);
+        }
+        input_thread_start (&server, session);
+        realtime_init (&server);
 
         // wl_display_init_shm (server.wl_display);
 
-        wl_display_run (server.wl_display);
+        server_run (&server);
 
+        ipc_finish (&server);
+        stats_finish (&server);
+        damage_vis_finish (&server);
+        animation_finish (&server);
+        perf_overlay_finish (&server);
+        overview_finish (&server);
+        idle_finish (&server);
         wl_display_destroy_clients (server.wl_display);
+        pacing_finish (&server);
+        focus_finish (&server);
+        latency_finish (&server);
+        replay_close (&server);
+        input_thread_finish (&server);
+        record_close (&server);
         wlr_scene_node_destroy (&server.scene->tree.node);
         wlr_xcursor_manager_destroy (server.cursor_mgr);
         wlr_cursor_destroy (server.cursor);
@@ -152,6 +440,11 @@ int main (int argc, char *argv[]) {
         wlr_renderer_destroy (server.renderer);
         wlr_backend_destroy (server.backend);
         wl_display_destroy (server.wl_display);
+
+        /* Clients, devices and outputs are all gone, and with them every
+         * object nwm allocated for them. */
+        alloc_report_leaks ();
         wlr_log (WLR_INFO, "Pass");
+        log_finish ();
         return 0;
 }
\ No newline at end of file
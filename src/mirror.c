@@ -0,0 +1,151 @@
+#include "mirror.h"
+#include "nwm_server.h"
+#include "output.h"
+#include "timespec.h"
+
+#include <string.h>
+#include <wlr/render/pass.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+bool mirror_output_is_mirror (struct comp_server *server, const char *name) {
+        /* With no source there is nothing to mirror, and every output shows
+         * the desktop until it appears. */
+        const struct comp_mirror *mirror = &server->mirror;
+        return mirror->source != NULL && strcmp (name, mirror->source_name) != 0;
+}
+
+bool mirror_output_is_source (struct comp_server *server, const char *name) {
+        const char *source_name = server->mirror.source_name;
+        return source_name != NULL && strcmp (name, source_name) == 0;
+}
+
+void mirror_source_add (struct comp_server *server, struct comp_output *output) {
+        /* The hardware cursor plane is not part of the committed buffer, so
+         * the source composites its cursor in software for the mirrors to
+         * show it as well. */
+        server->mirror.source = output;
+        wlr_output_lock_software_cursors (output->wlr_output, true);
+        wlr_log (WLR_INFO, "Output %s is the mirror source", output->wlr_output->name);
+
+        /* Outputs that came first were showing the desktop meanwhile. */
+        struct comp_output *other;
+        wl_list_for_each (other, &server->outputs, link) {
+                if (other != output && !other->mirror) {
+                        output_set_mirror (other);
+                }
+        }
+}
+
+void mirror_source_commit (struct comp_server *server, struct wlr_output_event_commit *event) {
+        /* Keep the newest source buffer around and let the mirrors know. The
+         * lock keeps the swapchain from handing it out for rendering again
+         * until a newer one replaces it. */
+        struct comp_mirror *mirror = &server->mirror;
+        if (mirror->source == NULL || event->output != mirror->source->wlr_output
+            || !(event->state->committed & WLR_OUTPUT_STATE_BUFFER)
+            || event->state->buffer == NULL) {
+                return;
+        }
+        if (mirror->buffer != NULL) {
+                wlr_buffer_unlock (mirror->buffer);
+        }
+        mirror->buffer = wlr_buffer_lock (event->state->buffer);
+        mirror->seq++;
+
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                if (output->mirror && output->wlr_output->enabled) {
+                        wlr_output_schedule_frame (output->wlr_output);
+                }
+        }
+}
+
+static struct wlr_box fit_box (int src_width, int src_height, int width, int height) {
+        /* Largest box with the source aspect ratio that fits, centered. */
+        struct wlr_box box = { .width = width, .height = height };
+        if ((int64_t) src_width * height > (int64_t) src_height * width) {
+                box.height = (int) ((int64_t) src_height * width / src_width);
+        } else {
+                box.width = (int) ((int64_t) src_width * height / src_height);
+        }
+        box.x = (width - box.width) / 2;
+        box.y = (height - box.height) / 2;
+        return box;
+}
+
+void mirror_output_frame (struct comp_output *output) {
+        /* Called instead of the scene commit on mirrors. Nothing is drawn
+         * unless the source produced a new buffer since our last frame. */
+        struct comp_server *server     = output->server;
+        struct comp_mirror *mirror     = &server->mirror;
+        struct wlr_output  *wlr_output = output->wlr_output;
+        if (mirror->buffer == NULL || output->mirror_seq == mirror->seq) {
+                return;
+        }
+
+        struct timespec start, end;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+
+        struct wlr_texture *texture = wlr_texture_from_buffer (server->renderer, mirror->buffer);
+        if (texture == NULL) {
+                wlr_log (WLR_ERROR, "Mirror %s: cannot import source buffer", wlr_output->name);
+                return;
+        }
+
+        struct wlr_output_state state;
+        wlr_output_state_init (&state);
+        struct wlr_render_pass *pass = wlr_output_begin_render_pass (wlr_output, &state, NULL, NULL);
+        if (pass == NULL) {
+                wlr_log (WLR_ERROR, "Mirror %s: cannot begin render pass", wlr_output->name);
+                wlr_output_state_finish (&state);
+                wlr_texture_destroy (texture);
+                return;
+        }
+
+        const struct wlr_box full = { .width = wlr_output->width, .height = wlr_output->height };
+        const struct wlr_box dst
+            = fit_box (texture->width, texture->height, wlr_output->width, wlr_output->height);
+        if (!wlr_box_equal (&dst, &full)) {
+                wlr_render_pass_add_rect (pass,
+                                          &(struct wlr_render_rect_options) {
+                                              .box   = full,
+                                              .color = { .r = 0, .g = 0, .b = 0, .a = 1 },
+                                          });
+        }
+        wlr_render_pass_add_texture (pass,
+                                     &(struct wlr_render_texture_options) {
+                                         .texture     = texture,
+                                         .dst_box     = dst,
+                                         .filter_mode = WLR_SCALE_FILTER_BILINEAR,
+                                     });
+
+        if (!wlr_render_pass_submit (pass) || !wlr_output_commit_state (wlr_output, &state)) {
+                wlr_log (WLR_ERROR, "Mirror %s: commit failed", wlr_output->name);
+        }
+        wlr_output_state_finish (&state);
+        wlr_texture_destroy (texture);
+        output->mirror_seq = mirror->seq;
+
+        clock_gettime (CLOCK_MONOTONIC, &end);
+        server->stats.mirror_render_usec += timespec_diff_usec (&end, &start);
+}
+
+void mirror_output_destroy (struct comp_output *output) {
+        /* Mirrors keep showing the last frame if their source goes away. */
+        struct comp_mirror *mirror = &output->server->mirror;
+        if (mirror->source != output) {
+                return;
+        }
+        if (mirror->buffer != NULL) {
+                wlr_buffer_unlock (mirror->buffer);
+                mirror->buffer = NULL;
+        }
+        mirror->source = NULL;
+        wlr_log (WLR_INFO,
+                 "Mirror source %s is gone, mirrors keep its last frame",
+                 mirror->source_name);
+}
@@ -0,0 +1,34 @@
+#ifndef COMP_MIRROR_H
+#define COMP_MIRROR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct comp_output;
+struct comp_server;
+struct wlr_buffer;
+struct wlr_output_event_commit;
+
+/** Output mirroring. With a source configured, every other output becomes a
+ * mirror of it: it is kept out of the layout and the scene, and instead of
+ * rendering the scene it blits the last buffer the source committed, scaled
+ * to fit. The scene is walked once per source frame however many mirrors
+ * there are; each mirror costs a single textured quad. Outputs only become
+ * mirrors once the source exists; the ones that came before it are turned
+ * into mirrors when it does. */
+struct comp_mirror
+{
+        const char         *source_name; // NULL disables mirroring
+        struct comp_output *source;
+        struct wlr_buffer  *buffer; // last buffer committed on the source, locked
+        uint64_t            seq;    // bumped for every new source buffer
+};
+
+bool mirror_output_is_mirror (struct comp_server *server, const char *name);
+bool mirror_output_is_source (struct comp_server *server, const char *name);
+void mirror_source_add (struct comp_server *server, struct comp_output *output);
+void mirror_source_commit (struct comp_server *server, struct wlr_output_event_commit *event);
+void mirror_output_frame (struct comp_output *output);
+void mirror_output_destroy (struct comp_output *output);
+
+#endif // COMP_MIRROR_H
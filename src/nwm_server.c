@@ -3,3 +3,33 @@
 //
 
 #include "nwm_server.h"
+
+#include <errno.h>
+#include <poll.h>
+#include <wlr/util/log.h>
+
+/** wl_display_run, except that input queued by the input thread is handed
+ * to the seat as soon as the loop wakes up, before any other event source is
+ * dispatched. wl_event_loop_dispatch runs sources in whatever order epoll
+ * reports them, so the loop waits on the epoll fd itself and only then lets
+ * it dispatch, without waiting again. */
+void server_run (struct comp_server *server) {
+        struct pollfd pfd = { .fd = wl_event_loop_get_fd (server->wl_event_loop), .events = POLLIN };
+        server->running   = true;
+        while (server->running) {
+                /* What wl_event_loop_dispatch would do before waiting. */
+                wl_event_loop_dispatch_idle (server->wl_event_loop);
+                wl_display_flush_clients (server->wl_display);
+                if (poll (&pfd, 1, -1) < 0 && errno != EINTR) {
+                        wlr_log_errno (WLR_ERROR, "Event loop: poll failed");
+                        break;
+                }
+                input_thread_dispatch (server);
+                wl_event_loop_dispatch (server->wl_event_loop, 0);
+        }
+}
+
+void server_terminate (struct comp_server *server) {
+        server->running = false;
+        wl_display_terminate (server->wl_display);
+}
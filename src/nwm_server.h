@@ -5,6 +5,23 @@
 #ifndef COMP_SERVER_H
 #define COMP_SERVER_H
 
+#include "animation.h"
+#include "capture.h"
+#include "damage_vis.h"
+#include "focus.h"
+#include "idle.h"
+#include "input/input_thread.h"
+#include "ipc.h"
+#include "latency.h"
+#include "mirror.h"
+#include "overview.h"
+#include "pacing.h"
+#include "perf_overlay.h"
+#include "realtime.h"
+#include "record.h"
+#include "replay.h"
+#include "stats.h"
+#include "virtual_output.h"
 #include "xdg_shell.h"
 
 #include <wayland-server-core.h>
@@ -18,9 +35,50 @@ enum cursor_mode
         CURSOR_RESIZE,
 };
 
+enum cursor_image_type
+{
+        CURSOR_IMAGE_NONE,
+        CURSOR_IMAGE_XCURSOR,
+        CURSOR_IMAGE_SURFACE,
+};
+
+/** What the cursor currently shows, so identical requests can be dropped.
+ * The xcursor scale is not tracked: wlr_cursor resolves the theme image for
+ * each output's scale itself, from the images preloaded at hotplug. */
+struct cursor_image
+{
+        enum cursor_image_type type;
+        const char            *xcursor_name;
+        struct wlr_surface    *surface; // NULL hides the cursor
+        int32_t                hotspot_x, hotspot_y;
+};
+
+/** Fixed stacking order of the scene, bottom-most first. Toplevels live in
+ * SCENE_LAYER_NORMAL; layer shell surfaces in the other four. Raising a
+ * window only reorders its siblings, so it can never cover a panel. */
+enum scene_layer
+{
+        SCENE_LAYER_BACKGROUND,
+        SCENE_LAYER_BOTTOM,
+        SCENE_LAYER_NORMAL,
+        SCENE_LAYER_TOP,
+        SCENE_LAYER_OVERLAY,
+        SCENE_LAYER_COUNT,
+};
+
+#define MAX_OUTPUT_SCALES 16
+
+/** Scale applied to outputs at hotplug; a NULL name matches every output. */
+struct output_scale
+{
+        const char *name;
+        float       scale;
+};
+
 struct comp_server
 {
         char                           *name; // TEST
+        bool                            running; // cleared by server_terminate
         struct wl_display              *wl_display;    // accepts clients from unix socket
         struct wl_event_loop           *wl_event_loop; // wl_display_get_event_loop (wl_display)
         struct wlr_backend             *backend;       // abstracts hardware i/o
@@ -29,11 +87,17 @@ struct comp_server
         struct wlr_output_layout       *output_layout;
         struct wlr_scene               *scene;
         struct wlr_scene_output_layout *scene_layout;
+        struct wlr_scene_tree          *layers[SCENE_LAYER_COUNT];
 
         struct wlr_xdg_shell *xdg_shell;
         struct wl_listener    new_xdg_toplevel;
         struct wl_listener    new_xdg_popup;
-        struct wl_list        toplevels;
+        struct wl_list        toplevels; // toplevel::link, most recently focused first
+
+        struct wlr_ext_foreign_toplevel_list_v1 *foreign_toplevel_list;
+
+        struct wlr_layer_shell_v1 *layer_shell;
+        struct wl_listener         new_layer_surface;
 
         struct wlr_cursor          *cursor;
         struct wlr_xcursor_manager *cursor_mgr;
@@ -42,6 +106,14 @@ struct comp_server
         struct wl_listener          cursor_button;
         struct wl_listener          cursor_axis;
         struct wl_listener          cursor_frame;
+        struct cursor_image         cursor_image;
+        struct wl_listener          cursor_image_surface_destroy;
+
+        struct wlr_relative_pointer_manager_v1 *relative_pointer_mgr;
+        struct wlr_pointer_constraints_v1      *pointer_constraints;
+        struct wlr_pointer_constraint_v1       *active_constraint;
+        struct wl_listener                      new_pointer_constraint;
+        struct wl_listener                      keyboard_focus_change;
 
         struct wlr_seat   *seat;
         struct wl_listener new_input;
@@ -54,8 +126,32 @@ struct comp_server
         struct wlr_box     grab_geobox;
         uint32_t           resize_edges;
 
-        struct wl_listener new_output;
-        struct wl_list     outputs; // comp_output::link
+        struct wl_listener  new_output;
+        struct wl_list      outputs; // comp_output::link
+        struct wl_listener  output_layout_change;
+        struct output_scale output_scales[MAX_OUTPUT_SCALES];
+        int                 num_output_scales;
+
+        struct comp_animation    animation;
+        struct comp_capture      capture;
+        struct comp_damage_vis   damage_vis;
+        struct comp_focus        focus;
+        struct comp_idle         idle;
+        struct comp_input_thread input_thread;
+        struct comp_ipc          ipc;
+        struct comp_stats        stats;
+        struct comp_latency      latency;
+        struct comp_mirror       mirror;
+        struct comp_overview     overview;
+        struct comp_pacing       pacing;
+        struct comp_perf_overlay perf_overlay;
+        struct comp_realtime     realtime;
+        struct comp_record       record;
+        struct comp_replay       replay;
+        struct comp_virtual      virtual_output;
 };
 
+void server_run (struct comp_server *server);
+void server_terminate (struct comp_server *server);
+
 #endif // COMP_SERVER_H
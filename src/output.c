@@ -4,8 +4,21 @@
 #define _GNU_SOURCE
 
 #include "output.h"
+#include "alloc.h"
+#include "animation.h"
+#include "capture.h"
+#include "damage_vis.h"
+#include "latency.h"
+#include "layer_shell.h"
+#include "mirror.h"
+#include "pacing.h"
+#include "perf_overlay.h"
+#include "record.h"
+#include "timespec.h"
+#include "virtual_output.h"
 
 #include <stdlib.h>
+#include <string.h>
 #include <wlr/util/log.h>
 
 #include <assert.h>
@@ -18,6 +31,7 @@
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_scene.h>
+#include <wlr/types/wlr_xcursor_manager.h>
 
 static void output_request_state_notify (struct wl_listener *listener, void *data) {
         /* This function is called when the backend requests a new state for
@@ -28,29 +42,190 @@ static void output_request_state_notify (struct wl_listener *listener, void *dat
         wlr_output_commit_state (output->wlr_output, event->state);
 }
 
+static void output_commit_notify (struct wl_listener *listener, void *data) {
+        struct comp_output                   *output = wl_container_of (listener, output, commit);
+        const struct wlr_output_event_commit *event  = data;
+        if (event->state->committed & WLR_OUTPUT_STATE_BUFFER) {
+                /* Only count frames, not mode or power changes. */
+                output->server->stats.output_commits++;
+                output->commits++;
+                if (output->overlay_redrawn) {
+                        output->overlay_own_commits++;
+                }
+                output->overlay_redrawn = false;
+        }
+        latency_output_commit (output->server, data);
+        mirror_source_commit (output->server, data);
+        capture_output_commit (output, data);
+        virtual_output_commit (output, data);
+}
+
+/* Presentations further apart than this many refresh cycles are not back to
+ * back: nothing needed drawing in between, no frame was missed. */
+#define OUTPUT_BACK_TO_BACK_CYCLES 4
+#define OUTPUT_DEFAULT_REFRESH_USEC 16667
+
+static void output_frame_timing (struct comp_output                    *output,
+                                 const struct wlr_output_event_present *event) {
+        if (!event->presented) {
+                return;
+        }
+        struct timespec when;
+        if (event->when != NULL) {
+                when = *event->when;
+        } else {
+                clock_gettime (CLOCK_MONOTONIC, &when);
+        }
+        const int64_t interval = timespec_diff_usec (&when, &output->last_frame);
+        const int64_t refresh  = event->refresh > 0 ? event->refresh / 1000 : OUTPUT_DEFAULT_REFRESH_USEC;
+        output->last_frame     = when;
+
+        /* A frame drawn on a frame event is due at the next refresh. Rounded
+         * to whole cycles, every cycle it took past the first was missed.
+         * Cycles with nothing to draw are not: a client drawing at half the
+         * refresh rate misses nothing. */
+        if (output->frame_wanted.tv_sec != 0 || output->frame_wanted.tv_nsec != 0) {
+                const int64_t late   = timespec_diff_usec (&when, &output->frame_wanted);
+                const int64_t cycles = (late + refresh / 2) / refresh;
+                if (cycles > 1) {
+                        output->missed_frames += cycles - 1;
+                }
+                output->frame_wanted = (struct timespec) { 0 };
+        }
+
+        if (interval > 0 && interval <= refresh * OUTPUT_BACK_TO_BACK_CYCLES) {
+                const uint32_t head      = output->frame_head++ % OUTPUT_FRAME_HISTORY;
+                output->frame_usec[head] = (uint32_t) interval;
+        }
+}
+
+static void output_present_notify (struct wl_listener *listener, void *data) {
+        struct comp_output *output = wl_container_of (listener, output, present);
+        record_event (output->server, RECORD_OUTPUT_PRESENT, output->record_id, NULL, 0);
+        latency_output_present (output->server, data);
+        output_frame_timing (output, data);
+}
+
 static void output_frame_notify (struct wl_listener *listener, void *data) {
         struct comp_output *output = wl_container_of (listener, output, frame);
         struct wlr_scene   *scene  = output->server->scene;
 
+        record_event (output->server, RECORD_OUTPUT_FRAME, output->record_id, NULL, 0);
+
+        /* Nothing is rendered and no frame callbacks go out while idle. */
+        if (output->server->idle.idle) {
+                return;
+        }
+
+        if (output->mirror) {
+                mirror_output_frame (output);
+                return;
+        }
+
         struct wlr_scene_output *scene_output
             = wlr_scene_get_scene_output (scene, output->wlr_output);
 
+        /* Animations move nodes first, so their damage makes this frame. */
+        animation_output_frame (output);
+
         /* Render the scene if needed and commit the output */
-        if (scene_output != NULL) // May be unnecessary but may be necessary but may be unnecessary
+        struct timespec start, end;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        if (scene_output != NULL) { // May be unnecessary but may be necessary but may be unnecessary
+                if (wlr_scene_output_needs_frame (scene_output) && output->frame_wanted.tv_sec == 0
+                    && output->frame_wanted.tv_nsec == 0) {
+                        output->frame_wanted = start;
+                }
+                damage_vis_output_frame (output, scene_output);
                 wlr_scene_output_commit (scene_output, NULL);
+        }
+        clock_gettime (CLOCK_MONOTONIC, &end);
+        output->server->stats.scene_render_usec += timespec_diff_usec (&end, &start);
 
         struct timespec now;
         clock_gettime (CLOCK_MONOTONIC, &now);
         wlr_scene_output_send_frame_done (scene_output, &now);
+
+        /* Surfaces pacing themselves may queue their next frame now. */
+        pacing_output_frame (output);
 }
 
 static void output_destroy_notify (struct wl_listener *listener, void *data) {
         struct comp_output *output = wl_container_of (listener, output, destroy);
         wlr_log (WLR_INFO, "Output %s Destroyed", output->wlr_output->name);
+        latency_output_destroy (output->server, output->wlr_output);
+        layers_output_destroy (output);
+        mirror_output_destroy (output);
+        perf_overlay_output_destroy (output);
+        capture_output_destroy (output);
+        virtual_output_destroy (output);
         wl_list_remove (&output->link);
         wl_list_remove (&output->destroy.link);
         wl_list_remove (&output->frame.link);
-        free (output);
+        wl_list_remove (&output->commit.link);
+        wl_list_remove (&output->present.link);
+        wl_list_remove (&output->request_state.link);
+        nwm_free (output);
+}
+
+void output_set_mirror (struct comp_output *output) {
+        /* Takes an output that was set up to show the desktop out of the
+         * layout and the scene, as if it had been created a mirror. */
+        struct comp_server      *server = output->server;
+        struct wlr_scene_output *scene_output
+            = wlr_scene_get_scene_output (server->scene, output->wlr_output);
+        layers_output_destroy (output);
+        perf_overlay_output_destroy (output);
+        if (scene_output != NULL) {
+                wlr_scene_output_destroy (scene_output);
+        }
+        wlr_output_layout_remove (server->output_layout, output->wlr_output);
+        output->mirror = true;
+        wlr_log (WLR_INFO,
+                 "Output %s now mirrors %s",
+                 output->wlr_output->name,
+                 server->mirror.source_name);
+}
+
+void output_damage_whole (struct comp_output *output) {
+        /* The scene has no public way to damage one of its outputs as a
+         * whole, but adding and removing a node damages everything under it.
+         * The rect is gone before the next frame, so it is never drawn. */
+        struct wlr_box box;
+        wlr_output_layout_get_box (output->server->output_layout, output->wlr_output, &box);
+        if (wlr_box_empty (&box)) {
+                return;
+        }
+        static const float     color[4] = { 0, 0, 0, 1 };
+        struct wlr_scene_rect *rect
+            = wlr_scene_rect_create (&output->server->scene->tree, box.width, box.height, color);
+        wlr_scene_node_set_position (&rect->node, box.x, box.y);
+        wlr_scene_node_destroy (&rect->node);
+}
+
+static float output_scale_for (struct comp_server *server, const char *name) {
+        /* Rules naming the output win over the catch-all one. */
+        float scale = 1.0f;
+        for (int i = 0; i < server->num_output_scales; i++) {
+                const struct output_scale *rule = &server->output_scales[i];
+                if (rule->name == NULL) {
+                        scale = rule->scale;
+                } else if (strcmp (rule->name, name) == 0) {
+                        return rule->scale;
+                }
+        }
+        return scale;
+}
+
+/** Raised whenever an output is added, moved, or changes mode, scale or
+ * transform. Layer surfaces are laid out relative to their output, so this
+ * is the one place (besides their own commits) that rearranges them. */
+void output_layout_change_notify (struct wl_listener *listener, void *data) {
+        struct comp_server *server = wl_container_of (listener, server, output_layout_change);
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                layers_arrange (output);
+        }
 }
 
 /** Raised by backend when a new display becomes available */
@@ -71,25 +246,62 @@ void new_output_notify (struct wl_listener *listener, void *data) {
                 wlr_output_state_set_mode (&state, mode);
         }
 
+        /* Fractional scales are fine: with wp_fractional_scale and wp_viewporter
+         * the scene tells clients the exact scale, so they can allocate buffers
+         * at the physical size instead of rendering at 2x and being downsampled. */
+        wlr_output_state_set_scale (&state, output_scale_for (server, wlr_output->name));
+
         /* Atomically applies the new output state. */
         wlr_output_commit_state (wlr_output, &state);
         wlr_output_state_finish (&state);
 
-        struct comp_output *output = calloc (1, sizeof (struct comp_output));
+        /* Load the cursor theme at this output's scale now, rather than on the
+         * first motion event that crosses onto it. */
+        wlr_xcursor_manager_load (server->cursor_mgr, wlr_output->scale);
+
+        struct comp_output *output = nwm_alloc (ALLOC_OUTPUT, struct comp_output);
         output->server             = server;
         output->wlr_output         = wlr_output;
+        output->record_id          = record_output_add (server, wlr_output);
+        wlr_output->data           = output;
         clock_gettime (CLOCK_MONOTONIC, &output->last_frame);
+        wl_list_init (&output->layer_surfaces);
         wl_list_insert (&server->outputs, &output->link);
 
         output->frame.notify = output_frame_notify;
         wl_signal_add (&wlr_output->events.frame, &output->frame);
 
+        output->commit.notify = output_commit_notify;
+        wl_signal_add (&wlr_output->events.commit, &output->commit);
+
+        output->present.notify = output_present_notify;
+        wl_signal_add (&wlr_output->events.present, &output->present);
+
         output->destroy.notify = output_destroy_notify;
         wl_signal_add (&wlr_output->events.destroy, &output->destroy);
 
         output->request_state.notify = output_request_state_notify;
         wl_signal_add (&wlr_output->events.request_state, &output->request_state);
 
+        /* Mirrors stay out of the layout and the scene: no wl_output global,
+         * no cursor, no surfaces, nothing to render but the source's frames. */
+        if (mirror_output_is_mirror (server, wlr_output->name)) {
+                output->mirror = true;
+                wlr_log (WLR_INFO,
+                         "Output %s Created, mirroring %s",
+                         wlr_output->name,
+                         server->mirror.source_name);
+                return;
+        }
+        if (mirror_output_is_source (server, wlr_output->name)) {
+                mirror_source_add (server, output);
+        } else if (server->mirror.source_name != NULL) {
+                wlr_log (WLR_ERROR,
+                         "Output %s: no mirror source %s yet, showing the desktop",
+                         wlr_output->name,
+                         server->mirror.source_name);
+        }
+
         /* Adds this to the output layout. The add_auto function arranges outputs
          * from left-to-right in the order they appear. A more sophisticated
          * compositor would let the user configure the arrangement of outputs in the
@@ -7,13 +7,42 @@
 
 #include "nwm_server.h"
 
+#include <wlr/util/box.h>
+
+#define OUTPUT_FRAME_HISTORY 64
+
 struct comp_output
 {
         struct wlr_output  *wlr_output;
         struct comp_server *server;
-        struct timespec     last_frame;
+        struct timespec     last_frame; // last presentation
+        uint16_t            record_id;
+        bool                idle_off;      // powered down by the idle manager
+        bool                mirror;        // shows the mirror source instead of the scene
+        uint64_t            mirror_seq;    // source buffer shown, see comp_mirror::seq
+        uint64_t            damage_pixels; // repainted this window, see comp_damage_vis
+        uint64_t            damage_frames; // frames that repainted anything this window
+
+        /* Frame timing, kept for the performance overlay. Intervals between
+         * back-to-back presentations in microseconds, oldest at frame_head. */
+        uint32_t                 frame_usec[OUTPUT_FRAME_HISTORY];
+        uint32_t                 frame_head;
+        struct timespec          frame_wanted;        // had something to draw, 0 once presented
+        uint64_t                 missed_frames;       // refresh cycles a frame to draw was late by
+        uint64_t                 commits;             // frames committed since creation
+        uint64_t                 overlay_own_commits; // of those, the ones only the overlay caused
+        uint64_t                 overlay_commits;     // other commits at the last overlay update
+        bool                     overlay_redrawn;     // the next commit is the overlay's own
+        struct wlr_scene_buffer *overlay;             // NULL unless the overlay is shown
+        struct wlr_buffer       *capture_buffer;      // last committed, held while captured
+        struct virtual_ring     *virtual_ring;        // NULL unless added at runtime, see comp_virtual
+
+        struct wl_list layer_surfaces; // layer_surface::link
+        struct wlr_box usable_area;    // layout coords, minus exclusive zones
 
         struct wl_listener frame;
+        struct wl_listener commit;
+        struct wl_listener present;
         struct wl_listener request_state;
         struct wl_listener destroy;
 
@@ -21,5 +50,8 @@ struct comp_output
 };
 
 void new_output_notify (struct wl_listener *listener, void *data);
+void output_layout_change_notify (struct wl_listener *listener, void *data);
+void output_set_mirror (struct comp_output *output);
+void output_damage_whole (struct comp_output *output);
 
 #endif // COMP_OUTPUT_H
@@ -0,0 +1,368 @@
+#include "overview.h"
+#include "animation.h"
+#include "input/keyboard.h"
+#include "nwm_server.h"
+#include "output.h"
+#include "timespec.h"
+
+#include <drm_fourcc.h>
+#include <pixman.h>
+#include <time.h>
+#include <wlr/render/allocator.h>
+#include <wlr/render/pass.h>
+#include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_buffer.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+#define THUMBNAIL_MAX_SIZE    512 // longest side, in pixels
+#define THUMBNAIL_INTERVAL_MS 200 // per toplevel
+#define OVERVIEW_GAP          24
+
+static const float overview_backdrop[4] = { 0.05f, 0.05f, 0.05f, 0.9f };
+
+static void thumbnail_drop (struct comp_overview *overview, struct thumbnail *thumbnail) {
+        /* The scene keeps its own lock while the thumbnail is on screen. */
+        if (thumbnail->buffer == NULL) {
+                return;
+        }
+        wlr_buffer_drop (thumbnail->buffer);
+        thumbnail->buffer = NULL;
+        overview->used -= thumbnail->bytes;
+        thumbnail->bytes = 0;
+        wl_list_remove (&thumbnail->link);
+}
+
+static void overview_evict (struct comp_overview *overview, struct thumbnail *replaced, size_t incoming) {
+        /* Least recently used first, never what is on screen. The buffer
+         * being replaced is about to go anyway. */
+        const size_t      replaced_bytes = replaced != NULL ? replaced->bytes : 0;
+        struct thumbnail *thumbnail, *tmp;
+        wl_list_for_each_reverse_safe (thumbnail, tmp, &overview->lru, link) {
+                if (overview->used - replaced_bytes + incoming <= overview->budget) {
+                        return;
+                }
+                if (thumbnail == replaced || thumbnail->node != NULL) {
+                        continue;
+                }
+                thumbnail_drop (overview, thumbnail);
+                thumbnail->evicted = true;
+        }
+}
+
+static int scale_round (double value) {
+        return (int) (value + 0.5);
+}
+
+static bool thumbnail_render (struct comp_server *server, struct toplevel *toplevel) {
+        /* Draws the toplevel into a new buffer no larger than
+         * THUMBNAIL_MAX_SIZE on its longest side. */
+        struct comp_overview   *overview    = &server->overview;
+        struct thumbnail       *thumbnail   = &toplevel->thumbnail;
+        struct wlr_xdg_surface *xdg_surface = toplevel->xdg_toplevel->base;
+
+        struct wlr_box geometry;
+        wlr_xdg_surface_get_geometry (xdg_surface, &geometry);
+        if (wlr_box_empty (&geometry)) {
+                return false;
+        }
+        const int    longest = geometry.width > geometry.height ? geometry.width : geometry.height;
+        const double scale   = longest > THUMBNAIL_MAX_SIZE ? (double) THUMBNAIL_MAX_SIZE / longest : 1.0;
+        int          width   = scale_round (geometry.width * scale);
+        int          height  = scale_round (geometry.height * scale);
+        width                = width > 0 ? width : 1;
+        height               = height > 0 ? height : 1;
+        const size_t bytes   = (size_t) width * (size_t) height * 4;
+
+        /* What is on screen is always rendered, over budget if need be. */
+        overview_evict (overview, thumbnail, bytes);
+        if (thumbnail->node == NULL && overview->used - thumbnail->bytes + bytes > overview->budget) {
+                thumbnail_drop (overview, thumbnail);
+                thumbnail->evicted = true;
+                return false;
+        }
+
+        const struct wlr_drm_format *format = wlr_drm_format_set_get (
+            wlr_renderer_get_render_formats (server->renderer), DRM_FORMAT_ARGB8888);
+        if (format == NULL) {
+                wlr_log (WLR_ERROR, "Overview: no ARGB8888 render format for thumbnails");
+                return false;
+        }
+        struct wlr_buffer *buffer = wlr_allocator_create_buffer (server->allocator, width, height, format);
+        if (buffer == NULL) {
+                return false;
+        }
+        struct wlr_render_pass *pass = wlr_renderer_begin_buffer_pass (server->renderer, buffer, NULL);
+        if (pass == NULL) {
+                wlr_buffer_drop (buffer);
+                return false;
+        }
+        wlr_render_pass_add_rect (pass,
+                                  &(struct wlr_render_rect_options) {
+                                      .box        = { .width = width, .height = height },
+                                      .color      = { .r = 0, .g = 0, .b = 0, .a = 0 },
+                                      .blend_mode = WLR_RENDER_BLEND_MODE_NONE,
+                                  });
+        xdg_toplevel_render (toplevel, pass, scale);
+        if (!wlr_render_pass_submit (pass)) {
+                wlr_buffer_drop (buffer);
+                return false;
+        }
+
+        thumbnail_drop (overview, thumbnail);
+        thumbnail->buffer      = buffer;
+        thumbnail->bytes       = bytes;
+        thumbnail->dirty       = false;
+        thumbnail->evicted     = false;
+        thumbnail->rendered_at = now_usec ();
+        overview->used += bytes;
+        wl_list_insert (&overview->lru, &thumbnail->link);
+        if (thumbnail->node != NULL) {
+                wlr_scene_buffer_set_buffer (thumbnail->node, buffer);
+        }
+        return true;
+}
+
+static void overview_arm_timer (struct comp_overview *overview, int64_t delay_usec) {
+        if (overview->timer == NULL || overview->timer_armed) {
+                return;
+        }
+        const int64_t delay_ms = (delay_usec + 999) / 1000;
+        wl_event_source_timer_update (overview->timer, delay_ms > 0 ? (int) delay_ms : 1);
+        overview->timer_armed = true;
+}
+
+static int overview_timer_notify (void *data) {
+        /* Re-renders damaged thumbnails whose interval is up. Evicted ones
+         * wait until they are shown again, new ones are rendered right
+         * away. */
+        struct comp_server   *server   = data;
+        struct comp_overview *overview = &server->overview;
+        overview->timer_armed          = false;
+        if (server->idle.idle) {
+                return 0;
+        }
+
+        const int64_t    now  = now_usec ();
+        int64_t          next = INT64_MAX;
+        struct toplevel *toplevel;
+        wl_list_for_each (toplevel, &server->toplevels, link) {
+                struct thumbnail *thumbnail = &toplevel->thumbnail;
+                if (!thumbnail->dirty || (thumbnail->evicted && thumbnail->node == NULL)) {
+                        continue;
+                }
+                const int64_t due = thumbnail->rendered_at + THUMBNAIL_INTERVAL_MS * 1000;
+                if (due > now) {
+                        next = due < next ? due : next;
+                        continue;
+                }
+                thumbnail_render (server, toplevel);
+        }
+        if (next != INT64_MAX) {
+                overview_arm_timer (overview, next - now);
+        }
+        return 0;
+}
+
+static struct wlr_box fit_box (int src_width, int src_height, const struct wlr_box *cell) {
+        /* Largest box with the source aspect ratio that fits in the cell
+         * without upscaling, centered. */
+        struct wlr_box box = { .width = src_width, .height = src_height };
+        if (box.width > cell->width) {
+                box.height = (int) ((int64_t) box.height * cell->width / box.width);
+                box.width  = cell->width;
+        }
+        if (box.height > cell->height) {
+                box.width  = (int) ((int64_t) box.width * cell->height / box.height);
+                box.height = cell->height;
+        }
+        box.x = cell->x + (cell->width - box.width) / 2;
+        box.y = cell->y + (cell->height - box.height) / 2;
+        return box;
+}
+
+static void overview_arrange (struct comp_server *server) {
+        /* A grid on the output under the cursor, most recently focused first.
+         * Only thumbnails that were never rendered or got evicted cost a
+         * render here; the rest are composed as they are. */
+        struct comp_overview *overview   = &server->overview;
+        struct wlr_output    *wlr_output = wlr_output_layout_output_at (
+            server->output_layout, server->cursor->x, server->cursor->y);
+        if (wlr_output == NULL) {
+                return;
+        }
+        const struct comp_output *output = wlr_output->data;
+        const struct wlr_box      area   = output->usable_area;
+
+        struct wlr_box box;
+        wlr_output_layout_get_box (server->output_layout, wlr_output, &box);
+        wlr_scene_rect_set_size (overview->backdrop, box.width, box.height);
+        wlr_scene_node_set_position (&overview->backdrop->node, box.x, box.y);
+
+        const int count = (int) server->focus.count;
+        if (count == 0) {
+                return;
+        }
+        int cols = 1;
+        while (cols * cols < count) {
+                cols++;
+        }
+        const int rows        = (count + cols - 1) / cols;
+        const int cell_width  = (area.width - OVERVIEW_GAP) / cols;
+        const int cell_height = (area.height - OVERVIEW_GAP) / rows;
+
+        int              i = 0;
+        struct toplevel *toplevel;
+        wl_list_for_each (toplevel, &server->toplevels, link) {
+                struct thumbnail *thumbnail = &toplevel->thumbnail;
+                if (thumbnail->node == NULL) {
+                        thumbnail->node = wlr_scene_buffer_create (overview->tree, NULL);
+                        thumbnail->node->node.data = toplevel;
+                }
+                if (thumbnail->buffer == NULL) {
+                        thumbnail_render (server, toplevel);
+                } else {
+                        wl_list_remove (&thumbnail->link);
+                        wl_list_insert (&overview->lru, &thumbnail->link);
+                        wlr_scene_buffer_set_buffer (thumbnail->node, thumbnail->buffer);
+                }
+
+                struct wlr_box geometry;
+                wlr_xdg_surface_get_geometry (toplevel->xdg_toplevel->base, &geometry);
+                const struct wlr_box cell = {
+                        .x      = area.x + OVERVIEW_GAP + (i % cols) * cell_width,
+                        .y      = area.y + OVERVIEW_GAP + (i / cols) * cell_height,
+                        .width  = cell_width - OVERVIEW_GAP,
+                        .height = cell_height - OVERVIEW_GAP,
+                };
+                const struct wlr_box dst = fit_box (geometry.width, geometry.height, &cell);
+                wlr_scene_buffer_set_dest_size (thumbnail->node, dst.width, dst.height);
+                wlr_scene_node_set_position (&thumbnail->node->node, dst.x, dst.y);
+                i++;
+        }
+}
+
+static void thumbnail_hide (struct thumbnail *thumbnail) {
+        if (thumbnail->node != NULL) {
+                wlr_scene_node_destroy (&thumbnail->node->node);
+                thumbnail->node = NULL;
+        }
+}
+
+void overview_set_active (struct comp_server *server, bool active) {
+        /* While the overview is up the toplevels themselves are left out of
+         * the scene, so frames only compose the thumbnails. */
+        struct comp_overview *overview = &server->overview;
+        if (overview->active == active) {
+                return;
+        }
+        overview->active = active;
+        wlr_scene_node_set_enabled (&server->layers[SCENE_LAYER_NORMAL]->node, !active);
+        wlr_scene_node_set_enabled (&overview->tree->node, active);
+
+        if (active) {
+                overview_arrange (server);
+                animation_opacity (server, &overview->tree->node, 0.0f, 1.0f, ANIMATION_OVERVIEW_MS);
+        } else {
+                struct toplevel *toplevel;
+                wl_list_for_each (toplevel, &server->toplevels, link) {
+                        thumbnail_hide (&toplevel->thumbnail);
+                }
+                /* What was shown may have pushed the cache over budget. */
+                overview_evict (overview, NULL, 0);
+        }
+        wlr_log (WLR_DEBUG,
+                 "Overview %s, %zu KiB of thumbnails cached",
+                 active ? "shown" : "hidden",
+                 overview->used / 1024);
+}
+
+bool overview_handle_button (struct comp_server *server, uint32_t button, bool pressed, double lx, double ly) {
+        /* Any click leaves the overview; one on a thumbnail also focuses its
+         * toplevel. Returns true if the event is the overview's, which is a
+         * press while it is up or the release of such a press: the overview
+         * is gone by then, but the client under the cursor never saw the
+         * press and must not see the release either. */
+        struct comp_overview *overview = &server->overview;
+        if (!pressed) {
+                for (size_t i = 0; i < overview->nheld; i++) {
+                        if (overview->held[i] == button) {
+                                overview->held[i] = overview->held[--overview->nheld];
+                                return true;
+                        }
+                }
+                return false;
+        }
+        if (!overview->active) {
+                return false;
+        }
+        if (overview->nheld < OVERVIEW_MAX_BUTTONS) {
+                overview->held[overview->nheld++] = button;
+        }
+        double                 sx, sy;
+        struct wlr_scene_node *node     = wlr_scene_node_at (&overview->tree->node, lx, ly, &sx, &sy);
+        struct toplevel       *toplevel = node != NULL ? node->data : NULL;
+        overview_set_active (server, false);
+        if (toplevel != NULL) {
+                keyboard_focus_toplevel (toplevel, toplevel->xdg_toplevel->base->surface);
+        }
+        return true;
+}
+
+void overview_toplevel_map (struct toplevel *toplevel) {
+        struct comp_overview *overview = &toplevel->server->overview;
+        toplevel->thumbnail.dirty      = true;
+        toplevel->thumbnail.evicted    = false;
+        overview_arm_timer (overview, 0);
+        if (overview->active) {
+                overview_arrange (toplevel->server);
+        }
+}
+
+void overview_toplevel_commit (struct toplevel *toplevel) {
+        /* Only commits that damage the toplevel's own buffer count;
+         * desynchronized subsurfaces are caught up on the next one. */
+        struct wlr_surface *surface   = toplevel->xdg_toplevel->base->surface;
+        struct thumbnail   *thumbnail = &toplevel->thumbnail;
+        if (!surface->mapped || !pixman_region32_not_empty (&surface->buffer_damage)) {
+                return;
+        }
+        thumbnail->dirty = true;
+        if (thumbnail->evicted && thumbnail->node == NULL) {
+                return;
+        }
+        const int64_t due = thumbnail->rendered_at + THUMBNAIL_INTERVAL_MS * 1000;
+        overview_arm_timer (&toplevel->server->overview, due - now_usec ());
+}
+
+void overview_toplevel_unmap (struct toplevel *toplevel) {
+        struct comp_overview *overview = &toplevel->server->overview;
+        thumbnail_hide (&toplevel->thumbnail);
+        thumbnail_drop (overview, &toplevel->thumbnail);
+        if (overview->active) {
+                overview_arrange (toplevel->server);
+        }
+}
+
+void overview_init (struct comp_server *server) {
+        /* Must run after the scene layers are created, so that the overview
+         * tree ends up above all of them. */
+        struct comp_overview *overview = &server->overview;
+        wl_list_init (&overview->lru);
+        overview->tree     = wlr_scene_tree_create (&server->scene->tree);
+        overview->backdrop = wlr_scene_rect_create (overview->tree, 0, 0, overview_backdrop);
+        overview->timer    = wl_event_loop_add_timer (server->wl_event_loop, overview_timer_notify, server);
+        wlr_scene_node_set_enabled (&overview->tree->node, false);
+        wlr_log (WLR_INFO, "Thumbnail cache budget %zu KiB", overview->budget / 1024);
+}
+
+void overview_finish (struct comp_server *server) {
+        /* Runs before the scene is destroyed. Cached thumbnails go with their
+         * toplevels. */
+        overview_set_active (server, false);
+        if (server->overview.timer != NULL) {
+                wl_event_source_remove (server->overview.timer);
+                server->overview.timer = NULL;
+        }
+}
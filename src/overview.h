@@ -0,0 +1,55 @@
+#ifndef COMP_OVERVIEW_H
+#define COMP_OVERVIEW_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+struct comp_server;
+struct toplevel;
+
+#define OVERVIEW_DEFAULT_BUDGET_MIB 64
+#define OVERVIEW_MAX_BUTTONS        8
+
+/** Cached downscaled rendering of one toplevel, embedded in it. */
+struct thumbnail
+{
+        struct wlr_buffer       *buffer; // NULL until rendered, or once evicted
+        size_t                   bytes;
+        bool                     dirty;       // damaged since it was rendered
+        bool                     evicted;     // only re-rendered when shown again
+        int64_t                  rendered_at; // CLOCK_MONOTONIC usec
+        struct wlr_scene_buffer *node;        // in the overview, while it is shown
+        struct wl_list           link;        // comp_overview::lru, while buffer != NULL
+};
+
+/** Exposé-style overview of every mapped toplevel. Thumbnails are rendered
+ * ahead of time, when their toplevel commits damage and no more than a few
+ * times per second each, so showing the overview only composes what is
+ * cached. The cache is bounded by a budget; past it, thumbnails that are
+ * not on screen are evicted least recently used first. */
+struct comp_overview
+{
+        bool                    active;
+        size_t                  budget; // bytes
+        size_t                  used;
+        struct wl_list          lru; // thumbnail::link, most recently used first
+        struct wlr_scene_tree  *tree; // above every scene layer
+        struct wlr_scene_rect  *backdrop;
+        struct wl_event_source *timer;
+        bool                    timer_armed;
+        uint32_t                held[OVERVIEW_MAX_BUTTONS]; // pressed on the overview, not released yet
+        size_t                  nheld;
+};
+
+void overview_init (struct comp_server *server);
+void overview_finish (struct comp_server *server);
+void overview_set_active (struct comp_server *server, bool active);
+bool overview_handle_button (struct comp_server *server, uint32_t button, bool pressed, double lx, double ly);
+
+void overview_toplevel_map (struct toplevel *toplevel);
+void overview_toplevel_commit (struct toplevel *toplevel);
+void overview_toplevel_unmap (struct toplevel *toplevel);
+
+#endif // COMP_OVERVIEW_H
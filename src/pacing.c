@@ -0,0 +1,447 @@
+#include "pacing.h"
+#include "alloc.h"
+#include "commit-timing-v1-protocol.h"
+#include "fifo-v1-protocol.h"
+#include "nwm_server.h"
+#include "output.h"
+#include "timespec.h"
+
+#include <time.h>
+#include <wlr/types/wlr_compositor.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/addon.h>
+#include <wlr/util/log.h>
+
+#define PACING_DEFAULT_REFRESH_USEC 16667
+
+/* A commit held back by a barrier or a target time. Commits that arrive
+ * while others are held are queued behind them to keep their order. */
+struct paced_commit
+{
+        struct wl_list link;
+        uint32_t       seq; // surface lock
+        bool           wait_barrier;
+        bool           set_barrier;
+        int64_t        target_usec; // 0 without a target
+};
+
+/* Pacing state of one surface, shared by its wp_fifo_v1 and its
+ * wp_commit_timer_v1. Lives until both are gone or the surface is. */
+struct paced_surface
+{
+        struct wl_list      link;
+        struct comp_server *server;
+        struct wlr_surface *surface;
+        struct wlr_addon    addon;
+        struct wl_resource *fifo;
+        struct wl_resource *timer;
+
+        /* Requested for the next commit. */
+        bool    pending_set_barrier;
+        bool    pending_wait_barrier;
+        int64_t pending_target_usec;
+
+        bool           barrier; // set by an applied commit until it is latched
+        struct wl_list commits; // paced_commit::link, oldest first
+
+        struct wl_listener client_commit;
+};
+
+static int64_t output_refresh_usec (struct comp_output *output) {
+        const int refresh = output->wlr_output->refresh; // mHz, 0 when unknown
+        return refresh > 0 ? 1000000000ll / refresh : PACING_DEFAULT_REFRESH_USEC;
+}
+
+static struct comp_output *paced_surface_output (struct paced_surface *paced) {
+        /* The output whose refresh cycle paces the surface: the first one it
+         * is shown on that is actually refreshing. */
+        struct wlr_surface_output *surface_output;
+        wl_list_for_each (surface_output, &paced->surface->current_outputs, link) {
+                struct comp_output *output = surface_output->output->data;
+                if (output != NULL && !output->idle_off && !output->mirror) {
+                        return output;
+                }
+        }
+        return NULL;
+}
+
+static int64_t predict_present (struct comp_output *output, int64_t now) {
+        /* Content applied now is rendered on the next frame event and shown
+         * on the refresh after the one in flight. Without an output nothing
+         * is shown, so the clock is all there is. */
+        if (output == NULL) {
+                return now;
+        }
+        const int64_t refresh = output_refresh_usec (output);
+        const int64_t next    = timespec_to_usec (&output->last_frame) + 2 * refresh;
+        return next > now + refresh ? next : now + refresh;
+}
+
+static void pacing_arm_timer (struct comp_pacing *pacing, int64_t deadline) {
+        /* One timer serves every surface; it only ever moves closer. */
+        if (pacing->timer == NULL
+            || (pacing->timer_deadline != 0 && pacing->timer_deadline <= deadline)) {
+                return;
+        }
+        pacing->timer_deadline = deadline;
+        const int64_t delay_ms = (deadline - now_usec () + 999) / 1000;
+        wl_event_source_timer_update (pacing->timer, delay_ms > 0 ? (int) delay_ms : 1);
+}
+
+static void paced_commit_apply (struct paced_surface *paced, struct paced_commit *commit) {
+        const uint32_t seq = commit->seq;
+        if (commit->set_barrier) {
+                paced->barrier = true;
+        }
+        wl_list_remove (&commit->link);
+        nwm_free (commit);
+        wlr_surface_unlock_cached (paced->surface, seq);
+}
+
+static void paced_surface_flush (struct paced_surface *paced, int64_t predicted) {
+        /* Applies held commits in order until one has to keep waiting. */
+        struct paced_commit *commit, *tmp;
+        wl_list_for_each_safe (commit, tmp, &paced->commits, link) {
+                if ((commit->wait_barrier && paced->barrier) || commit->target_usec > predicted) {
+                        return;
+                }
+                paced_commit_apply (paced, commit);
+        }
+}
+
+static void paced_surface_kick (struct paced_surface *paced) {
+        /* Applies whatever may go now and makes sure we come back for the
+         * rest: on the next refresh for a barrier, on the timer for a target
+         * time that is further away. */
+        if (wl_list_empty (&paced->commits)) {
+                return;
+        }
+        struct comp_output *output = paced_surface_output (paced);
+        const int64_t       now    = now_usec ();
+        if (output == NULL) {
+                /* No refresh cycle to wait for, nothing gets latched. */
+                paced->barrier = false;
+        }
+        const int64_t predicted = predict_present (output, now);
+        paced_surface_flush (paced, predicted);
+        if (wl_list_empty (&paced->commits)) {
+                return;
+        }
+
+        struct paced_commit *head = wl_container_of (paced->commits.next, head, link);
+        if (head->wait_barrier && paced->barrier) {
+                wlr_output_schedule_frame (output->wlr_output);
+        } else {
+                pacing_arm_timer (&paced->server->pacing, now + head->target_usec - predicted);
+        }
+}
+
+static void paced_surface_client_commit (struct wl_listener *listener, void *data) {
+        /* Raised on wl_surface.commit, before the pending state is applied or
+         * cached, which is the last chance to lock it. */
+        struct paced_surface *paced  = wl_container_of (listener, paced, client_commit);
+        struct paced_commit   commit = {
+                .wait_barrier = paced->pending_wait_barrier,
+                .set_barrier  = paced->pending_set_barrier,
+                .target_usec  = paced->pending_target_usec,
+        };
+        paced->pending_wait_barrier = false;
+        paced->pending_set_barrier  = false;
+        paced->pending_target_usec  = 0;
+
+        if (wl_list_empty (&paced->commits)) {
+                const int64_t predicted = predict_present (paced_surface_output (paced), now_usec ());
+                if (!(commit.wait_barrier && paced->barrier) && commit.target_usec <= predicted) {
+                        /* Nothing to wait for, the commit goes through as usual. */
+                        if (commit.set_barrier) {
+                                paced->barrier = true;
+                        }
+                        return;
+                }
+        }
+
+        struct paced_commit *held = nwm_alloc (ALLOC_PACING, struct paced_commit);
+        *held                     = commit;
+        held->seq                 = wlr_surface_lock_pending (paced->surface);
+        wl_list_insert (paced->commits.prev, &held->link);
+        paced_surface_kick (paced);
+}
+
+static void paced_surface_destroy (struct paced_surface *paced) {
+        /* Held commits are released, not dropped: the client gave up on
+         * pacing, not on its content. */
+        struct paced_commit *commit, *tmp;
+        wl_list_for_each_safe (commit, tmp, &paced->commits, link) {
+                paced_commit_apply (paced, commit);
+        }
+        if (paced->fifo != NULL) {
+                wl_resource_set_user_data (paced->fifo, NULL);
+        }
+        if (paced->timer != NULL) {
+                wl_resource_set_user_data (paced->timer, NULL);
+        }
+        wlr_addon_finish (&paced->addon);
+        wl_list_remove (&paced->client_commit.link);
+        wl_list_remove (&paced->link);
+        nwm_free (paced);
+}
+
+static void paced_surface_addon_destroy (struct wlr_addon *addon) {
+        /* The surface is going away, and its cached states with it. */
+        struct paced_surface *paced = wl_container_of (addon, paced, addon);
+        struct paced_commit  *commit, *tmp;
+        wl_list_for_each_safe (commit, tmp, &paced->commits, link) {
+                wl_list_remove (&commit->link);
+                nwm_free (commit);
+        }
+        paced_surface_destroy (paced);
+}
+
+static const struct wlr_addon_interface paced_surface_addon_impl = {
+        .name    = "nwm_paced_surface",
+        .destroy = paced_surface_addon_destroy,
+};
+
+static struct paced_surface *paced_surface_get (struct comp_server *server, struct wlr_surface *surface) {
+        struct wlr_addon *addon = wlr_addon_find (&surface->addons, &server->pacing, &paced_surface_addon_impl);
+        if (addon != NULL) {
+                struct paced_surface *paced = wl_container_of (addon, paced, addon);
+                return paced;
+        }
+
+        struct paced_surface *paced = nwm_alloc (ALLOC_PACING, struct paced_surface);
+        paced->server               = server;
+        paced->surface              = surface;
+        wl_list_init (&paced->commits);
+        wlr_addon_init (&paced->addon, &surface->addons, &server->pacing, &paced_surface_addon_impl);
+        paced->client_commit.notify = paced_surface_client_commit;
+        wl_signal_add (&surface->events.client_commit, &paced->client_commit);
+        wl_list_insert (&server->pacing.surfaces, &paced->link);
+        return paced;
+}
+
+static void resource_handle_destroy (struct wl_client *client, struct wl_resource *resource) {
+        wl_resource_destroy (resource);
+}
+
+/* wp_fifo_v1 */
+
+static struct paced_surface *paced_surface_from_fifo (struct wl_resource *resource) {
+        struct paced_surface *paced = wl_resource_get_user_data (resource);
+        if (paced == NULL) {
+                wl_resource_post_error (
+                    resource, WP_FIFO_V1_ERROR_SURFACE_DESTROYED, "the surface was destroyed");
+        }
+        return paced;
+}
+
+static void fifo_handle_set_barrier (struct wl_client *client, struct wl_resource *resource) {
+        struct paced_surface *paced = paced_surface_from_fifo (resource);
+        if (paced != NULL) {
+                paced->pending_set_barrier = true;
+        }
+}
+
+static void fifo_handle_wait_barrier (struct wl_client *client, struct wl_resource *resource) {
+        struct paced_surface *paced = paced_surface_from_fifo (resource);
+        if (paced != NULL) {
+                paced->pending_wait_barrier = true;
+        }
+}
+
+static const struct wp_fifo_v1_interface fifo_impl = {
+        .set_barrier  = fifo_handle_set_barrier,
+        .wait_barrier = fifo_handle_wait_barrier,
+        .destroy      = resource_handle_destroy,
+};
+
+static void fifo_resource_destroy (struct wl_resource *resource) {
+        struct paced_surface *paced = wl_resource_get_user_data (resource);
+        if (paced == NULL) {
+                return;
+        }
+        paced->fifo                 = NULL;
+        paced->pending_set_barrier  = false;
+        paced->pending_wait_barrier = false;
+        paced->barrier              = false;
+        if (paced->timer == NULL) {
+                paced_surface_destroy (paced);
+        } else {
+                paced_surface_kick (paced);
+        }
+}
+
+static void fifo_manager_handle_get_fifo (struct wl_client   *client,
+                                          struct wl_resource *resource,
+                                          uint32_t            id,
+                                          struct wl_resource *surface_resource) {
+        struct comp_server   *server  = wl_resource_get_user_data (resource);
+        struct wlr_surface   *surface = wlr_surface_from_resource (surface_resource);
+        struct paced_surface *paced   = paced_surface_get (server, surface);
+        if (paced->fifo != NULL) {
+                wl_resource_post_error (
+                    resource, WP_FIFO_MANAGER_V1_ERROR_ALREADY_EXISTS, "the surface already has a fifo");
+                return;
+        }
+
+        paced->fifo = wl_resource_create (client, &wp_fifo_v1_interface, wl_resource_get_version (resource), id);
+        if (paced->fifo == NULL) {
+                if (paced->timer == NULL) {
+                        paced_surface_destroy (paced);
+                }
+                wl_client_post_no_memory (client);
+                return;
+        }
+        wl_resource_set_implementation (paced->fifo, &fifo_impl, paced, fifo_resource_destroy);
+}
+
+static const struct wp_fifo_manager_v1_interface fifo_manager_impl = {
+        .destroy  = resource_handle_destroy,
+        .get_fifo = fifo_manager_handle_get_fifo,
+};
+
+static void fifo_manager_bind (struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+        struct wl_resource *resource = wl_resource_create (client, &wp_fifo_manager_v1_interface, version, id);
+        if (resource == NULL) {
+                wl_client_post_no_memory (client);
+                return;
+        }
+        wl_resource_set_implementation (resource, &fifo_manager_impl, data, NULL);
+}
+
+/* wp_commit_timer_v1 */
+
+static void timer_handle_set_timestamp (struct wl_client   *client,
+                                        struct wl_resource *resource,
+                                        uint32_t            tv_sec_hi,
+                                        uint32_t            tv_sec_lo,
+                                        uint32_t            tv_nsec) {
+        struct paced_surface *paced = wl_resource_get_user_data (resource);
+        if (paced == NULL) {
+                wl_resource_post_error (
+                    resource, WP_COMMIT_TIMER_V1_ERROR_SURFACE_DESTROYED, "the surface was destroyed");
+                return;
+        }
+        if (tv_nsec >= 1000000000) {
+                wl_resource_post_error (
+                    resource, WP_COMMIT_TIMER_V1_ERROR_INVALID_TIMESTAMP, "tv_nsec out of range");
+                return;
+        }
+        if (paced->pending_target_usec != 0) {
+                wl_resource_post_error (
+                    resource, WP_COMMIT_TIMER_V1_ERROR_TIMESTAMP_EXISTS, "timestamp already set");
+                return;
+        }
+        /* Same clock as wp_presentation, which is CLOCK_MONOTONIC for us. A
+         * zero target would read as "none", the epoch is long past anyway. */
+        const int64_t tv_sec       = (int64_t) (((uint64_t) tv_sec_hi << 32) | tv_sec_lo);
+        const int64_t target       = tv_sec * 1000000 + tv_nsec / 1000;
+        paced->pending_target_usec = target > 0 ? target : 1;
+}
+
+static const struct wp_commit_timer_v1_interface timer_impl = {
+        .set_timestamp = timer_handle_set_timestamp,
+        .destroy       = resource_handle_destroy,
+};
+
+static void timer_resource_destroy (struct wl_resource *resource) {
+        struct paced_surface *paced = wl_resource_get_user_data (resource);
+        if (paced == NULL) {
+                return;
+        }
+        paced->timer               = NULL;
+        paced->pending_target_usec = 0;
+        if (paced->fifo == NULL) {
+                paced_surface_destroy (paced);
+        } else {
+                paced_surface_kick (paced);
+        }
+}
+
+static void commit_timing_manager_handle_get_timer (struct wl_client   *client,
+                                                    struct wl_resource *resource,
+                                                    uint32_t            id,
+                                                    struct wl_resource *surface_resource) {
+        struct comp_server   *server  = wl_resource_get_user_data (resource);
+        struct wlr_surface   *surface = wlr_surface_from_resource (surface_resource);
+        struct paced_surface *paced   = paced_surface_get (server, surface);
+        if (paced->timer != NULL) {
+                wl_resource_post_error (resource,
+                                        WP_COMMIT_TIMING_MANAGER_V1_ERROR_COMMIT_TIMER_EXISTS,
+                                        "the surface already has a commit timer");
+                return;
+        }
+
+        paced->timer = wl_resource_create (
+            client, &wp_commit_timer_v1_interface, wl_resource_get_version (resource), id);
+        if (paced->timer == NULL) {
+                if (paced->fifo == NULL) {
+                        paced_surface_destroy (paced);
+                }
+                wl_client_post_no_memory (client);
+                return;
+        }
+        wl_resource_set_implementation (paced->timer, &timer_impl, paced, timer_resource_destroy);
+}
+
+static const struct wp_commit_timing_manager_v1_interface commit_timing_manager_impl = {
+        .destroy   = resource_handle_destroy,
+        .get_timer = commit_timing_manager_handle_get_timer,
+};
+
+static void commit_timing_manager_bind (struct wl_client *client, void *data, uint32_t version, uint32_t id) {
+        struct wl_resource *resource
+            = wl_resource_create (client, &wp_commit_timing_manager_v1_interface, version, id);
+        if (resource == NULL) {
+                wl_client_post_no_memory (client);
+                return;
+        }
+        wl_resource_set_implementation (resource, &commit_timing_manager_impl, data, NULL);
+}
+
+static int pacing_timer_notify (void *data) {
+        struct comp_server *server = data;
+        server->pacing.timer_deadline = 0;
+
+        struct paced_surface *paced;
+        wl_list_for_each (paced, &server->pacing.surfaces, link) {
+                paced_surface_kick (paced);
+        }
+        return 0;
+}
+
+void pacing_output_frame (struct comp_output *output) {
+        /* Called once the scene has been committed: whatever the surfaces on
+         * this output applied so far is now latched, which clears their
+         * barrier and lets the next queued frame through. */
+        struct paced_surface *paced;
+        wl_list_for_each (paced, &output->server->pacing.surfaces, link) {
+                if (paced_surface_output (paced) != output) {
+                        continue;
+                }
+                paced->barrier = false;
+                paced_surface_kick (paced);
+        }
+}
+
+void pacing_init (struct comp_server *server) {
+        struct comp_pacing *pacing = &server->pacing;
+        wl_list_init (&pacing->surfaces);
+        pacing->timer        = wl_event_loop_add_timer (server->wl_event_loop, pacing_timer_notify, server);
+        pacing->fifo_manager = wl_global_create (
+            server->wl_display, &wp_fifo_manager_v1_interface, 1, server, fifo_manager_bind);
+        pacing->commit_timing_manager = wl_global_create (server->wl_display,
+                                                          &wp_commit_timing_manager_v1_interface,
+                                                          1,
+                                                          server,
+                                                          commit_timing_manager_bind);
+}
+
+void pacing_finish (struct comp_server *server) {
+        /* Runs once clients are gone, their surfaces took the pacing state
+         * with them. The globals go with the display. */
+        if (server->pacing.timer != NULL) {
+                wl_event_source_remove (server->pacing.timer);
+                server->pacing.timer = NULL;
+        }
+}
@@ -0,0 +1,28 @@
+#ifndef COMP_PACING_H
+#define COMP_PACING_H
+
+#include <stdint.h>
+#include <wayland-server-core.h>
+
+struct comp_output;
+struct comp_server;
+
+/** Client-driven presentation pacing: wp_fifo_v1 and wp_commit_timing_v1.
+ * Commits that have to wait for the previous frame to be latched (FIFO
+ * barriers) or for a target presentation time are held with a surface lock
+ * and applied in order on the refresh cycle they belong to. Clients can
+ * then queue frames ahead and sleep instead of spinning on frame callbacks. */
+struct comp_pacing
+{
+        struct wl_global       *fifo_manager;
+        struct wl_global       *commit_timing_manager;
+        struct wl_list          surfaces; // paced_surface::link
+        struct wl_event_source *timer;
+        int64_t                 timer_deadline; // CLOCK_MONOTONIC usec, 0 when unarmed
+};
+
+void pacing_init (struct comp_server *server);
+void pacing_finish (struct comp_server *server);
+void pacing_output_frame (struct comp_output *output);
+
+#endif // COMP_PACING_H
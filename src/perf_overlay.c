@@ -0,0 +1,359 @@
+#include "perf_overlay.h"
+#include "alloc.h"
+#include "nwm_server.h"
+#include "output.h"
+
+#include <drm_fourcc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <wlr/interfaces/wlr_buffer.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
+
+#define PERF_OVERLAY_INTERVAL_MS 250
+
+/* Panel layout in buffer pixels. Glyphs are 5x7, drawn GLYPH_SCALE times
+ * larger on a 6x10 cell. The graph has one bar per frame_usec entry. */
+#define GLYPH_SCALE  2
+#define CELL_WIDTH   (6 * GLYPH_SCALE)
+#define LINE_HEIGHT  (10 * GLYPH_SCALE)
+#define PADDING      8
+#define MARGIN       8
+#define BAR_WIDTH    4
+#define GRAPH_HEIGHT 48
+#define TEXT_LINES   5
+#define PANEL_WIDTH  (2 * PADDING + OUTPUT_FRAME_HISTORY * BAR_WIDTH)
+#define PANEL_HEIGHT (2 * PADDING + TEXT_LINES * LINE_HEIGHT + GRAPH_HEIGHT)
+#define LINE_CHARS   ((PANEL_WIDTH - 2 * PADDING) / CELL_WIDTH)
+
+/* The graph spans this many refresh periods; longer frames are clipped. */
+#define GRAPH_CYCLES 3
+
+/* Premultiplied ARGB. */
+#define COLOR_BACKGROUND 0xc0000000
+#define COLOR_TEXT       0xffffffff
+#define COLOR_REFRESH    0xff808080
+#define COLOR_FRAME_OK   0xff40c040
+#define COLOR_FRAME_SLOW 0xffe04040
+
+/* Rows top to bottom, bit 4 is the leftmost column. */
+static const uint8_t font_digits[10][7] = {
+        { 0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e },
+        { 0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e },
+        { 0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f },
+        { 0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e },
+        { 0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02 },
+        { 0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e },
+        { 0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e },
+        { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08 },
+        { 0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e },
+        { 0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c },
+};
+
+static const uint8_t font_letters[26][7] = {
+        { 0x0e, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 }, // A
+        { 0x1e, 0x11, 0x11, 0x1e, 0x11, 0x11, 0x1e },
+        { 0x0e, 0x11, 0x10, 0x10, 0x10, 0x11, 0x0e },
+        { 0x1c, 0x12, 0x11, 0x11, 0x11, 0x12, 0x1c },
+        { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x1f },
+        { 0x1f, 0x10, 0x10, 0x1e, 0x10, 0x10, 0x10 },
+        { 0x0e, 0x11, 0x10, 0x17, 0x11, 0x11, 0x0f },
+        { 0x11, 0x11, 0x11, 0x1f, 0x11, 0x11, 0x11 },
+        { 0x0e, 0x04, 0x04, 0x04, 0x04, 0x04, 0x0e },
+        { 0x07, 0x02, 0x02, 0x02, 0x02, 0x12, 0x0c },
+        { 0x11, 0x12, 0x14, 0x18, 0x14, 0x12, 0x11 },
+        { 0x10, 0x10, 0x10, 0x10, 0x10, 0x10, 0x1f },
+        { 0x11, 0x1b, 0x15, 0x15, 0x11, 0x11, 0x11 },
+        { 0x11, 0x11, 0x19, 0x15, 0x13, 0x11, 0x11 },
+        { 0x0e, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e },
+        { 0x1e, 0x11, 0x11, 0x1e, 0x10, 0x10, 0x10 },
+        { 0x0e, 0x11, 0x11, 0x11, 0x15, 0x12, 0x0d },
+        { 0x1e, 0x11, 0x11, 0x1e, 0x14, 0x12, 0x11 },
+        { 0x0f, 0x10, 0x10, 0x0e, 0x01, 0x01, 0x1e },
+        { 0x1f, 0x04, 0x04, 0x04, 0x04, 0x04, 0x04 },
+        { 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x0e },
+        { 0x11, 0x11, 0x11, 0x11, 0x11, 0x0a, 0x04 },
+        { 0x11, 0x11, 0x11, 0x15, 0x15, 0x15, 0x0a },
+        { 0x11, 0x11, 0x0a, 0x04, 0x0a, 0x11, 0x11 },
+        { 0x11, 0x11, 0x11, 0x0a, 0x04, 0x04, 0x04 },
+        { 0x1f, 0x01, 0x02, 0x04, 0x08, 0x10, 0x1f }, // Z
+};
+
+static const uint8_t font_period[7]  = { 0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c };
+static const uint8_t font_slash[7]   = { 0x00, 0x01, 0x02, 0x04, 0x08, 0x10, 0x00 };
+static const uint8_t font_percent[7] = { 0x18, 0x19, 0x02, 0x04, 0x08, 0x13, 0x03 };
+
+static const uint8_t *font_glyph (char c) {
+        /* Anything without a glyph, lower case included, is drawn as a blank. */
+        if (c >= '0' && c <= '9') {
+                return font_digits[c - '0'];
+        }
+        if (c >= 'A' && c <= 'Z') {
+                return font_letters[c - 'A'];
+        }
+        switch (c) {
+        case '.':
+                return font_period;
+        case '/':
+                return font_slash;
+        case '%':
+                return font_percent;
+        default:
+                return NULL;
+        }
+}
+
+/* A wlr_buffer backed by plain memory. The scene uploads it to a texture
+ * when it is attached; a fresh one is drawn for every update. */
+struct overlay_buffer
+{
+        struct wlr_buffer base;
+        uint32_t          pixels[PANEL_WIDTH * PANEL_HEIGHT];
+};
+
+static void overlay_buffer_destroy (struct wlr_buffer *wlr_buffer) {
+        struct overlay_buffer *buffer = wl_container_of (wlr_buffer, buffer, base);
+        wlr_buffer_finish (wlr_buffer);
+        nwm_free (buffer);
+}
+
+static bool overlay_buffer_begin_data_ptr_access (struct wlr_buffer *wlr_buffer,
+                                                  uint32_t           flags,
+                                                  void             **data,
+                                                  uint32_t          *format,
+                                                  size_t            *stride) {
+        struct overlay_buffer *buffer = wl_container_of (wlr_buffer, buffer, base);
+        if (flags & WLR_BUFFER_DATA_PTR_ACCESS_WRITE) {
+                return false;
+        }
+        *data   = buffer->pixels;
+        *format = DRM_FORMAT_ARGB8888;
+        *stride = PANEL_WIDTH * sizeof (uint32_t);
+        return true;
+}
+
+static void overlay_buffer_end_data_ptr_access (struct wlr_buffer *wlr_buffer) {
+        // Nothing to do, the memory is always mapped
+}
+
+static const struct wlr_buffer_impl overlay_buffer_impl = {
+        .destroy               = overlay_buffer_destroy,
+        .begin_data_ptr_access = overlay_buffer_begin_data_ptr_access,
+        .end_data_ptr_access   = overlay_buffer_end_data_ptr_access,
+};
+
+static void fill_rect (struct overlay_buffer *buffer, int x, int y, int width, int height, uint32_t color) {
+        for (int row = y; row < y + height; row++) {
+                for (int col = x; col < x + width; col++) {
+                        buffer->pixels[row * PANEL_WIDTH + col] = color;
+                }
+        }
+}
+
+static void draw_text (struct overlay_buffer *buffer, int line, const char *text) {
+        const int y = PADDING + line * LINE_HEIGHT;
+        for (int i = 0; text[i] != '\0' && i < LINE_CHARS; i++) {
+                const uint8_t *glyph = font_glyph (text[i]);
+                if (glyph == NULL) {
+                        continue;
+                }
+                const int x = PADDING + i * CELL_WIDTH;
+                for (int row = 0; row < 7; row++) {
+                        for (int col = 0; col < 5; col++) {
+                                if (glyph[row] & (0x10 >> col)) {
+                                        fill_rect (buffer,
+                                                   x + col * GLYPH_SCALE,
+                                                   y + row * GLYPH_SCALE,
+                                                   GLYPH_SCALE,
+                                                   GLYPH_SCALE,
+                                                   COLOR_TEXT);
+                                }
+                        }
+                }
+        }
+}
+
+static void draw_graph (struct overlay_buffer *buffer, const struct comp_output *output, uint32_t refresh_usec) {
+        /* One bar per frame, oldest on the left, with a line at one refresh
+         * period. Bars over one and a half periods are frames that missed. */
+        const int      top   = PADDING + TEXT_LINES * LINE_HEIGHT;
+        const uint64_t range = (uint64_t) refresh_usec * GRAPH_CYCLES;
+        for (int i = 0; i < OUTPUT_FRAME_HISTORY; i++) {
+                const uint32_t usec = output->frame_usec[(output->frame_head + i) % OUTPUT_FRAME_HISTORY];
+                if (usec == 0) {
+                        continue;
+                }
+                const int height = usec >= range ? GRAPH_HEIGHT : (int) (usec * GRAPH_HEIGHT / range);
+                fill_rect (buffer,
+                           PADDING + i * BAR_WIDTH,
+                           top + GRAPH_HEIGHT - height,
+                           BAR_WIDTH - 1,
+                           height,
+                           usec * 2 > refresh_usec * 3 ? COLOR_FRAME_SLOW : COLOR_FRAME_OK);
+        }
+        fill_rect (buffer,
+                   PADDING,
+                   top + GRAPH_HEIGHT - GRAPH_HEIGHT / GRAPH_CYCLES,
+                   PANEL_WIDTH - 2 * PADDING,
+                   1,
+                   COLOR_REFRESH);
+}
+
+static struct wlr_buffer *overlay_render (struct comp_output *output, double elapsed) {
+        struct comp_server *server     = output->server;
+        struct wlr_output  *wlr_output = output->wlr_output;
+
+        struct overlay_buffer *buffer = nwm_alloc (ALLOC_OUTPUT, struct overlay_buffer);
+        wlr_buffer_init (&buffer->base, &overlay_buffer_impl, PANEL_WIDTH, PANEL_HEIGHT);
+        fill_rect (buffer, 0, 0, PANEL_WIDTH, PANEL_HEIGHT, COLOR_BACKGROUND);
+
+        /* Backends that do not know the refresh rate report 0. */
+        const uint32_t refresh_usec = wlr_output->refresh > 0 ? 1000000000u / wlr_output->refresh : 16667;
+
+        uint64_t frame_sum = 0, frame_max = 0, frames = 0;
+        for (int i = 0; i < OUTPUT_FRAME_HISTORY; i++) {
+                const uint32_t usec = output->frame_usec[i];
+                if (usec != 0) {
+                        frame_sum += usec;
+                        frame_max = usec > frame_max ? usec : frame_max;
+                        frames++;
+                }
+        }
+
+        char line[LINE_CHARS + 1];
+        snprintf (line, sizeof (line), "REFRESH %.2f HZ", wlr_output->refresh / 1000.0);
+        draw_text (buffer, 0, line);
+        snprintf (line,
+                  sizeof (line),
+                  "FRAME %.1f/%.1f MS",
+                  frames > 0 ? frame_sum / 1000.0 / frames : 0,
+                  frame_max / 1000.0);
+        draw_text (buffer, 1, line);
+        snprintf (line, sizeof (line), "MISSED %lu", (unsigned long) output->missed_frames);
+        draw_text (buffer, 2, line);
+        /* Leave out the commits redrawing the overlay caused itself. */
+        const uint64_t commits = output->commits - output->overlay_own_commits;
+        snprintf (line, sizeof (line), "COMMITS %.0f/S", (commits - output->overlay_commits) / elapsed);
+        draw_text (buffer, 3, line);
+        snprintf (line, sizeof (line), "TOPLEVELS %u", server->focus.count);
+        draw_text (buffer, 4, line);
+        draw_graph (buffer, output, refresh_usec);
+
+        output->overlay_commits = commits;
+        return &buffer->base;
+}
+
+static bool overlay_accepts_input (struct wlr_scene_buffer *buffer, double *sx, double *sy) {
+        /* Clicks go to whatever is underneath. */
+        return false;
+}
+
+static void overlay_update_output (struct comp_output *output, double elapsed) {
+        struct comp_server *server = output->server;
+        if (output->mirror) {
+                return;
+        }
+        struct wlr_box box;
+        wlr_output_layout_get_box (server->output_layout, output->wlr_output, &box);
+        if (wlr_box_empty (&box)) {
+                return;
+        }
+
+        if (output->overlay == NULL) {
+                output->overlay = wlr_scene_buffer_create (server->perf_overlay.tree, NULL);
+                output->overlay->point_accepts_input = overlay_accepts_input;
+        }
+
+        /* Unless the output redraws anyway, the commit that shows the new
+         * panel is the overlay's own. */
+        struct wlr_scene_output *scene_output
+            = wlr_scene_get_scene_output (server->scene, output->wlr_output);
+        output->overlay_redrawn
+            = scene_output != NULL && !wlr_scene_output_needs_frame (scene_output);
+
+        /* The scene keeps its own reference; the overlay is rendered at the
+         * output's pixel density and scaled back to layout coordinates. */
+        struct wlr_buffer *buffer = overlay_render (output, elapsed);
+        wlr_scene_buffer_set_buffer (output->overlay, buffer);
+        wlr_buffer_drop (buffer);
+
+        const float scale  = output->wlr_output->scale;
+        const int   width  = (int) (PANEL_WIDTH / scale);
+        const int   height = (int) (PANEL_HEIGHT / scale);
+        wlr_scene_buffer_set_dest_size (output->overlay, width, height);
+        wlr_scene_node_set_position (
+            &output->overlay->node, box.x + box.width - width - MARGIN, box.y + MARGIN);
+}
+
+static int perf_overlay_timer_notify (void *data) {
+        struct comp_server       *server  = data;
+        struct comp_perf_overlay *overlay = &server->perf_overlay;
+
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        double elapsed = (double) (now.tv_sec - overlay->last_update.tv_sec)
+                         + (double) (now.tv_nsec - overlay->last_update.tv_nsec) / 1e9;
+        if (elapsed <= 0) {
+                elapsed = 1;
+        }
+        overlay->last_update = now;
+
+        /* Redrawing would wake powered down outputs. */
+        if (!server->idle.idle) {
+                struct comp_output *output;
+                wl_list_for_each (output, &server->outputs, link) {
+                        overlay_update_output (output, elapsed);
+                }
+        }
+
+        wl_event_source_timer_update (overlay->timer, PERF_OVERLAY_INTERVAL_MS);
+        return 0;
+}
+
+void perf_overlay_output_destroy (struct comp_output *output) {
+        if (output->overlay != NULL) {
+                wlr_scene_node_destroy (&output->overlay->node);
+                output->overlay = NULL;
+        }
+}
+
+void perf_overlay_set_enabled (struct comp_server *server, bool enabled) {
+        struct comp_perf_overlay *overlay = &server->perf_overlay;
+        if (overlay->enabled == enabled) {
+                return;
+        }
+        overlay->enabled = enabled;
+
+        struct comp_output *output;
+        wl_list_for_each (output, &server->outputs, link) {
+                output->overlay_commits = output->commits - output->overlay_own_commits;
+                if (!enabled) {
+                        perf_overlay_output_destroy (output);
+                }
+        }
+        clock_gettime (CLOCK_MONOTONIC, &overlay->last_update);
+        wl_event_source_timer_update (overlay->timer, enabled ? PERF_OVERLAY_INTERVAL_MS : 0);
+        wlr_log (WLR_INFO, "Performance overlay %s", enabled ? "on" : "off");
+}
+
+void perf_overlay_init (struct comp_server *server) {
+        /* Must run after the scene layers are created, so that the overlay
+         * tree ends up above all of them. */
+        struct comp_perf_overlay *overlay = &server->perf_overlay;
+        const bool                enabled = overlay->enabled;
+        overlay->tree    = wlr_scene_tree_create (&server->scene->tree);
+        overlay->timer   = wl_event_loop_add_timer (server->wl_event_loop, perf_overlay_timer_notify, server);
+        overlay->enabled = false;
+        perf_overlay_set_enabled (server, enabled);
+}
+
+void perf_overlay_finish (struct comp_server *server) {
+        /* Runs before the scene is destroyed, which would free the nodes
+         * under our feet. */
+        perf_overlay_set_enabled (server, false);
+        if (server->perf_overlay.timer != NULL) {
+                wl_event_source_remove (server->perf_overlay.timer);
+                server->perf_overlay.timer = NULL;
+        }
+}
@@ -0,0 +1,29 @@
+#ifndef COMP_PERF_OVERLAY_H
+#define COMP_PERF_OVERLAY_H
+
+#include <stdbool.h>
+#include <time.h>
+
+struct comp_output;
+struct comp_server;
+
+/** On-screen performance overlay. A small panel in the top right corner of
+ * every output with its refresh rate, a graph of recent frame times, missed
+ * frames, commits per second and the number of mapped toplevels. It is
+ * redrawn a few times per second from counters the outputs keep anyway, so
+ * showing it costs a handful of extra commits per second and nothing per
+ * frame. */
+struct comp_perf_overlay
+{
+        bool                    enabled;
+        struct wlr_scene_tree  *tree; // above every scene layer
+        struct wl_event_source *timer;
+        struct timespec         last_update;
+};
+
+void perf_overlay_init (struct comp_server *server);
+void perf_overlay_finish (struct comp_server *server);
+void perf_overlay_set_enabled (struct comp_server *server, bool enabled);
+void perf_overlay_output_destroy (struct comp_output *output);
+
+#endif // COMP_PERF_OVERLAY_H
@@ -0,0 +1,114 @@
+#define _GNU_SOURCE
+
+#include "realtime.h"
+#include "nwm_server.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+/* Low on purpose: above every normal task, below the kernel's threaded
+ * interrupt handlers (50) and whatever audio servers use. */
+#define REALTIME_RR_PRIORITY 10
+#define REALTIME_NICE_VALUE  -10
+
+static bool set_rr (int priority) {
+        const struct sched_param param = { .sched_priority = priority };
+        return sched_setscheduler (0, SCHED_RR | SCHED_RESET_ON_FORK, &param) == 0;
+}
+
+static bool realtime_try_rr (struct comp_realtime *realtime) {
+        /* Without CAP_SYS_NICE, RLIMIT_RTPRIO (often set for the user by
+         * PAM or rtkit-style setups) caps the priority we may ask for. */
+        int priority = REALTIME_RR_PRIORITY;
+        if (!set_rr (priority)) {
+                struct rlimit limit;
+                if (errno != EPERM || getrlimit (RLIMIT_RTPRIO, &limit) < 0 || limit.rlim_cur == 0) {
+                        return false;
+                }
+                priority = (int) limit.rlim_cur;
+                if (priority >= REALTIME_RR_PRIORITY || !set_rr (priority)) {
+                        return false;
+                }
+        }
+        realtime->class    = REALTIME_RR;
+        realtime->priority = priority;
+        return true;
+}
+
+static bool realtime_try_nice (struct comp_realtime *realtime) {
+        /* Nice values are per thread on Linux. Reset on fork has to be set
+         * first, through the policy, for children to start back at 0. The
+         * lowest value allowed without privileges is 20 - RLIMIT_NICE, so
+         * walk up from the one we want until one is accepted. */
+        const struct sched_param param = { .sched_priority = 0 };
+        if (sched_setscheduler (0, SCHED_OTHER | SCHED_RESET_ON_FORK, &param) < 0) {
+                return false;
+        }
+        const pid_t tid = gettid ();
+        for (int nice = REALTIME_NICE_VALUE; nice < 0; nice++) {
+                if (setpriority (PRIO_PROCESS, (id_t) tid, nice) == 0) {
+                        realtime->class    = REALTIME_NICE;
+                        realtime->priority = nice;
+                        return true;
+                }
+        }
+        return false;
+}
+
+static void realtime_lock_memory (struct comp_realtime *realtime) {
+        /* Locking future mappings makes every later mmap fail once the
+         * locked total reaches RLIMIT_MEMLOCK, client buffers included. That
+         * is only safe without a limit; under one, only what is mapped now
+         * (code, libraries, the renderer, what was allocated so far) is
+         * locked, and only if it fits. */
+        struct rlimit limit;
+        const bool    unlimited = geteuid () == 0
+                            || (getrlimit (RLIMIT_MEMLOCK, &limit) == 0 && limit.rlim_cur == RLIM_INFINITY);
+        if (unlimited && mlockall (MCL_CURRENT | MCL_FUTURE) == 0) {
+                realtime->locked        = true;
+                realtime->locked_future = true;
+                return;
+        }
+        if (mlockall (MCL_CURRENT) == 0) {
+                realtime->locked = true;
+                return;
+        }
+        wlr_log_errno (WLR_INFO, "Low-latency mode: cannot lock memory, raise RLIMIT_MEMLOCK to allow it");
+}
+
+void realtime_init (struct comp_server *server) {
+        /* Runs on the compositor thread right before the loop, once the
+         * backend, renderer and input thread are up: threads started earlier
+         * keep normal priority, and the memory locked covers the setup. */
+        struct comp_realtime *realtime = &server->realtime;
+        if (!realtime->enabled) {
+                return;
+        }
+        if (!realtime_try_rr (realtime) && !realtime_try_nice (realtime)) {
+                wlr_log (WLR_ERROR,
+                         "Low-latency mode: not permitted to raise priority, grant CAP_SYS_NICE "
+                         "or an RLIMIT_RTPRIO/RLIMIT_NICE allowance");
+        }
+        realtime_lock_memory (realtime);
+        wlr_log (WLR_INFO,
+                 "Low-latency mode: %s %d, memory %s",
+                 realtime_class_name (realtime->class),
+                 realtime->priority,
+                 realtime->locked_future ? "locked" : realtime->locked ? "locked at startup" : "not locked");
+}
+
+const char *realtime_class_name (enum realtime_class class) {
+        switch (class) {
+        case REALTIME_RR:
+                return "SCHED_RR";
+        case REALTIME_NICE:
+                return "nice";
+        case REALTIME_NORMAL:
+                break;
+        }
+        return "normal";
+}
@@ -0,0 +1,33 @@
+#ifndef COMP_REALTIME_H
+#define COMP_REALTIME_H
+
+#include <stdbool.h>
+
+struct comp_server;
+
+enum realtime_class
+{
+        REALTIME_NORMAL, // not enabled, or nothing was permitted
+        REALTIME_NICE,   // SCHED_OTHER at a negative nice value
+        REALTIME_RR,     // SCHED_RR
+};
+
+/** Low-latency mode. The compositor thread, the one in server_run,
+ * asks for SCHED_RR and settles for a raised nice value when that is not
+ * permitted, so that a loaded machine does not hold back input handling and
+ * frames. Either way SCHED_RESET_ON_FORK is set: anything the thread starts
+ * later, threads included, is back at normal priority. Memory is locked so
+ * the loop never stalls on paging in its own code or data. */
+struct comp_realtime
+{
+        bool                enabled;
+        enum realtime_class class;
+        int                 priority;      // SCHED_RR priority, or the nice value
+        bool                locked;        // pages mapped when it started
+        bool                locked_future; // and everything mapped after
+};
+
+void        realtime_init (struct comp_server *server);
+const char *realtime_class_name (enum realtime_class class);
+
+#endif // COMP_REALTIME_H
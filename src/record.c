@@ -0,0 +1,164 @@
+#include "record.h"
+#include "nwm_server.h"
+#include "timespec.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <wlr/types/wlr_input_device.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+struct record_device
+{
+        struct wl_list           link;
+        struct comp_server      *server;
+        struct wlr_input_device *device;
+        uint16_t                 id;
+        struct wl_listener       destroy;
+};
+
+bool record_open (struct comp_server *server, const char *path) {
+        struct comp_record *record = &server->record;
+        wl_list_init (&record->devices);
+
+        record->file = fopen (path, "wb");
+        if (record->file == NULL) {
+                wlr_log_errno (WLR_ERROR, "Failed to open recording %s", path);
+                return false;
+        }
+        /* Big enough for any record, so header and payload leave in a single
+         * write when record_event flushes. */
+        setvbuf (record->file, NULL, _IOFBF, sizeof (struct record_header) + UINT16_MAX);
+
+        struct record_file_header header = { .version = RECORD_VERSION };
+        memcpy (header.magic, RECORD_MAGIC, sizeof (header.magic));
+        fwrite (&header, sizeof (header), 1, record->file);
+
+        clock_gettime (CLOCK_MONOTONIC, &record->start);
+        wlr_log (WLR_INFO, "Recording input and output events to %s", path);
+        return true;
+}
+
+void record_event (struct comp_server *server,
+                   enum record_type    type,
+                   uint16_t            id,
+                   const void         *payload,
+                   uint16_t            size) {
+        struct comp_record *record = &server->record;
+        if (record->file == NULL) {
+                return;
+        }
+
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        const struct record_header header = {
+                .time_usec = timespec_diff_usec (&now, &record->start),
+                .type      = type,
+                .id        = id,
+                .size      = size,
+        };
+        fwrite (&header, sizeof (header), 1, record->file);
+        if (size > 0) {
+                fwrite (payload, size, 1, record->file);
+        }
+        /* Hand every record to the kernel right away, a crash should not take
+         * the events leading up to it along. */
+        fflush (record->file);
+}
+
+static void record_device_destroy (struct wl_listener *listener, void *data) {
+        struct record_device *device = wl_container_of (listener, device, destroy);
+        record_event (device->server, RECORD_DEVICE_REMOVE, device->id, NULL, 0);
+        wl_list_remove (&device->destroy.link);
+        wl_list_remove (&device->link);
+        free (device);
+}
+
+uint16_t record_input_device (struct comp_server *server, struct wlr_input_device *device) {
+        /* Devices get small ids in the order they appear; every later event
+         * from the device refers to it by that id. */
+        struct comp_record *record = &server->record;
+        if (record->file == NULL) {
+                return 0;
+        }
+
+        struct record_device *rec_device = calloc (1, sizeof (*rec_device));
+        rec_device->server               = server;
+        rec_device->device               = device;
+        rec_device->id                   = record->next_device_id++;
+        rec_device->destroy.notify       = record_device_destroy;
+        wl_signal_add (&device->events.destroy, &rec_device->destroy);
+        wl_list_insert (&record->devices, &rec_device->link);
+
+        const char               *name     = device->name != NULL ? device->name : "";
+        const size_t              name_len = strlen (name) + 1;
+        const size_t              len      = name_len < 256 ? name_len : 256;
+        uint8_t                   payload[sizeof (struct record_device_add) + 256];
+        struct record_device_add *add = (struct record_device_add *) payload;
+
+        add->device_type = device->type;
+        memcpy (add->name, name, len);
+        add->name[len - 1] = '\0';
+        record_event (server, RECORD_DEVICE_ADD, rec_device->id, payload, sizeof (*add) + len);
+        return rec_device->id;
+}
+
+void record_device_event (struct comp_server      *server,
+                          struct wlr_input_device *device,
+                          enum record_type         type,
+                          const void              *payload,
+                          uint16_t                 size) {
+        struct comp_record *record = &server->record;
+        if (record->file == NULL) {
+                return;
+        }
+
+        struct record_device *rec_device;
+        wl_list_for_each (rec_device, &record->devices, link) {
+                if (rec_device->device == device) {
+                        if (device->type == WLR_INPUT_DEVICE_POINTER) {
+                                record->last_pointer_id = rec_device->id;
+                        }
+                        record_event (server, type, rec_device->id, payload, size);
+                        return;
+                }
+        }
+}
+
+uint16_t record_output_add (struct comp_server *server, struct wlr_output *output) {
+        struct comp_record *record = &server->record;
+        if (record->file == NULL) {
+                return 0;
+        }
+
+        const size_t              name_len = strlen (output->name) + 1;
+        const size_t              len      = name_len < 64 ? name_len : 64;
+        uint8_t                   payload[sizeof (struct record_output_add) + 64];
+        struct record_output_add *add = (struct record_output_add *) payload;
+
+        add->width   = output->width;
+        add->height  = output->height;
+        add->refresh = output->refresh;
+        memcpy (add->name, output->name, len);
+        add->name[len - 1] = '\0';
+
+        const uint16_t id = record->next_output_id++;
+        record_event (server, RECORD_OUTPUT_ADD, id, payload, sizeof (*add) + len);
+        return id;
+}
+
+void record_close (struct comp_server *server) {
+        struct comp_record *record = &server->record;
+        if (record->file == NULL) {
+                return;
+        }
+
+        struct record_device *device, *tmp;
+        wl_list_for_each_safe (device, tmp, &record->devices, link) {
+                wl_list_remove (&device->destroy.link);
+                wl_list_remove (&device->link);
+                free (device);
+        }
+        fclose (record->file);
+        record->file = NULL;
+}
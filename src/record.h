@@ -0,0 +1,126 @@
+#ifndef COMP_RECORD_H
+#define COMP_RECORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <wayland-server-core.h>
+
+struct comp_server;
+struct wlr_input_device;
+struct wlr_keyboard_key_event;
+struct wlr_output;
+
+/* On-disk format of a recording: a file header followed by records. Every
+ * record is a record_header followed by `size` bytes of payload. All fields
+ * are host-endian; recordings are meant to be replayed on the machine class
+ * they were captured on, not exchanged. */
+#define RECORD_MAGIC   "NWMREC"
+#define RECORD_VERSION 2
+
+struct record_file_header
+{
+        char     magic[6];
+        uint16_t version;
+} __attribute__ ((packed));
+
+enum record_type
+{
+        RECORD_DEVICE_ADD = 1,
+        RECORD_DEVICE_REMOVE,
+        RECORD_POINTER_MOTION,
+        RECORD_POINTER_MOTION_ABSOLUTE,
+        RECORD_POINTER_BUTTON,
+        RECORD_POINTER_AXIS,
+        RECORD_POINTER_FRAME,
+        RECORD_KEYBOARD_KEY,
+        RECORD_OUTPUT_ADD,
+        RECORD_OUTPUT_FRAME,
+        RECORD_OUTPUT_PRESENT,
+};
+
+struct record_header
+{
+        uint64_t time_usec; // since the start of the recording
+        uint8_t  type;      // enum record_type
+        uint16_t id;        // device or output id
+        uint16_t size;      // payload size
+} __attribute__ ((packed));
+
+struct record_device_add
+{
+        uint8_t device_type; // enum wlr_input_device_type
+        char    name[];      // NUL terminated
+} __attribute__ ((packed));
+
+struct record_pointer_motion
+{
+        uint32_t time_msec;
+        double   delta_x, delta_y;
+        double   unaccel_dx, unaccel_dy;
+} __attribute__ ((packed));
+
+struct record_pointer_motion_absolute
+{
+        uint32_t time_msec;
+        double   x, y;
+} __attribute__ ((packed));
+
+struct record_pointer_button
+{
+        uint32_t time_msec;
+        uint32_t button;
+        uint8_t  state;
+} __attribute__ ((packed));
+
+struct record_pointer_axis
+{
+        uint32_t time_msec;
+        uint8_t  source;
+        uint8_t  orientation;
+        uint8_t  relative_direction;
+        double   delta;
+        int32_t  delta_discrete;
+} __attribute__ ((packed));
+
+struct record_keyboard_key
+{
+        uint32_t time_msec;
+        uint32_t keycode;
+        uint8_t  state;
+} __attribute__ ((packed));
+
+struct record_output_add
+{
+        int32_t width, height;
+        int32_t refresh; // mHz
+        char    name[];  // NUL terminated
+} __attribute__ ((packed));
+
+struct comp_record
+{
+        FILE           *file;
+        struct timespec start;
+        struct wl_list  devices; // record_device::link
+        uint16_t        next_device_id;
+        uint16_t        next_output_id;
+        uint16_t        last_pointer_id; // pointer frames carry no device
+};
+
+bool     record_open (struct comp_server *server, const char *path);
+void     record_close (struct comp_server *server);
+uint16_t record_input_device (struct comp_server *server, struct wlr_input_device *device);
+uint16_t record_output_add (struct comp_server *server, struct wlr_output *output);
+void     record_event (struct comp_server *server,
+                       enum record_type    type,
+                       uint16_t            id,
+                       const void         *payload,
+                       uint16_t            size);
+void     record_device_event (struct comp_server      *server,
+                              struct wlr_input_device *device,
+                              enum record_type         type,
+                              const void              *payload,
+                              uint16_t                 size);
+
+#endif // COMP_RECORD_H
@@ -0,0 +1,366 @@
+#include "replay.h"
+#include "input/input.h"
+#include "input/synthetic.h"
+#include "nwm_server.h"
+#include "timespec.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <wlr/backend/headless.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+/* Records dispatched per loop iteration at maximum speed, so outputs still get
+ * to render in between instead of the whole file being drained in one go. */
+#define REPLAY_MAX_SPEED_BATCH 64
+/* Time given to the last frames to reach the screen before exiting. */
+#define REPLAY_EXIT_GRACE_MS   500
+
+static bool replay_read_next (struct comp_replay *replay) {
+        replay->have_next = false;
+        if (fread (&replay->next, sizeof (replay->next), 1, replay->file) != 1) {
+                return false;
+        }
+        if (replay->next.size > 0
+            && fread (replay->payload, replay->next.size, 1, replay->file) != 1) {
+                wlr_log (WLR_ERROR, "Replay: truncated record");
+                return false;
+        }
+        replay->have_next = true;
+        return true;
+}
+
+static uint32_t replay_time_msec (struct comp_replay *replay, uint32_t recorded) {
+        /* Keep the recorded spacing between event timestamps, shifted so the
+         * first one lines up with the current time. */
+        if (!replay->have_time_offset) {
+                replay->time_offset_msec = (uint32_t) (now_usec () / 1000) - recorded;
+                replay->have_time_offset = true;
+        }
+        return recorded + replay->time_offset_msec;
+}
+
+static struct wlr_input_device *replay_device (struct comp_replay *replay, uint16_t id) {
+        return id < replay->devices_len ? replay->devices[id] : NULL;
+}
+
+static struct wlr_pointer *replay_pointer (struct comp_replay *replay, uint16_t id) {
+        struct wlr_input_device *device = replay_device (replay, id);
+        if (device == NULL || device->type != WLR_INPUT_DEVICE_POINTER) {
+                return NULL;
+        }
+        return wlr_pointer_from_input_device (device);
+}
+
+static struct wlr_keyboard *replay_keyboard (struct comp_replay *replay, uint16_t id) {
+        struct wlr_input_device *device = replay_device (replay, id);
+        if (device == NULL || device->type != WLR_INPUT_DEVICE_KEYBOARD) {
+                return NULL;
+        }
+        return wlr_keyboard_from_input_device (device);
+}
+
+static void replay_device_add (struct comp_server *server, uint16_t id, const void *payload) {
+        struct comp_replay             *replay = &server->replay;
+        const struct record_device_add *add    = payload;
+        struct wlr_input_device        *device = NULL;
+
+        if (id >= replay->devices_len) {
+                /* Ids are handed out in order, so the table only ever grows
+                 * to the number of devices seen so far. */
+                const size_t              len = (size_t) id + 1;
+                struct wlr_input_device **devices
+                    = realloc (replay->devices, len * sizeof (*devices));
+                if (devices == NULL) {
+                        wlr_log (WLR_ERROR, "Replay: out of memory for device %d", id);
+                        return;
+                }
+                memset (devices + replay->devices_len,
+                        0,
+                        (len - replay->devices_len) * sizeof (*devices));
+                replay->devices     = devices;
+                replay->devices_len = len;
+        }
+
+        switch (add->device_type) {
+        case WLR_INPUT_DEVICE_POINTER:
+                device = &synthetic_pointer_create (add->name)->base;
+                break;
+        case WLR_INPUT_DEVICE_KEYBOARD:
+                device = &synthetic_keyboard_create (add->name, NULL, NULL)->base;
+                break;
+        default:
+                wlr_log (WLR_DEBUG, "Replay: skipping unsupported device %s", add->name);
+                return;
+        }
+        replay->devices[id] = device;
+        server_new_input (&server->new_input, device);
+}
+
+static void replay_device_remove (struct comp_replay *replay, uint16_t id) {
+        struct wlr_input_device *device = replay_device (replay, id);
+        if (device == NULL) {
+                return;
+        }
+        replay->devices[id] = NULL;
+        if (device->type == WLR_INPUT_DEVICE_POINTER) {
+                synthetic_pointer_destroy (wlr_pointer_from_input_device (device));
+        } else {
+                synthetic_keyboard_destroy (wlr_keyboard_from_input_device (device));
+        }
+}
+
+static void replay_output_add (struct comp_server *server, const void *payload) {
+        /* Recreate the recorded output as a headless one of the same size and
+         * refresh rate; new_output_notify takes it from there. */
+        const struct record_output_add *add    = payload;
+        struct wlr_output              *output = wlr_headless_add_output (
+            server->backend, add->width, add->height);
+
+        struct wlr_output_state state;
+        wlr_output_state_init (&state);
+        wlr_output_state_set_custom_mode (&state, add->width, add->height, add->refresh);
+        wlr_output_commit_state (output, &state);
+        wlr_output_state_finish (&state);
+
+        wlr_log (WLR_INFO,
+                 "Replay: output %s as %dx%d@%.2fHz",
+                 add->name,
+                 add->width,
+                 add->height,
+                 add->refresh / 1000.0);
+}
+
+static void replay_dispatch (struct comp_server *server) {
+        struct comp_replay         *replay  = &server->replay;
+        const struct record_header *header  = &replay->next;
+        const void                 *payload = replay->payload;
+        struct wlr_pointer         *pointer;
+        struct wlr_keyboard        *keyboard;
+
+        switch (header->type) {
+        case RECORD_DEVICE_ADD:
+                replay_device_add (server, header->id, payload);
+                break;
+        case RECORD_DEVICE_REMOVE:
+                replay_device_remove (replay, header->id);
+                break;
+        case RECORD_POINTER_MOTION:
+                if ((pointer = replay_pointer (replay, header->id)) != NULL) {
+                        const struct record_pointer_motion *rec   = payload;
+                        struct wlr_pointer_motion_event     event = {
+                                    .pointer    = pointer,
+                                    .time_msec  = replay_time_msec (replay, rec->time_msec),
+                                    .delta_x    = rec->delta_x,
+                                    .delta_y    = rec->delta_y,
+                                    .unaccel_dx = rec->unaccel_dx,
+                                    .unaccel_dy = rec->unaccel_dy,
+                        };
+                        wl_signal_emit_mutable (&pointer->events.motion, &event);
+                }
+                break;
+        case RECORD_POINTER_MOTION_ABSOLUTE:
+                if ((pointer = replay_pointer (replay, header->id)) != NULL) {
+                        const struct record_pointer_motion_absolute *rec   = payload;
+                        struct wlr_pointer_motion_absolute_event     event = {
+                                    .pointer   = pointer,
+                                    .time_msec = replay_time_msec (replay, rec->time_msec),
+                                    .x         = rec->x,
+                                    .y         = rec->y,
+                        };
+                        wl_signal_emit_mutable (&pointer->events.motion_absolute, &event);
+                }
+                break;
+        case RECORD_POINTER_BUTTON:
+                if ((pointer = replay_pointer (replay, header->id)) != NULL) {
+                        const struct record_pointer_button *rec   = payload;
+                        struct wlr_pointer_button_event     event = {
+                                    .pointer   = pointer,
+                                    .time_msec = replay_time_msec (replay, rec->time_msec),
+                                    .button    = rec->button,
+                                    .state     = rec->state,
+                        };
+                        wl_signal_emit_mutable (&pointer->events.button, &event);
+                }
+                break;
+        case RECORD_POINTER_AXIS:
+                if ((pointer = replay_pointer (replay, header->id)) != NULL) {
+                        const struct record_pointer_axis *rec   = payload;
+                        struct wlr_pointer_axis_event     event = {
+                                    .pointer            = pointer,
+                                    .time_msec          = replay_time_msec (replay, rec->time_msec),
+                                    .source             = rec->source,
+                                    .orientation        = rec->orientation,
+                                    .relative_direction = rec->relative_direction,
+                                    .delta              = rec->delta,
+                                    .delta_discrete     = rec->delta_discrete,
+                        };
+                        wl_signal_emit_mutable (&pointer->events.axis, &event);
+                }
+                break;
+        case RECORD_POINTER_FRAME:
+                if ((pointer = replay_pointer (replay, header->id)) != NULL) {
+                        wl_signal_emit_mutable (&pointer->events.frame, pointer);
+                }
+                break;
+        case RECORD_KEYBOARD_KEY:
+                if ((keyboard = replay_keyboard (replay, header->id)) != NULL) {
+                        const struct record_keyboard_key *rec   = payload;
+                        struct wlr_keyboard_key_event     event = {
+                                    .time_msec    = replay_time_msec (replay, rec->time_msec),
+                                    .keycode      = rec->keycode,
+                                    .update_state = true,
+                                    .state        = rec->state,
+                        };
+                        wlr_keyboard_notify_key (keyboard, &event);
+                }
+                break;
+        case RECORD_OUTPUT_ADD:
+                replay_output_add (server, payload);
+                break;
+        case RECORD_OUTPUT_FRAME:
+        case RECORD_OUTPUT_PRESENT:
+                /* Reference timing of the original session, nothing to inject. */
+                break;
+        default:
+                wlr_log (WLR_DEBUG, "Replay: skipping unknown record type %d", header->type);
+                break;
+        }
+        replay->events++;
+}
+
+static int replay_exit_notify (void *data) {
+        struct comp_server *server = data;
+        server_terminate (server);
+        return 0;
+}
+
+static void replay_done (struct comp_server *server) {
+        struct comp_replay *replay  = &server->replay;
+        const double        elapsed = (now_usec () - timespec_to_usec (&replay->start)) / 1e6;
+        wlr_log (WLR_INFO,
+                 "Replay finished: %lu events in %.3fs",
+                 (unsigned long) replay->events,
+                 elapsed);
+
+        wl_event_source_remove (replay->source);
+        replay->source = wl_event_loop_add_timer (server->wl_event_loop, replay_exit_notify, server);
+        wl_event_source_timer_update (replay->source, REPLAY_EXIT_GRACE_MS);
+}
+
+static void replay_pump (struct comp_server *server) {
+        struct comp_replay *replay = &server->replay;
+        const uint64_t      start  = timespec_to_usec (&replay->start);
+        int                 budget = REPLAY_MAX_SPEED_BATCH;
+
+        while (replay->have_next) {
+                if (replay->max_speed) {
+                        if (budget-- == 0) {
+                                return;
+                        }
+                } else {
+                        const uint64_t due = start + replay->next.time_usec;
+                        const uint64_t now = now_usec ();
+                        if (now < due) {
+                                /* Event loop timers have millisecond resolution,
+                                 * round up so we never fire early. */
+                                wl_event_source_timer_update (replay->source,
+                                                              (int) ((due - now + 999) / 1000));
+                                return;
+                        }
+                }
+                replay_dispatch (server);
+                replay_read_next (replay);
+        }
+        replay_done (server);
+}
+
+static int replay_timer_notify (void *data) {
+        replay_pump (data);
+        return 0;
+}
+
+static int replay_wake_notify (int fd, uint32_t mask, void *data) {
+        replay_pump (data);
+        return 0;
+}
+
+bool replay_open (struct comp_server *server, const char *path) {
+        struct comp_replay *replay = &server->replay;
+        replay->wake_fd            = -1;
+
+        replay->file = fopen (path, "rb");
+        if (replay->file == NULL) {
+                wlr_log_errno (WLR_ERROR, "Failed to open replay %s", path);
+                return false;
+        }
+
+        struct record_file_header header;
+        if (fread (&header, sizeof (header), 1, replay->file) != 1
+            || memcmp (header.magic, RECORD_MAGIC, sizeof (header.magic)) != 0
+            || header.version != RECORD_VERSION) {
+                wlr_log (WLR_ERROR, "%s is not an nwm recording (version %d)", path, RECORD_VERSION);
+                fclose (replay->file);
+                replay->file = NULL;
+                return false;
+        }
+
+        replay->payload = malloc (UINT16_MAX);
+        if (replay->payload == NULL) {
+                wlr_log (WLR_ERROR, "Failed to allocate the replay buffer");
+                fclose (replay->file);
+                replay->file = NULL;
+                return false;
+        }
+        return true;
+}
+
+void replay_start (struct comp_server *server) {
+        /* Called once the headless backend is running. */
+        struct comp_replay *replay = &server->replay;
+        clock_gettime (CLOCK_MONOTONIC, &replay->start);
+
+        if (replay->max_speed) {
+                /* An eventfd that is never drained stays readable, so the loop
+                 * dispatches one batch per iteration without ever sleeping. */
+                replay->wake_fd = eventfd (1, EFD_CLOEXEC | EFD_NONBLOCK);
+                replay->source  = wl_event_loop_add_fd (
+                    server->wl_event_loop, replay->wake_fd, WL_EVENT_READABLE, replay_wake_notify, server);
+        } else {
+                replay->source
+                    = wl_event_loop_add_timer (server->wl_event_loop, replay_timer_notify, server);
+        }
+
+        wlr_log (WLR_INFO, "Replaying at %s speed", replay->max_speed ? "maximum" : "original");
+        if (!replay_read_next (replay)) {
+                wlr_log (WLR_ERROR, "Replay: recording is empty");
+        }
+        replay_pump (server);
+}
+
+void replay_close (struct comp_server *server) {
+        struct comp_replay *replay = &server->replay;
+        if (replay->file == NULL) {
+                return;
+        }
+
+        for (size_t id = 0; id < replay->devices_len; id++) {
+                replay_device_remove (replay, id);
+        }
+        free (replay->devices);
+        replay->devices     = NULL;
+        replay->devices_len = 0;
+        if (replay->source != NULL) {
+                wl_event_source_remove (replay->source);
+        }
+        if (replay->wake_fd >= 0) {
+                close (replay->wake_fd);
+        }
+        fclose (replay->file);
+        replay->file = NULL;
+        free (replay->payload);
+        replay->payload = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef COMP_REPLAY_H
+#define COMP_REPLAY_H
+
+#include "record.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+struct comp_server;
+struct wlr_input_device;
+
+/** Feeds a recording made with --record back into nwm through synthetic
+ * devices and headless outputs, either with the original timing or as fast
+ * as the event loop allows. nwm exits once the recording is exhausted, so the
+ * usual --stats/--latency reports can be compared between builds. */
+struct comp_replay
+{
+        FILE                     *file;
+        bool                      max_speed;
+        struct wl_event_source   *source;
+        int                       wake_fd; // always readable, drives max speed replay
+        struct timespec           start;
+        bool                      have_time_offset;
+        uint32_t                  time_offset_msec;
+        uint64_t                  events;
+        struct record_header      next;
+        bool                      have_next;
+        uint8_t                  *payload;     // UINT16_MAX bytes
+        struct wlr_input_device **devices;     // indexed by record id
+        size_t                    devices_len;
+};
+
+bool replay_open (struct comp_server *server, const char *path);
+void replay_start (struct comp_server *server);
+void replay_close (struct comp_server *server);
+
+#endif // COMP_REPLAY_H
@@ -0,0 +1,64 @@
+#include "stats.h"
+#include "nwm_server.h"
+
+#include <wayland-server-core.h>
+#include <wlr/util/log.h>
+
+#define STATS_INTERVAL_MS 1000
+
+static double timespec_diff_sec (const struct timespec *a, const struct timespec *b) {
+        return (double) (a->tv_sec - b->tv_sec) + (double) (a->tv_nsec - b->tv_nsec) / 1e9;
+}
+
+static int stats_timer_notify (void *data) {
+        /* Report every counter as a per-second rate and start a new window. */
+        struct comp_server *server = data;
+        struct comp_stats  *stats  = &server->stats;
+
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        double elapsed = timespec_diff_sec (&now, &stats->window_start);
+        if (elapsed <= 0) {
+                elapsed = 1;
+        }
+
+        wlr_log (WLR_INFO,
+                 "stats: cursor moves %.1f/s, cursor image updates %.1f/s (skipped %.1f/s), "
+                 "output commits %.1f/s, scene render %.2fms/s, mirror render %.2fms/s",
+                 stats->cursor_moves / elapsed,
+                 stats->cursor_image_updates / elapsed,
+                 stats->cursor_image_skipped / elapsed,
+                 stats->output_commits / elapsed,
+                 stats->scene_render_usec / 1000.0 / elapsed,
+                 stats->mirror_render_usec / 1000.0 / elapsed);
+
+        stats->cursor_moves         = 0;
+        stats->cursor_image_updates = 0;
+        stats->cursor_image_skipped = 0;
+        stats->output_commits       = 0;
+        stats->scene_render_usec    = 0;
+        stats->mirror_render_usec   = 0;
+        stats->window_start         = now;
+
+        wl_event_source_timer_update (stats->timer, STATS_INTERVAL_MS);
+        return 0;
+}
+
+void stats_init (struct comp_server *server) {
+        /* Counters are always maintained since they are just increments; the
+         * periodic report is only armed when asked for. */
+        struct comp_stats *stats = &server->stats;
+        clock_gettime (CLOCK_MONOTONIC, &stats->window_start);
+        if (!stats->enabled) {
+                return;
+        }
+        stats->timer = wl_event_loop_add_timer (server->wl_event_loop, stats_timer_notify, server);
+        wl_event_source_timer_update (stats->timer, STATS_INTERVAL_MS);
+}
+
+void stats_finish (struct comp_server *server) {
+        if (server->stats.timer != NULL) {
+                wl_event_source_remove (server->stats.timer);
+                server->stats.timer = NULL;
+        }
+}
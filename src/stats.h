@@ -0,0 +1,29 @@
+#ifndef COMP_STATS_H
+#define COMP_STATS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+struct comp_server;
+
+/** Counters reset once per reporting interval. Only touched from the
+ * compositor thread, so plain integers are enough. */
+struct comp_stats
+{
+        bool                    enabled;
+        struct wl_event_source *timer;
+        struct timespec         window_start;
+
+        uint64_t cursor_moves;         // cursor position changes, each damages a cursor plane
+        uint64_t cursor_image_updates; // cursor image changes actually applied
+        uint64_t cursor_image_skipped; // redundant cursor image requests dropped
+        uint64_t output_commits;       // frames committed across all outputs
+        uint64_t scene_render_usec;    // time spent rendering and committing the scene
+        uint64_t mirror_render_usec;   // time spent blitting to mirror outputs
+};
+
+void stats_init (struct comp_server *server);
+void stats_finish (struct comp_server *server);
+
+#endif // COMP_STATS_H
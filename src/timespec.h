@@ -0,0 +1,27 @@
+#ifndef COMP_TIMESPEC_H
+#define COMP_TIMESPEC_H
+
+#include <stdint.h>
+#include <time.h>
+
+/* Microsecond arithmetic on CLOCK_MONOTONIC timestamps, shared by everything
+ * that measures or schedules frames and input. */
+
+static inline int64_t timespec_to_usec (const struct timespec *ts) {
+        return (int64_t) ts->tv_sec * 1000000 + ts->tv_nsec / 1000;
+}
+
+static inline int64_t now_usec (void) {
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        return timespec_to_usec (&now);
+}
+
+/* a - b, or 0 if b is the later one. */
+static inline uint64_t timespec_diff_usec (const struct timespec *a, const struct timespec *b) {
+        const int64_t usec = (int64_t) (a->tv_sec - b->tv_sec) * 1000000
+                             + (a->tv_nsec - b->tv_nsec) / 1000;
+        return usec > 0 ? (uint64_t) usec : 0;
+}
+
+#endif // COMP_TIMESPEC_H
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+
+#include "virtual_output.h"
+#include "alloc.h"
+#include "nwm_server.h"
+#include "output.h"
+#include "timespec.h"
+
+#include <drm_fourcc.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <pixman.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <wlr/backend/headless.h>
+#include <wlr/backend/multi.h>
+#include <wlr/render/wlr_texture.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+/** The geometry is kept here and only ever written to the header: encoders
+ * cannot write to the ring, but nothing read back from it is trusted. */
+struct virtual_ring
+{
+        int                         fd;
+        void                       *map;
+        size_t                      size;
+        struct virtual_ring_header *header;
+        int                         width, height;
+        uint32_t                    stride;
+        size_t                      slot_offset, slot_size;
+        size_t                      pixel_offset; // from the start of a slot
+        uint64_t                    seq;          // last frame written
+        pixman_region32_t           stale[VIRTUAL_RING_SLOTS]; // changed since the slot was written
+};
+
+static size_t page_align (size_t size) {
+        const size_t page = (size_t) sysconf (_SC_PAGESIZE);
+        return (size + page - 1) / page * page;
+}
+
+static struct virtual_ring_slot *ring_slot (struct virtual_ring *ring, uint32_t index) {
+        return (struct virtual_ring_slot *) ((char *) ring->map + ring->slot_offset + index * ring->slot_size);
+}
+
+static struct virtual_ring *ring_create (const char *name, int width, int height) {
+        /* Sealed, so an encoder can map it once and trust the size for good.
+         * Writes are sealed off once nwm has its own mapping, which stays
+         * writable: the fd handed out can only be mapped read-only. */
+        const uint32_t stride      = (uint32_t) width * 4;
+        const size_t   pixel_off   = page_align (sizeof (struct virtual_ring_slot));
+        const size_t   slot_size   = page_align (pixel_off + (size_t) stride * height);
+        const size_t   slot_offset = page_align (sizeof (struct virtual_ring_header));
+        const size_t   size        = slot_offset + slot_size * VIRTUAL_RING_SLOTS;
+
+        char memfd_name[64];
+        snprintf (memfd_name, sizeof (memfd_name), "nwm-virtual-%s", name);
+        const int fd = memfd_create (memfd_name, MFD_CLOEXEC | MFD_ALLOW_SEALING);
+        if (fd < 0) {
+                wlr_log_errno (WLR_ERROR, "Virtual output %s: memfd_create failed", name);
+                return NULL;
+        }
+        void *map = MAP_FAILED;
+        if (ftruncate (fd, (off_t) size) < 0 || fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW) < 0
+            || (map = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED
+            || fcntl (fd, F_ADD_SEALS, F_SEAL_FUTURE_WRITE | F_SEAL_SEAL) < 0) {
+                wlr_log_errno (WLR_ERROR, "Virtual output %s: cannot set up a %zu byte ring", name, size);
+                if (map != MAP_FAILED) {
+                        munmap (map, size);
+                }
+                close (fd);
+                return NULL;
+        }
+
+        struct virtual_ring *ring = nwm_alloc (ALLOC_OUTPUT, struct virtual_ring);
+        ring->fd                  = fd;
+        ring->map                 = map;
+        ring->size                = size;
+        ring->header              = map;
+        ring->width               = width;
+        ring->height              = height;
+        ring->stride              = stride;
+        ring->slot_offset         = slot_offset;
+        ring->slot_size           = slot_size;
+        ring->pixel_offset        = pixel_off;
+        *ring->header             = (struct virtual_ring_header) {
+                .magic       = VIRTUAL_RING_MAGIC,
+                .version     = VIRTUAL_RING_VERSION,
+                .width       = (uint32_t) width,
+                .height      = (uint32_t) height,
+                .stride      = stride,
+                .format      = DRM_FORMAT_XRGB8888,
+                .slots       = VIRTUAL_RING_SLOTS,
+                .slot_size   = (uint32_t) slot_size,
+                .slot_offset = slot_offset,
+        };
+        for (uint32_t i = 0; i < VIRTUAL_RING_SLOTS; i++) {
+                ring_slot (ring, i)->pixel_offset = (uint32_t) pixel_off;
+                pixman_region32_init_rect (&ring->stale[i], 0, 0, width, height);
+        }
+        return ring;
+}
+
+static void ring_destroy (struct virtual_ring *ring) {
+        /* Encoders keep their mapping, they just stop seeing new frames. */
+        for (uint32_t i = 0; i < VIRTUAL_RING_SLOTS; i++) {
+                pixman_region32_fini (&ring->stale[i]);
+        }
+        munmap (ring->map, ring->size);
+        close (ring->fd);
+        nwm_free (ring);
+}
+
+static void ring_set_rects (struct virtual_ring_slot *slot, const pixman_region32_t *damage) {
+        int                   nboxes;
+        const pixman_box32_t *boxes = pixman_region32_rectangles ((pixman_region32_t *) damage, &nboxes);
+        if (nboxes > VIRTUAL_RING_RECTS) {
+                boxes  = pixman_region32_extents ((pixman_region32_t *) damage);
+                nboxes = 1;
+        }
+        for (int i = 0; i < nboxes; i++) {
+                slot->rects[i] = (struct virtual_ring_rect) {
+                        .x      = boxes[i].x1,
+                        .y      = boxes[i].y1,
+                        .width  = boxes[i].x2 - boxes[i].x1,
+                        .height = boxes[i].y2 - boxes[i].y1,
+                };
+        }
+        slot->nrects = (uint32_t) nboxes;
+}
+
+void virtual_output_commit (struct comp_output *output, struct wlr_output_event_commit *event) {
+        /* Called on every commit of every output; only virtual outputs that
+         * committed a buffer with damage produce a frame. The slot written
+         * is brought up to date with everything that changed since it was
+         * last written, which is the frame damage plus that of the frames
+         * in the other slots. */
+        struct virtual_ring           *ring  = output->virtual_ring;
+        const struct wlr_output_state *state = event->state;
+        if (ring == NULL || !(state->committed & WLR_OUTPUT_STATE_BUFFER) || state->buffer == NULL) {
+                return;
+        }
+        if (state->buffer->width != ring->width || state->buffer->height != ring->height) {
+                wlr_log (WLR_DEBUG, "Virtual output %s: buffer does not match the ring", output->wlr_output->name);
+                return;
+        }
+
+        pixman_region32_t damage;
+        if (state->committed & WLR_OUTPUT_STATE_DAMAGE) {
+                pixman_region32_init (&damage);
+                pixman_region32_intersect_rect (
+                    &damage, (pixman_region32_t *) &state->damage, 0, 0, ring->width, ring->height);
+        } else {
+                pixman_region32_init_rect (&damage, 0, 0, ring->width, ring->height);
+        }
+        if (!pixman_region32_not_empty (&damage)) {
+                pixman_region32_fini (&damage);
+                return;
+        }
+
+        struct wlr_texture *texture = wlr_texture_from_buffer (output->server->renderer, state->buffer);
+        if (texture == NULL) {
+                pixman_region32_fini (&damage);
+                return;
+        }
+
+        const uint64_t            seq   = ring->seq + 1;
+        const uint32_t            index = (uint32_t) ((seq - 1) % VIRTUAL_RING_SLOTS);
+        struct virtual_ring_slot *slot  = ring_slot (ring, index);
+        for (uint32_t i = 0; i < VIRTUAL_RING_SLOTS; i++) {
+                pixman_region32_union (&ring->stale[i], &ring->stale[i], &damage);
+        }
+
+        /* Mark the slot as being written. The fence keeps the pixel and rect
+         * writes below from becoming visible before the mark does, a reader
+         * checking seq after copying sees either 0 or a changed value. */
+        atomic_store_explicit (&slot->seq, 0, memory_order_relaxed);
+        atomic_thread_fence (memory_order_release);
+        int                   nboxes;
+        const pixman_box32_t *boxes = pixman_region32_rectangles (&ring->stale[index], &nboxes);
+        bool                  ok    = true;
+        for (int i = 0; i < nboxes && ok; i++) {
+                ok = wlr_texture_read_pixels (texture,
+                                              &(struct wlr_texture_read_pixels_options) {
+                                                  .data    = (char *) slot + ring->pixel_offset,
+                                                  .format  = DRM_FORMAT_XRGB8888,
+                                                  .stride  = ring->stride,
+                                                  .dst_x   = boxes[i].x1,
+                                                  .dst_y   = boxes[i].y1,
+                                                  .src_box = {
+                                                      .x      = boxes[i].x1,
+                                                      .y      = boxes[i].y1,
+                                                      .width  = boxes[i].x2 - boxes[i].x1,
+                                                      .height = boxes[i].y2 - boxes[i].y1,
+                                                  },
+                                              });
+        }
+        wlr_texture_destroy (texture);
+        if (!ok) {
+                /* The slot stays marked as being written, and stale. */
+                wlr_log (WLR_ERROR, "Virtual output %s: cannot read back the frame", output->wlr_output->name);
+                pixman_region32_fini (&damage);
+                return;
+        }
+        pixman_region32_clear (&ring->stale[index]);
+
+        struct timespec now;
+        if (event->when == NULL) {
+                clock_gettime (CLOCK_MONOTONIC, &now);
+        }
+        const struct timespec *when = event->when != NULL ? event->when : &now;
+        slot->present_usec          = (uint64_t) timespec_to_usec (when);
+        ring_set_rects (slot, &damage);
+        pixman_region32_fini (&damage);
+
+        atomic_store_explicit (&slot->seq, seq, memory_order_release);
+        atomic_store_explicit (&ring->header->seq, seq, memory_order_release);
+        ring->seq = seq;
+}
+
+struct comp_output *virtual_output_add (struct comp_server *server, int width, int height, int refresh_mhz) {
+        /* Headless outputs come from a headless backend of our own, added to
+         * the multi backend so it starts and stops with the rest. When nwm
+         * itself runs headless, that backend is used directly. */
+        struct comp_virtual *virt = &server->virtual_output;
+        if (virt->backend == NULL) {
+                if (wlr_backend_is_headless (server->backend)) {
+                        virt->backend = server->backend;
+                } else if (wlr_backend_is_multi (server->backend)) {
+                        virt->backend = wlr_headless_backend_create (server->wl_event_loop);
+                        if (virt->backend == NULL || !wlr_multi_backend_add (server->backend, virt->backend)) {
+                                wlr_log (WLR_ERROR, "Virtual outputs: cannot add a headless backend");
+                                if (virt->backend != NULL) {
+                                        wlr_backend_destroy (virt->backend);
+                                        virt->backend = NULL;
+                                }
+                                return NULL;
+                        }
+                        /* Added late, so it missed the start of the others. */
+                        if (!wlr_backend_start (virt->backend)) {
+                                wlr_log (WLR_ERROR, "Virtual outputs: cannot start the headless backend");
+                                wlr_multi_backend_remove (server->backend, virt->backend);
+                                wlr_backend_destroy (virt->backend);
+                                virt->backend = NULL;
+                                return NULL;
+                        }
+                } else {
+                        wlr_log (WLR_ERROR, "Virtual outputs: the backend cannot take another one");
+                        return NULL;
+                }
+        }
+
+        /* Raises new_output, which sets the output up like any other. */
+        struct wlr_output *wlr_output = wlr_headless_add_output (virt->backend, (unsigned) width, (unsigned) height);
+        if (wlr_output == NULL || wlr_output->data == NULL) {
+                return NULL;
+        }
+        struct comp_output *output = wlr_output->data;
+
+        struct wlr_output_state state;
+        wlr_output_state_init (&state);
+        wlr_output_state_set_custom_mode (&state, width, height, refresh_mhz);
+        const bool committed = wlr_output_commit_state (wlr_output, &state);
+        wlr_output_state_finish (&state);
+        if (!committed) {
+                wlr_log (WLR_ERROR, "Virtual output %s: cannot set %dx%d@%dmHz", wlr_output->name, width, height, refresh_mhz);
+                wlr_output_destroy (wlr_output);
+                return NULL;
+        }
+
+        output->virtual_ring = ring_create (wlr_output->name, width, height);
+        if (output->virtual_ring == NULL) {
+                wlr_output_destroy (wlr_output);
+                return NULL;
+        }
+        wlr_log (WLR_INFO, "Virtual output %s Created, %dx%d@%dmHz", wlr_output->name, width, height, refresh_mhz);
+        return output;
+}
+
+void virtual_output_remove (struct comp_output *output) {
+        /* Goes through output_destroy_notify like an unplugged output. */
+        wlr_output_destroy (output->wlr_output);
+}
+
+void virtual_output_destroy (struct comp_output *output) {
+        if (output->virtual_ring != NULL) {
+                ring_destroy (output->virtual_ring);
+                output->virtual_ring = NULL;
+        }
+}
+
+int virtual_output_ring_fd (struct comp_output *output) {
+        return output->virtual_ring != NULL ? output->virtual_ring->fd : -1;
+}
+
+uint64_t virtual_output_frames (struct comp_output *output) {
+        if (output->virtual_ring == NULL) {
+                return 0;
+        }
+        return output->virtual_ring->seq;
+}
@@ -0,0 +1,68 @@
+#ifndef COMP_VIRTUAL_OUTPUT_H
+#define COMP_VIRTUAL_OUTPUT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct comp_output;
+struct comp_server;
+struct wlr_backend;
+struct wlr_output_event_commit;
+
+/** Virtual outputs: headless outputs added and removed at runtime, for
+ * remote desktop and thin client sessions. Each one streams what it renders
+ * into a frame ring in a sealed memfd, handed to an encoder over the control
+ * socket ("output export NAME"), which maps it read-only and reads frames
+ * in place. Only frames that changed something are written, and of those
+ * only what is stale in the slot being written. */
+struct comp_virtual
+{
+        struct wlr_backend *backend; // headless, created on first use
+};
+
+/* Ring layout, shared with encoders. The header sits at offset 0, followed by
+ * VIRTUAL_RING_SLOTS slots of slot_size bytes from slot_offset on. Frame n
+ * lives in slot (n - 1) % slots. Each slot is a seqlock: the writer zeroes
+ * its seq, fills it in, then stores n into it and into the header. A reader
+ * takes the header seq, checks the slot seq against it before and after
+ * using the pixels, and retries if it changed. */
+#define VIRTUAL_RING_MAGIC   0x726d776e // "nwmr"
+#define VIRTUAL_RING_VERSION 1
+#define VIRTUAL_RING_SLOTS   4
+#define VIRTUAL_RING_RECTS   64
+
+struct virtual_ring_header
+{
+        uint32_t         magic;
+        uint32_t         version;
+        uint32_t         width, height;
+        uint32_t         stride; // bytes per row of pixels
+        uint32_t         format; // DRM fourcc, always XRGB8888
+        uint32_t         slots;
+        uint32_t         slot_size;   // bytes, page aligned
+        uint64_t         slot_offset; // page aligned
+        _Atomic uint64_t seq;         // last complete frame, 0 before the first
+};
+
+struct virtual_ring_rect
+{
+        int32_t x, y, width, height;
+};
+
+struct virtual_ring_slot
+{
+        _Atomic uint64_t         seq;          // frame held, 0 while being written
+        uint64_t                 present_usec; // CLOCK_MONOTONIC
+        uint32_t                 nrects;       // damage since the previous frame
+        uint32_t                 pixel_offset; // from the start of the slot
+        struct virtual_ring_rect rects[VIRTUAL_RING_RECTS]; // more become their bounding box
+};
+
+struct comp_output *virtual_output_add (struct comp_server *server, int width, int height, int refresh_mhz);
+void                virtual_output_remove (struct comp_output *output);
+void                virtual_output_commit (struct comp_output *output, struct wlr_output_event_commit *event);
+void                virtual_output_destroy (struct comp_output *output);
+int                 virtual_output_ring_fd (struct comp_output *output);
+uint64_t            virtual_output_frames (struct comp_output *output);
+
+#endif // COMP_VIRTUAL_OUTPUT_H
@@ -4,11 +4,19 @@
 
 #include "xdg_shell.h"
 
+#include "alloc.h"
+#include "animation.h"
+#include "capture.h"
+#include "focus.h"
 #include "input/cursor.h"
 #include "input/keyboard.h"
+#include "latency.h"
+#include "output.h"
 
 #include <assert.h>
 #include <stdlib.h>
+#include <wlr/render/pass.h>
+#include <wlr/types/wlr_output_layout.h>
 #include <wlr/types/wlr_scene.h>
 #include <wlr/util/edges.h>
 #include <wlr/util/log.h>
@@ -23,9 +31,12 @@ static void xdg_begin_interactive (struct toplevel *toplevel,
         struct comp_server *server          = toplevel->server;
         struct wlr_surface *focused_surface = server->seat->pointer_state.focused_surface;
 
-        wlr_log (WLR_INFO, "XDG BEGIN INTERACTIVE");
+        wlr_log (WLR_DEBUG, "XDG BEGIN INTERACTIVE");
 
-        /* Deny move/resize requests from unfocused clients. */
+        /* Deny move/resize requests from unfocused clients. wlroots does not
+         * check the grab serial, so the pointer may not be over any surface. */
+        if (focused_surface == NULL)
+                return;
         if (toplevel->xdg_toplevel->base->surface != wlr_surface_get_root_surface (focused_surface))
                 return;
 
@@ -100,6 +111,29 @@ static void xdg_toplevel_request_fullscreen (struct wl_listener *listener, void
         }
 }
 
+static void xdg_toplevel_update_foreign_handle (struct toplevel *toplevel) {
+        /* Keeps the ext-foreign-toplevel-list handle, which capture clients
+         * pick windows by, in sync with the title and app id. */
+        if (toplevel->foreign_handle == NULL) {
+                return;
+        }
+        const struct wlr_ext_foreign_toplevel_handle_v1_state state = {
+                .title  = toplevel->xdg_toplevel->title,
+                .app_id = toplevel->xdg_toplevel->app_id,
+        };
+        wlr_ext_foreign_toplevel_handle_v1_update_state (toplevel->foreign_handle, &state);
+}
+
+static void xdg_toplevel_set_title (struct wl_listener *listener, void *data) {
+        struct toplevel *toplevel = wl_container_of (listener, toplevel, set_title);
+        xdg_toplevel_update_foreign_handle (toplevel);
+}
+
+static void xdg_toplevel_set_app_id (struct wl_listener *listener, void *data) {
+        struct toplevel *toplevel = wl_container_of (listener, toplevel, set_app_id);
+        xdg_toplevel_update_foreign_handle (toplevel);
+}
+
 struct toplevel *desktop_toplevel_at (struct comp_server  *server,
                                       double               lx,
                                       double               ly,
@@ -121,12 +155,67 @@ struct toplevel *desktop_toplevel_at (struct comp_server  *server,
 
         *surface = scene_surface->surface;
         /* Find the node corresponding to the tinywl_toplevel at the root of this
-         * surface tree, it is the only one for which we set the data field. */
+         * surface tree, it is the only one for which we set the data field.
+         * Layer surfaces have none, so for them we walk up to the scene root
+         * and return just the surface. */
         struct wlr_scene_tree *tree = node->parent;
         while (tree != NULL && tree->node.data == NULL) {
                 tree = tree->node.parent;
         }
-        return tree->node.data;
+        return tree != NULL ? tree->node.data : NULL;
+}
+
+struct toplevel_render
+{
+        struct wlr_render_pass *pass;
+        double                  scale;
+        int                     x, y; // window geometry origin, surface coords
+};
+
+static int render_round (double value) {
+        return (int) (value < 0 ? value - 0.5 : value + 0.5);
+}
+
+static void toplevel_render_surface (struct wlr_surface *surface, int sx, int sy, void *data) {
+        struct toplevel_render *render  = data;
+        struct wlr_texture     *texture = wlr_surface_get_texture (surface);
+        if (texture == NULL) {
+                return;
+        }
+
+        struct wlr_fbox src;
+        wlr_surface_get_buffer_source_box (surface, &src);
+        const struct wlr_box dst = {
+                .x      = render_round ((sx - render->x) * render->scale),
+                .y      = render_round ((sy - render->y) * render->scale),
+                .width  = render_round (surface->current.width * render->scale),
+                .height = render_round (surface->current.height * render->scale),
+        };
+        wlr_render_pass_add_texture (render->pass,
+                                     &(struct wlr_render_texture_options) {
+                                         .texture     = texture,
+                                         .src_box     = src,
+                                         .dst_box     = dst,
+                                         .transform   = wlr_output_transform_invert (surface->current.transform),
+                                         .filter_mode = WLR_SCALE_FILTER_BILINEAR,
+                                     });
+}
+
+void xdg_toplevel_render (struct toplevel *toplevel, struct wlr_render_pass *pass, double scale) {
+        /* Draws the toplevel and its subsurfaces, without popups, with the
+         * window geometry origin at 0,0. Used off screen, for thumbnails and
+         * captures, so it does not go through the scene. */
+        struct wlr_xdg_surface *xdg_surface = toplevel->xdg_toplevel->base;
+        struct wlr_box          geometry;
+        wlr_xdg_surface_get_geometry (xdg_surface, &geometry);
+
+        struct toplevel_render render = {
+                .pass  = pass,
+                .scale = scale,
+                .x     = geometry.x,
+                .y     = geometry.y,
+        };
+        wlr_surface_for_each_surface (xdg_surface->surface, toplevel_render_surface, &render);
 }
 
 // Toplevel
@@ -136,13 +225,16 @@ void new_xdg_toplevel_notify (struct wl_listener *listener, void *data) {
         struct wlr_xdg_toplevel *xdg_toplevel = data;
 
         /* Allocate a tinywl_toplevel for this surface */
-        struct toplevel *toplevel = calloc (1, sizeof (*toplevel));
+        struct toplevel *toplevel = nwm_alloc (ALLOC_XDG_SHELL, struct toplevel);
         toplevel->server          = server;
         toplevel->xdg_toplevel    = xdg_toplevel;
         toplevel->scene_tree
-            = wlr_scene_xdg_surface_create (&toplevel->server->scene->tree, xdg_toplevel->base);
+            = wlr_scene_xdg_surface_create (server->layers[SCENE_LAYER_NORMAL], xdg_toplevel->base);
         toplevel->scene_tree->node.data = toplevel;
         xdg_toplevel->base->data        = toplevel->scene_tree;
+        if (!focus_toplevel_create (toplevel)) {
+                wlr_log (WLR_ERROR, "Cannot assign a toplevel ID, it will not be addressable");
+        }
 
         /* Listen to the various events it can emit */
         toplevel->map.notify     = xdg_toplevel_map_notify;
@@ -160,20 +252,38 @@ void new_xdg_toplevel_notify (struct wl_listener *listener, void *data) {
         toplevel->request_resize.notify     = xdg_toplevel_request_resize;
         toplevel->request_maximize.notify   = xdg_toplevel_request_maximize;
         toplevel->request_fullscreen.notify = xdg_toplevel_request_fullscreen;
+        toplevel->set_title.notify          = xdg_toplevel_set_title;
+        toplevel->set_app_id.notify         = xdg_toplevel_set_app_id;
 
         wl_signal_add (&xdg_toplevel->events.request_resize, &toplevel->request_resize);
         wl_signal_add (&xdg_toplevel->events.request_move, &toplevel->request_move);
         wl_signal_add (&xdg_toplevel->events.request_maximize, &toplevel->request_maximize);
         wl_signal_add (&xdg_toplevel->events.request_fullscreen, &toplevel->request_fullscreen);
+        wl_signal_add (&xdg_toplevel->events.set_title, &toplevel->set_title);
+        wl_signal_add (&xdg_toplevel->events.set_app_id, &toplevel->set_app_id);
 }
 
 void xdg_toplevel_map_notify (struct wl_listener *listener, void *data) {
         /* Called when the surface is mapped, or ready to display on-screen. */
         struct toplevel *toplevel = wl_container_of (listener, toplevel, map);
 
-        wl_list_insert (&toplevel->server->toplevels, &toplevel->link);
+        focus_toplevel_map (toplevel);
 
         keyboard_focus_toplevel (toplevel, toplevel->xdg_toplevel->base->surface);
+        overview_toplevel_map (toplevel);
+
+        /* New windows fade and grow into place. */
+        struct wlr_scene_node *node = &toplevel->scene_tree->node;
+        animation_opacity (toplevel->server, node, 0.0f, 1.0f, ANIMATION_MAP_MS);
+        animation_scale (toplevel->server, node, 0.9f, 1.0f, ANIMATION_MAP_MS);
+
+        const struct wlr_ext_foreign_toplevel_handle_v1_state state = {
+                .title  = toplevel->xdg_toplevel->title,
+                .app_id = toplevel->xdg_toplevel->app_id,
+        };
+        toplevel->foreign_handle
+            = wlr_ext_foreign_toplevel_handle_v1_create (toplevel->server->foreign_toplevel_list, &state);
+        toplevel->foreign_handle->data = toplevel;
 }
 
 void xdg_toplevel_unmap_notify (struct wl_listener *listener, void *data) {
@@ -185,7 +295,11 @@ void xdg_toplevel_unmap_notify (struct wl_listener *listener, void *data) {
                 reset_cursor_mode (toplevel->server);
         }
 
-        wl_list_remove (&toplevel->link);
+        focus_toplevel_unmap (toplevel);
+        overview_toplevel_unmap (toplevel);
+        capture_toplevel_unmap (toplevel);
+        wlr_ext_foreign_toplevel_handle_v1_destroy (toplevel->foreign_handle);
+        toplevel->foreign_handle = NULL;
 }
 
 void xdg_toplevel_commit_notify (struct wl_listener *listener, void *data) {
@@ -198,7 +312,23 @@ void xdg_toplevel_commit_notify (struct wl_listener *listener, void *data) {
                  * configures the xdg_toplevel with 0,0 size to let the client pick the
                  * dimensions itself. */
                 wlr_xdg_toplevel_set_size (toplevel->xdg_toplevel, 0, 0);
+
+                /* Start new windows in the corner of the output under the
+                 * cursor that panels leave free. */
+                struct comp_server *server     = toplevel->server;
+                struct wlr_output  *wlr_output = wlr_output_layout_output_at (
+                    server->output_layout, server->cursor->x, server->cursor->y);
+                if (wlr_output != NULL) {
+                        const struct comp_output *output = wlr_output->data;
+                        wlr_scene_node_set_position (&toplevel->scene_tree->node,
+                                                     output->usable_area.x,
+                                                     output->usable_area.y);
+                }
         }
+
+        latency_surface_commit (toplevel->server, toplevel->xdg_toplevel->base->surface);
+        overview_toplevel_commit (toplevel);
+        capture_toplevel_commit (toplevel);
 }
 
 void xdg_toplevel_destroy_notify (struct wl_listener *listener, void *data) {
@@ -215,16 +345,21 @@ void xdg_toplevel_destroy_notify (struct wl_listener *listener, void *data) {
         wl_list_remove (&toplevel->request_resize.link);
         wl_list_remove (&toplevel->request_maximize.link);
         wl_list_remove (&toplevel->request_fullscreen.link);
+        wl_list_remove (&toplevel->set_title.link);
+        wl_list_remove (&toplevel->set_app_id.link);
 
-        free (toplevel);
+        focus_toplevel_destroy (toplevel);
+        nwm_free (toplevel);
 }
 
 /// Popups
 void new_xdg_popup_notify (struct wl_listener *listener, void *data) {
         /* This event is raised when a client creates a new popup. */
+        struct comp_server   *server    = wl_container_of (listener, server, new_xdg_popup);
         struct wlr_xdg_popup *xdg_popup = data;
 
-        struct popup *popup = calloc (1, sizeof (*popup));
+        struct popup *popup = nwm_alloc (ALLOC_XDG_SHELL, struct popup);
+        popup->server       = server;
         popup->xdg_popup    = xdg_popup;
 
         /* We must add xdg popups to the scene graph so they get rendered. The
@@ -232,10 +367,15 @@ void new_xdg_popup_notify (struct wl_listener *listener, void *data) {
          * provide the proper parent scene node of the xdg popup. To enable this,
          * we always set the user data field of xdg_surfaces to the corresponding
          * scene node. */
-        struct wlr_xdg_surface *parent = wlr_xdg_surface_try_from_wlr_surface (xdg_popup->parent);
-        assert (parent != NULL);
-        struct wlr_scene_tree *parent_tree = parent->data;
-        xdg_popup->base->data = wlr_scene_xdg_surface_create (parent_tree, xdg_popup->base);
+        if (xdg_popup->parent != NULL) {
+                struct wlr_xdg_surface *parent
+                    = wlr_xdg_surface_try_from_wlr_surface (xdg_popup->parent);
+                assert (parent != NULL);
+                struct wlr_scene_tree *parent_tree = parent->data;
+                xdg_popup->base->data = wlr_scene_xdg_surface_create (parent_tree, xdg_popup->base);
+        }
+        /* Otherwise it belongs to a layer surface, which names it as its popup
+         * later on; layer_surface_new_popup adds it to the scene then. */
 
         popup->commit.notify = xdg_popup_commit_notify;
         wl_signal_add (&xdg_popup->base->surface->events.commit, &popup->commit);
@@ -256,6 +396,8 @@ void xdg_popup_commit_notify (struct wl_listener *listener, void *data) {
                  * off-screen, for example. */
                 wlr_xdg_surface_schedule_configure (popup->xdg_popup->base);
         }
+
+        latency_surface_commit (popup->server, popup->xdg_popup->base->surface);
 }
 
 void xdg_popup_destroy_notify (struct wl_listener *listener, void *data) {
@@ -265,5 +407,5 @@ void xdg_popup_destroy_notify (struct wl_listener *listener, void *data) {
         wl_list_remove (&popup->commit.link);
         wl_list_remove (&popup->destroy.link);
 
-        free (popup);
+        nwm_free (popup);
 }
\ No newline at end of file
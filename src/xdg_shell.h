@@ -6,6 +6,9 @@
 #define COMP_XDG_SHELL_H
 
 #include "nwm_server.h"
+#include "overview.h"
+
+#include <wlr/types/wlr_ext_foreign_toplevel_list_v1.h>
 #include <wlr/types/wlr_xdg_shell.h>
 
 struct toplevel
@@ -14,6 +17,11 @@ struct toplevel
         struct comp_server      *server;
         struct wlr_xdg_toplevel *xdg_toplevel;
         struct wlr_scene_tree   *scene_tree;
+        struct thumbnail         thumbnail;
+        uint64_t                 id; // stable while the toplevel exists, see comp_focus
+
+        struct wlr_ext_foreign_toplevel_handle_v1 *foreign_handle; // while mapped
+
         struct wl_listener       map;
         struct wl_listener       unmap;
         struct wl_listener       commit;
@@ -22,10 +30,13 @@ struct toplevel
         struct wl_listener       request_resize;
         struct wl_listener       request_maximize;
         struct wl_listener       request_fullscreen;
+        struct wl_listener       set_title;
+        struct wl_listener       set_app_id;
 };
 
 struct popup
 {
+        struct comp_server   *server;
         struct wlr_xdg_popup *xdg_popup;
         struct wl_listener    commit;
         struct wl_listener    destroy;
@@ -38,6 +49,9 @@ struct toplevel *desktop_toplevel_at (struct comp_server  *server,
                                       double              *sx,
                                       double              *sy);
 
+struct wlr_render_pass;
+void xdg_toplevel_render (struct toplevel *toplevel, struct wlr_render_pass *pass, double scale);
+
 void new_xdg_toplevel_notify (struct wl_listener *listener, void *data);
 void xdg_toplevel_map_notify (struct wl_listener *listener, void *data);
 void xdg_toplevel_unmap_notify (struct wl_listener *listener, void *data);
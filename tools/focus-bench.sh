@@ -0,0 +1,89 @@
+#!/bin/sh
+#
+# focus-bench.sh: focus changes at scale. For each window count, starts a
+# headless nwm, maps that many small idle nwm-loadgen windows, runs
+# `nwm-msg focus bench` and prints what a focus change costs. With constant
+# time focus changes the numbers stay flat as the count grows.
+#
+#     tools/focus-bench.sh [BUILD_DIR] [COUNT...]
+#
+# BUILD_DIR defaults to build, the counts to 100 1000 5000. CHANGES sets the
+# focus changes per run (default 20000, the most nwm does in one bench).
+#
+set -eu
+
+build=${1:-build}
+[ $# -gt 0 ] && shift
+counts=${*:-100 1000 5000}
+changes=${CHANGES:-20000}
+
+for tool in nwm nwm-loadgen nwm-msg; do
+        if [ ! -x "$build/$tool" ]; then
+                echo "$build/$tool not found, build first or pass the build directory" >&2
+                exit 2
+        fi
+done
+: "${XDG_RUNTIME_DIR:?XDG_RUNTIME_DIR must be set, nwm puts its sockets there}"
+
+nwm_pid=
+loadgen_pid=
+cleanup () {
+        [ -n "$loadgen_pid" ] && kill "$loadgen_pid" 2>/dev/null
+        [ -n "$nwm_pid" ] && kill "$nwm_pid" 2>/dev/null
+        wait 2>/dev/null
+        nwm_pid=
+        loadgen_pid=
+}
+
+# Retries a command every 100ms for up to $1 seconds.
+retry () {
+        tries=$(($1 * 10))
+        shift
+        while ! "$@" >/dev/null 2>&1; do
+                tries=$((tries - 1))
+                [ "$tries" -gt 0 ] || return 1
+                sleep 0.1
+        done
+}
+
+mapped () {
+        "$build/nwm-msg" focus | grep -q ", $1 toplevels"
+}
+
+log=$(mktemp)
+trap 'cleanup; rm -f "$log"' EXIT
+trap 'exit 1' INT TERM
+
+# Sets NWM_SOCK to the control socket nwm logged it listens on.
+find_sock () {
+        NWM_SOCK=$(sed -n 's/.*IPC listening on //p' "$log")
+        [ -S "$NWM_SOCK" ]
+}
+
+echo "toplevels changes result"
+for count in $counts; do
+        # nwm names its control socket after the Wayland display it picked.
+        WLR_BACKENDS=headless WLR_RENDERER=pixman WLR_HEADLESS_OUTPUTS=1 WLR_LIBINPUT_NO_DEVICES=1 \
+                "$build/nwm" -v silent -v core=info >/dev/null 2>"$log" &
+        nwm_pid=$!
+
+        NWM_SOCK=
+        if ! retry 10 find_sock; then
+                echo "nwm did not start" >&2
+                exit 1
+        fi
+        export NWM_SOCK
+        display=${NWM_SOCK##*/nwm-}
+        export WAYLAND_DISPLAY=${display%.sock}
+
+        "$build/nwm-loadgen" -n "$count" -s 16x16 -r 1 >/dev/null 2>&1 &
+        loadgen_pid=$!
+        if ! retry 120 mapped "$count"; then
+                echo "$count windows did not map" >&2
+                exit 1
+        fi
+
+        result=$("$build/nwm-msg" focus bench "$changes" | head -n 1)
+        echo "$count $changes ${result#*changes: }"
+        cleanup
+done
@@ -0,0 +1,786 @@
+//
+// nwm-loadgen: a deliberately badly behaved Wayland client used to stress the
+// compositor. It opens any number of xdg toplevels, commits shm buffers at a
+// fixed rate (or as fast as frame callbacks allow), churns popups and spams
+// interactive move/resize requests, then reports the frame callback intervals
+// it observed.
+//
+// Focus changes at scale: on a headless nwm (WLR_BACKENDS=headless), open
+// thousands of small, idle windows with `nwm-loadgen -n 5000 -s 16x16 -r 1`
+// and run `nwm-msg focus bench 20000` for the cost of each focus change;
+// tools/focus-bench.sh does all of that for a range of window counts.
+//
+// Low-latency mode under load: `nwm-loadgen -c $(nproc) -d 60` keeps every
+// CPU busy while a window commits on every frame callback. Run it against
+// nwm with and without --low-latency and compare the tail (p99, max) of the
+// total frame callback interval; nwm --latency and --perf-overlay show the
+// compositor's side of the same run. tools/rt-bench.sh runs both modes on a
+// headless nwm, with the hogs in a separate client, and prints the results.
+//
+#define _GNU_SOURCE
+#include "../src/histogram.h"
+#include "xdg-shell-client-protocol.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#define MAX_BUFFERS 2
+
+struct loadgen_options
+{
+        int    toplevels;
+        int    width, height;
+        double commit_rate; // commits per second per window, 0 = frame callback driven
+        double popup_rate;  // popups per second across all windows
+        double move_rate;   // move/resize requests per second across all windows
+        int    duration;    // seconds, 0 = until killed
+        bool   fill;        // repaint the whole buffer on every commit
+        int    cpu_hogs;    // threads spinning on a CPU each, to load the machine
+};
+
+struct buffer
+{
+        struct window    *window; // owner, NULL for a popup's buffer
+        struct wl_buffer *wl_buffer;
+        uint32_t         *data;
+        size_t            size;
+        bool              busy;
+};
+
+struct window
+{
+        struct loadgen      *loadgen;
+        struct wl_surface   *surface;
+        struct xdg_surface  *xdg_surface;
+        struct xdg_toplevel *xdg_toplevel;
+        struct wl_callback  *frame_callback;
+        struct buffer        buffers[MAX_BUFFERS];
+        int                  width, height;
+        bool                 configured;
+        uint32_t             color;
+        struct timespec      last_frame_done;
+        bool                 have_last_frame_done;
+        bool                 frame_owed; // a frame callback found every buffer busy
+};
+
+struct popup
+{
+        struct wl_surface  *surface;
+        struct xdg_surface *xdg_surface;
+        struct xdg_popup   *xdg_popup;
+        struct buffer       buffer;
+};
+
+struct loadgen
+{
+        struct loadgen_options options;
+
+        struct wl_display    *display;
+        struct wl_registry   *registry;
+        struct wl_compositor *compositor;
+        struct wl_shm        *shm;
+        struct xdg_wm_base   *wm_base;
+        struct wl_seat       *seat;
+        struct wl_pointer    *pointer;
+        uint32_t              last_serial;
+
+        struct window *windows;
+        struct popup  *popup; // at most one in flight, replaced on every churn tick
+        int            next_popup_window;
+        int            next_move_window;
+
+        struct histogram window_intervals; // microseconds, since the last report
+        struct histogram total_intervals;  // whole run
+        uint64_t         commits;
+        uint64_t         popups;
+        uint64_t         moves;
+        bool             running;
+};
+
+static double timespec_diff_ms (const struct timespec *a, const struct timespec *b) {
+        return (a->tv_sec - b->tv_sec) * 1000.0 + (a->tv_nsec - b->tv_nsec) / 1e6;
+}
+
+static void interval_report (const struct histogram *intervals, const char *label) {
+        if (intervals->count == 0) {
+                printf ("%s: no frame callbacks\n", label);
+                return;
+        }
+        char line[256];
+        histogram_format (intervals, label, line, sizeof (line));
+        printf ("%s\n", line);
+}
+
+static void window_commit (struct window *window);
+
+// Buffers
+static void buffer_release (void *data, struct wl_buffer *wl_buffer) {
+        /* Nothing else would ever ask a window that skipped a frame for the
+         * next one, so that frame is drawn as soon as a buffer is back. */
+        struct buffer *buffer = data;
+        buffer->busy          = false;
+        if (buffer->window != NULL && buffer->window->frame_owed) {
+                window_commit (buffer->window);
+        }
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+        .release = buffer_release,
+};
+
+static bool buffer_init (struct loadgen *loadgen, struct buffer *buffer, int width, int height) {
+        const int    stride = width * 4;
+        const size_t size   = (size_t) stride * height;
+
+        int fd = memfd_create ("nwm-loadgen", MFD_CLOEXEC);
+        if (fd < 0 || ftruncate (fd, size) < 0) {
+                perror ("nwm-loadgen: shm");
+                if (fd >= 0) {
+                        close (fd);
+                }
+                return false;
+        }
+        buffer->data = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (buffer->data == MAP_FAILED) {
+                perror ("nwm-loadgen: mmap");
+                close (fd);
+                return false;
+        }
+
+        struct wl_shm_pool *pool = wl_shm_create_pool (loadgen->shm, fd, size);
+        buffer->wl_buffer
+            = wl_shm_pool_create_buffer (pool, 0, width, height, stride, WL_SHM_FORMAT_XRGB8888);
+        wl_shm_pool_destroy (pool);
+        close (fd);
+
+        buffer->size = size;
+        buffer->busy = false;
+        wl_buffer_add_listener (buffer->wl_buffer, &buffer_listener, buffer);
+        return true;
+}
+
+static void buffer_finish (struct buffer *buffer) {
+        if (buffer->wl_buffer == NULL) {
+                return;
+        }
+        wl_buffer_destroy (buffer->wl_buffer);
+        munmap (buffer->data, buffer->size);
+        memset (buffer, 0, sizeof (*buffer));
+}
+
+static void buffer_fill (struct buffer *buffer, uint32_t color) {
+        const size_t pixels = buffer->size / 4;
+        for (size_t i = 0; i < pixels; i++) {
+                buffer->data[i] = color;
+        }
+}
+
+// Windows
+static void frame_done (void *data, struct wl_callback *callback, uint32_t time) {
+        struct window  *window  = data;
+        struct loadgen *loadgen = window->loadgen;
+
+        wl_callback_destroy (callback);
+        window->frame_callback = NULL;
+
+        struct timespec now;
+        clock_gettime (CLOCK_MONOTONIC, &now);
+        if (window->have_last_frame_done) {
+                const double interval = timespec_diff_ms (&now, &window->last_frame_done);
+                histogram_add (&loadgen->window_intervals, (uint64_t) (interval * 1000.0));
+                histogram_add (&loadgen->total_intervals, (uint64_t) (interval * 1000.0));
+        }
+        window->last_frame_done      = now;
+        window->have_last_frame_done = true;
+
+        /* Without a fixed rate we behave like a well-paced client and redraw
+         * on every frame callback. */
+        if (loadgen->options.commit_rate <= 0) {
+                window_commit (window);
+        }
+}
+
+static const struct wl_callback_listener frame_listener = {
+        .done = frame_done,
+};
+
+static void window_commit (struct window *window) {
+        struct loadgen *loadgen = window->loadgen;
+        if (!window->configured) {
+                return;
+        }
+
+        struct buffer *buffer = NULL;
+        for (int i = 0; i < MAX_BUFFERS; i++) {
+                if (!window->buffers[i].busy) {
+                        buffer = &window->buffers[i];
+                        break;
+                }
+        }
+        if (buffer == NULL) {
+                /* The compositor holds both buffers; a real client would skip
+                 * the frame too. Driven by frame callbacks, it is owed: no
+                 * callback is pending to trigger the next one. */
+                window->frame_owed = loadgen->options.commit_rate <= 0;
+                return;
+        }
+        if (buffer->wl_buffer == NULL) {
+                if (!buffer_init (loadgen, buffer, window->width, window->height)) {
+                        return;
+                }
+                buffer->window = window;
+        }
+        window->frame_owed = false;
+
+        window->color += 0x010203;
+        if (loadgen->options.fill) {
+                buffer_fill (buffer, window->color | 0xff000000);
+        }
+
+        if (window->frame_callback == NULL) {
+                window->frame_callback = wl_surface_frame (window->surface);
+                wl_callback_add_listener (window->frame_callback, &frame_listener, window);
+        }
+        wl_surface_attach (window->surface, buffer->wl_buffer, 0, 0);
+        wl_surface_damage_buffer (window->surface, 0, 0, INT32_MAX, INT32_MAX);
+        wl_surface_commit (window->surface);
+        buffer->busy = true;
+        loadgen->commits++;
+}
+
+static void xdg_surface_configure (void *data, struct xdg_surface *xdg_surface, uint32_t serial) {
+        struct window *window = data;
+        xdg_surface_ack_configure (xdg_surface, serial);
+        const bool first   = !window->configured;
+        window->configured = true;
+        /* A resize drops the buffers, so a frame owed to their release
+         * is drawn now instead. */
+        if (first || window->frame_owed) {
+                window_commit (window);
+        }
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+        .configure = xdg_surface_configure,
+};
+
+static void xdg_toplevel_configure (void                *data,
+                                    struct xdg_toplevel *xdg_toplevel,
+                                    int32_t              width,
+                                    int32_t              height,
+                                    struct wl_array     *states) {
+        /* Resizes from the compositor reallocate the buffers at the new size. */
+        struct window *window = data;
+        if (width <= 0 || height <= 0 || (width == window->width && height == window->height)) {
+                return;
+        }
+        window->width  = width;
+        window->height = height;
+        for (int i = 0; i < MAX_BUFFERS; i++) {
+                buffer_finish (&window->buffers[i]);
+        }
+}
+
+static void xdg_toplevel_close (void *data, struct xdg_toplevel *xdg_toplevel) {
+        struct window *window    = data;
+        window->loadgen->running = false;
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+        .configure = xdg_toplevel_configure,
+        .close     = xdg_toplevel_close,
+};
+
+static void window_init (struct loadgen *loadgen, struct window *window, int index) {
+        window->loadgen = loadgen;
+        window->width   = loadgen->options.width;
+        window->height  = loadgen->options.height;
+        window->color   = (uint32_t) index * 0x00254a6f;
+
+        window->surface     = wl_compositor_create_surface (loadgen->compositor);
+        window->xdg_surface = xdg_wm_base_get_xdg_surface (loadgen->wm_base, window->surface);
+        xdg_surface_add_listener (window->xdg_surface, &xdg_surface_listener, window);
+        window->xdg_toplevel = xdg_surface_get_toplevel (window->xdg_surface);
+        xdg_toplevel_add_listener (window->xdg_toplevel, &xdg_toplevel_listener, window);
+
+        char title[32];
+        snprintf (title, sizeof (title), "nwm-loadgen %d", index);
+        xdg_toplevel_set_title (window->xdg_toplevel, title);
+        xdg_toplevel_set_app_id (window->xdg_toplevel, "nwm-loadgen");
+        wl_surface_commit (window->surface);
+}
+
+static void window_finish (struct window *window) {
+        if (window->frame_callback != NULL) {
+                wl_callback_destroy (window->frame_callback);
+        }
+        for (int i = 0; i < MAX_BUFFERS; i++) {
+                buffer_finish (&window->buffers[i]);
+        }
+        xdg_toplevel_destroy (window->xdg_toplevel);
+        xdg_surface_destroy (window->xdg_surface);
+        wl_surface_destroy (window->surface);
+}
+
+// Popups
+static void popup_destroy (struct popup *popup) {
+        xdg_popup_destroy (popup->xdg_popup);
+        xdg_surface_destroy (popup->xdg_surface);
+        wl_surface_destroy (popup->surface);
+        buffer_finish (&popup->buffer);
+        free (popup);
+}
+
+static void popup_xdg_surface_configure (void               *data,
+                                         struct xdg_surface *xdg_surface,
+                                         uint32_t            serial) {
+        struct popup *popup = data;
+        xdg_surface_ack_configure (xdg_surface, serial);
+        if (popup->buffer.busy) {
+                return;
+        }
+        buffer_fill (&popup->buffer, 0xff3060c0);
+        wl_surface_attach (popup->surface, popup->buffer.wl_buffer, 0, 0);
+        wl_surface_damage_buffer (popup->surface, 0, 0, INT32_MAX, INT32_MAX);
+        wl_surface_commit (popup->surface);
+        popup->buffer.busy = true;
+}
+
+static const struct xdg_surface_listener popup_xdg_surface_listener = {
+        .configure = popup_xdg_surface_configure,
+};
+
+static void popup_configure (void             *data,
+                             struct xdg_popup *xdg_popup,
+                             int32_t           x,
+                             int32_t           y,
+                             int32_t           width,
+                             int32_t           height) {}
+
+static void popup_done (void *data, struct xdg_popup *xdg_popup) {}
+
+static const struct xdg_popup_listener popup_listener = {
+        .configure  = popup_configure,
+        .popup_done = popup_done,
+};
+
+static void popup_churn (struct loadgen *loadgen) {
+        /* Tear down the previous popup and open a new one on the next window,
+         * so every tick exercises both the destroy and the creation path. */
+        if (loadgen->popup != NULL) {
+                popup_destroy (loadgen->popup);
+                loadgen->popup = NULL;
+        }
+
+        struct window *parent = &loadgen->windows[loadgen->next_popup_window];
+        loadgen->next_popup_window = (loadgen->next_popup_window + 1) % loadgen->options.toplevels;
+        if (!parent->configured) {
+                return;
+        }
+
+        struct popup *popup = calloc (1, sizeof (*popup));
+        if (!buffer_init (loadgen, &popup->buffer, 64, 64)) {
+                free (popup);
+                return;
+        }
+        struct xdg_positioner *positioner = xdg_wm_base_create_positioner (loadgen->wm_base);
+        xdg_positioner_set_size (positioner, 64, 64);
+        xdg_positioner_set_anchor_rect (positioner, 0, 0, 1, 1);
+        xdg_positioner_set_offset (positioner, (int) (loadgen->popups % 16) * 8, 0);
+
+        popup->surface     = wl_compositor_create_surface (loadgen->compositor);
+        popup->xdg_surface = xdg_wm_base_get_xdg_surface (loadgen->wm_base, popup->surface);
+        xdg_surface_add_listener (popup->xdg_surface, &popup_xdg_surface_listener, popup);
+        popup->xdg_popup = xdg_surface_get_popup (popup->xdg_surface, parent->xdg_surface, positioner);
+        xdg_popup_add_listener (popup->xdg_popup, &popup_listener, popup);
+        xdg_positioner_destroy (positioner);
+        wl_surface_commit (popup->surface);
+
+        loadgen->popup = popup;
+        loadgen->popups++;
+}
+
+// Move/resize spam
+static void move_spam (struct loadgen *loadgen) {
+        /* Alternate between move and resize requests. nwm only honours them
+         * for the window under the pointer, but each one still travels the
+         * whole request path. */
+        if (loadgen->seat == NULL) {
+                return;
+        }
+        struct window *window     = &loadgen->windows[loadgen->next_move_window];
+        loadgen->next_move_window = (loadgen->next_move_window + 1) % loadgen->options.toplevels;
+        if (!window->configured) {
+                return;
+        }
+        if (loadgen->moves % 2 == 0) {
+                xdg_toplevel_move (window->xdg_toplevel, loadgen->seat, loadgen->last_serial);
+        } else {
+                xdg_toplevel_resize (window->xdg_toplevel,
+                                     loadgen->seat,
+                                     loadgen->last_serial,
+                                     XDG_TOPLEVEL_RESIZE_EDGE_BOTTOM_RIGHT);
+        }
+        loadgen->moves++;
+}
+
+// Globals
+static void wm_base_ping (void *data, struct xdg_wm_base *wm_base, uint32_t serial) {
+        xdg_wm_base_pong (wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+        .ping = wm_base_ping,
+};
+
+static void pointer_enter (void              *data,
+                           struct wl_pointer *pointer,
+                           uint32_t           serial,
+                           struct wl_surface *surface,
+                           wl_fixed_t         sx,
+                           wl_fixed_t         sy) {
+        struct loadgen *loadgen = data;
+        loadgen->last_serial    = serial;
+}
+
+static void pointer_leave (void              *data,
+                           struct wl_pointer *pointer,
+                           uint32_t           serial,
+                           struct wl_surface *surface) {}
+
+static void pointer_motion (void              *data,
+                            struct wl_pointer *pointer,
+                            uint32_t           time,
+                            wl_fixed_t         sx,
+                            wl_fixed_t         sy) {}
+
+static void pointer_button (void              *data,
+                            struct wl_pointer *pointer,
+                            uint32_t           serial,
+                            uint32_t           time,
+                            uint32_t           button,
+                            uint32_t           state) {
+        struct loadgen *loadgen = data;
+        loadgen->last_serial    = serial;
+}
+
+static void pointer_axis (void              *data,
+                          struct wl_pointer *pointer,
+                          uint32_t           time,
+                          uint32_t           axis,
+                          wl_fixed_t         value) {}
+
+static const struct wl_pointer_listener pointer_listener = {
+        .enter  = pointer_enter,
+        .leave  = pointer_leave,
+        .motion = pointer_motion,
+        .button = pointer_button,
+        .axis   = pointer_axis,
+};
+
+static void seat_capabilities (void *data, struct wl_seat *seat, uint32_t caps) {
+        struct loadgen *loadgen = data;
+        if ((caps & WL_SEAT_CAPABILITY_POINTER) && loadgen->pointer == NULL) {
+                loadgen->pointer = wl_seat_get_pointer (seat);
+                wl_pointer_add_listener (loadgen->pointer, &pointer_listener, loadgen);
+        }
+}
+
+static void seat_name (void *data, struct wl_seat *seat, const char *name) {}
+
+static const struct wl_seat_listener seat_listener = {
+        .capabilities = seat_capabilities,
+        .name         = seat_name,
+};
+
+static void registry_global (void               *data,
+                             struct wl_registry *registry,
+                             uint32_t            name,
+                             const char         *interface,
+                             uint32_t            version) {
+        struct loadgen *loadgen = data;
+        if (strcmp (interface, wl_compositor_interface.name) == 0) {
+                loadgen->compositor = wl_registry_bind (registry, name, &wl_compositor_interface, 4);
+        } else if (strcmp (interface, wl_shm_interface.name) == 0) {
+                loadgen->shm = wl_registry_bind (registry, name, &wl_shm_interface, 1);
+        } else if (strcmp (interface, xdg_wm_base_interface.name) == 0) {
+                loadgen->wm_base = wl_registry_bind (registry, name, &xdg_wm_base_interface, 1);
+                xdg_wm_base_add_listener (loadgen->wm_base, &wm_base_listener, loadgen);
+        } else if (strcmp (interface, wl_seat_interface.name) == 0 && loadgen->seat == NULL) {
+                loadgen->seat = wl_registry_bind (registry, name, &wl_seat_interface, 1);
+                wl_seat_add_listener (loadgen->seat, &seat_listener, loadgen);
+        }
+}
+
+static void registry_global_remove (void *data, struct wl_registry *registry, uint32_t name) {}
+
+static const struct wl_registry_listener registry_listener = {
+        .global        = registry_global,
+        .global_remove = registry_global_remove,
+};
+
+// Main loop
+static int timer_create_rate (double rate) {
+        /* A periodic timerfd ticking `rate` times per second, or -1 if the
+         * feature is disabled. */
+        if (rate <= 0) {
+                return -1;
+        }
+        int fd = timerfd_create (CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+        if (fd < 0) {
+                perror ("nwm-loadgen: timerfd");
+                return -1;
+        }
+        const long              period_ns = (long) (1e9 / rate);
+        const struct timespec   period    = { period_ns / 1000000000, period_ns % 1000000000 };
+        const struct itimerspec spec      = { .it_interval = period, .it_value = period };
+        timerfd_settime (fd, 0, &spec, NULL);
+        return fd;
+}
+
+static uint64_t timer_drain (int fd) {
+        uint64_t expirations = 0;
+        if (read (fd, &expirations, sizeof (expirations)) != sizeof (expirations)) {
+                return 0;
+        }
+        return expirations;
+}
+
+static void report (struct loadgen *loadgen, double elapsed) {
+        printf ("%.0fs: %lu commits, %lu popups, %lu move/resize requests\n",
+                elapsed,
+                (unsigned long) loadgen->commits,
+                (unsigned long) loadgen->popups,
+                (unsigned long) loadgen->moves);
+        interval_report (&loadgen->window_intervals, "  frame callback interval");
+        histogram_reset (&loadgen->window_intervals);
+        fflush (stdout);
+}
+
+static atomic_bool hogs_running = true;
+
+static void *cpu_hog (void *data) {
+        /* Pure computation, never sleeps: competes with nwm for CPU time
+         * the way a parallel build does. */
+        volatile uint64_t x = (uintptr_t) data;
+        while (atomic_load_explicit (&hogs_running, memory_order_relaxed)) {
+                x = x * 6364136223846793005ull + 1442695040888963407ull;
+        }
+        return NULL;
+}
+
+static const char usage[] = "Usage: %s [options]\n"
+                            "  -n, --toplevels N    number of toplevels to open (default 1)\n"
+                            "  -s, --size WxH       buffer size (default 640x480)\n"
+                            "  -r, --rate HZ        commits per second per toplevel; 0 commits on\n"
+                            "                       every frame callback (default 0)\n"
+                            "  -p, --popups HZ      popups opened and destroyed per second\n"
+                            "  -m, --moves HZ       move/resize requests per second\n"
+                            "  -d, --duration SEC   exit after SEC seconds\n"
+                            "  -N, --no-fill        commit without repainting buffer contents\n"
+                            "  -c, --cpu-hog N      also spin N threads at 100%% CPU\n"
+                            "  -h, --help           show this help\n";
+
+int main (int argc, char *argv[]) {
+        struct loadgen loadgen = {
+                .options = {
+                        .toplevels = 1,
+                        .width     = 640,
+                        .height    = 480,
+                        .fill      = true,
+                },
+                .running = true,
+        };
+
+        static const struct option long_options[] = {
+                {"toplevels", required_argument, NULL, 'n'},
+                {     "size", required_argument, NULL, 's'},
+                {     "rate", required_argument, NULL, 'r'},
+                {   "popups", required_argument, NULL, 'p'},
+                {    "moves", required_argument, NULL, 'm'},
+                { "duration", required_argument, NULL, 'd'},
+                {  "no-fill",       no_argument, NULL, 'N'},
+                {  "cpu-hog", required_argument, NULL, 'c'},
+                {     "help",       no_argument, NULL, 'h'},
+                {          0,                 0,    0,   0},
+        };
+        int opt;
+        while ((opt = getopt_long (argc, argv, "n:s:r:p:m:d:Nc:h", long_options, NULL)) != -1) {
+                switch (opt) {
+                case 'n':
+                        loadgen.options.toplevels = atoi (optarg);
+                        break;
+                case 's':
+                        if (sscanf (optarg, "%dx%d", &loadgen.options.width, &loadgen.options.height)
+                            != 2) {
+                                fprintf (stderr, usage, argv[0]);
+                                return 1;
+                        }
+                        break;
+                case 'r':
+                        loadgen.options.commit_rate = atof (optarg);
+                        break;
+                case 'p':
+                        loadgen.options.popup_rate = atof (optarg);
+                        break;
+                case 'm':
+                        loadgen.options.move_rate = atof (optarg);
+                        break;
+                case 'd':
+                        loadgen.options.duration = atoi (optarg);
+                        break;
+                case 'N':
+                        loadgen.options.fill = false;
+                        break;
+                case 'c':
+                        loadgen.options.cpu_hogs = atoi (optarg);
+                        break;
+                case 'h':
+                        printf (usage, argv[0]);
+                        return 0;
+                default:
+                        fprintf (stderr, usage, argv[0]);
+                        return 1;
+                }
+        }
+        if (loadgen.options.toplevels < 1 || loadgen.options.width < 1
+            || loadgen.options.height < 1 || loadgen.options.cpu_hogs < 0) {
+                fprintf (stderr, usage, argv[0]);
+                return 1;
+        }
+
+        loadgen.display = wl_display_connect (NULL);
+        if (loadgen.display == NULL) {
+                fprintf (stderr, "nwm-loadgen: cannot connect to the Wayland display\n");
+                return 1;
+        }
+        loadgen.registry = wl_display_get_registry (loadgen.display);
+        wl_registry_add_listener (loadgen.registry, &registry_listener, &loadgen);
+        wl_display_roundtrip (loadgen.display);
+        if (loadgen.compositor == NULL || loadgen.shm == NULL || loadgen.wm_base == NULL) {
+                fprintf (stderr, "nwm-loadgen: compositor lacks wl_compositor, wl_shm or xdg_wm_base\n");
+                return 1;
+        }
+
+        pthread_t *hogs = calloc (loadgen.options.cpu_hogs, sizeof (*hogs));
+        for (int i = 0; i < loadgen.options.cpu_hogs; i++) {
+                if (pthread_create (&hogs[i], NULL, cpu_hog, (void *) (uintptr_t) i) != 0) {
+                        fprintf (stderr, "nwm-loadgen: cannot start CPU hog %d\n", i);
+                        loadgen.options.cpu_hogs = i;
+                        break;
+                }
+        }
+
+        loadgen.windows = calloc (loadgen.options.toplevels, sizeof (*loadgen.windows));
+        for (int i = 0; i < loadgen.options.toplevels; i++) {
+                window_init (&loadgen, &loadgen.windows[i], i);
+        }
+
+        enum
+        {
+                FD_DISPLAY,
+                FD_COMMIT,
+                FD_POPUP,
+                FD_MOVE,
+                FD_REPORT,
+                FD_COUNT,
+        };
+        struct pollfd fds[FD_COUNT];
+        fds[FD_DISPLAY].fd = wl_display_get_fd (loadgen.display);
+        fds[FD_COMMIT].fd  = timer_create_rate (loadgen.options.commit_rate);
+        fds[FD_POPUP].fd   = timer_create_rate (loadgen.options.popup_rate);
+        fds[FD_MOVE].fd    = timer_create_rate (loadgen.options.move_rate);
+        fds[FD_REPORT].fd  = timer_create_rate (1);
+        for (int i = 0; i < FD_COUNT; i++) {
+                fds[i].events = POLLIN;
+        }
+
+        struct timespec start;
+        clock_gettime (CLOCK_MONOTONIC, &start);
+        while (loadgen.running) {
+                while (wl_display_prepare_read (loadgen.display) != 0) {
+                        wl_display_dispatch_pending (loadgen.display);
+                }
+                wl_display_flush (loadgen.display);
+                if (poll (fds, FD_COUNT, -1) < 0) {
+                        wl_display_cancel_read (loadgen.display);
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        perror ("nwm-loadgen: poll");
+                        break;
+                }
+                if (fds[FD_DISPLAY].revents & POLLIN) {
+                        if (wl_display_read_events (loadgen.display) < 0) {
+                                fprintf (stderr, "nwm-loadgen: lost connection to the compositor\n");
+                                break;
+                        }
+                } else {
+                        wl_display_cancel_read (loadgen.display);
+                }
+                if (fds[FD_DISPLAY].revents & (POLLERR | POLLHUP)) {
+                        fprintf (stderr, "nwm-loadgen: lost connection to the compositor\n");
+                        break;
+                }
+                wl_display_dispatch_pending (loadgen.display);
+
+                if (fds[FD_COMMIT].revents & POLLIN && timer_drain (fds[FD_COMMIT].fd) > 0) {
+                        for (int i = 0; i < loadgen.options.toplevels; i++) {
+                                window_commit (&loadgen.windows[i]);
+                        }
+                }
+                if (fds[FD_POPUP].revents & POLLIN && timer_drain (fds[FD_POPUP].fd) > 0) {
+                        popup_churn (&loadgen);
+                }
+                if (fds[FD_MOVE].revents & POLLIN) {
+                        for (uint64_t n = timer_drain (fds[FD_MOVE].fd); n > 0; n--) {
+                                move_spam (&loadgen);
+                        }
+                }
+                if (fds[FD_REPORT].revents & POLLIN && timer_drain (fds[FD_REPORT].fd) > 0) {
+                        struct timespec now;
+                        clock_gettime (CLOCK_MONOTONIC, &now);
+                        const double elapsed = timespec_diff_ms (&now, &start) / 1000.0;
+                        report (&loadgen, elapsed);
+                        if (loadgen.options.duration > 0 && elapsed >= loadgen.options.duration) {
+                                loadgen.running = false;
+                        }
+                }
+        }
+
+        interval_report (&loadgen.total_intervals, "total frame callback interval");
+
+        atomic_store (&hogs_running, false);
+        for (int i = 0; i < loadgen.options.cpu_hogs; i++) {
+                pthread_join (hogs[i], NULL);
+        }
+        free (hogs);
+
+        if (loadgen.popup != NULL) {
+                popup_destroy (loadgen.popup);
+        }
+        for (int i = 0; i < loadgen.options.toplevels; i++) {
+                window_finish (&loadgen.windows[i]);
+        }
+        for (int i = FD_COMMIT; i < FD_COUNT; i++) {
+                if (fds[i].fd >= 0) {
+                        close (fds[i].fd);
+                }
+        }
+        free (loadgen.windows);
+        wl_display_disconnect (loadgen.display);
+        return 0;
+}
@@ -0,0 +1,83 @@
+//
+// nwm-msg: sends one command to a running nwm over its control socket and
+// prints the reply. Exits non-zero if nwm reports an error.
+//
+//     nwm-msg log input debug
+//
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+int main (int argc, char *argv[]) {
+        if (argc < 2) {
+                fprintf (stderr, "Usage: %s COMMAND [ARGS...]\n       %s help\n", argv[0], argv[0]);
+                return 2;
+        }
+        const char *path = getenv ("NWM_SOCK");
+        if (path == NULL) {
+                fprintf (stderr, "NWM_SOCK is not set, is nwm running?\n");
+                return 2;
+        }
+
+        struct sockaddr_un addr = { .sun_family = AF_UNIX };
+        snprintf (addr.sun_path, sizeof (addr.sun_path), "%s", path);
+        const int fd = socket (AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect (fd, (struct sockaddr *) &addr, sizeof (addr)) < 0) {
+                perror ("connect");
+                return 2;
+        }
+
+        /* One line: the arguments joined by spaces. */
+        char   line[1024];
+        size_t len = 0;
+        for (int i = 1; i < argc; i++) {
+                const int n = snprintf (
+                    line + len, sizeof (line) - len, "%s%s", argv[i], i + 1 < argc ? " " : "\n");
+                if (n < 0 || (size_t) n >= sizeof (line) - len) {
+                        fprintf (stderr, "Command too long\n");
+                        return 2;
+                }
+                len += n;
+        }
+        if (write (fd, line, len) != (ssize_t) len) {
+                perror ("write");
+                return 2;
+        }
+        /* nwm closes its end once it sees ours closed, after replying. */
+        shutdown (fd, SHUT_WR);
+
+        /* The whole reply is kept: an error line can span two reads. */
+        char   *reply     = NULL;
+        size_t  reply_len = 0, reply_cap = 0;
+        char    chunk[8192];
+        ssize_t n;
+        while ((n = read (fd, chunk, sizeof (chunk))) > 0) {
+                fwrite (chunk, 1, n, stdout);
+                if (reply_len + n + 1 > reply_cap) {
+                        const size_t cap   = (reply_len + n + 1) * 2;
+                        char        *grown = realloc (reply, cap);
+                        if (grown == NULL) {
+                                perror ("realloc");
+                                free (reply);
+                                close (fd);
+                                return 2;
+                        }
+                        reply     = grown;
+                        reply_cap = cap;
+                }
+                memcpy (reply + reply_len, chunk, n);
+                reply_len += n;
+                reply[reply_len] = '\0';
+        }
+        close (fd);
+
+        const bool failed = reply != NULL
+                            && (strncmp (reply, "error: ", strlen ("error: ")) == 0
+                                || strstr (reply, "\nerror: ") != NULL);
+        free (reply);
+        return failed ? 1 : 0;
+}
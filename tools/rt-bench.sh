@@ -0,0 +1,80 @@
+#!/bin/sh
+#
+# rt-bench.sh: tail frame times with and without --low-latency under CPU
+# load. Runs a headless nwm twice, once per mode. Each run keeps every CPU
+# busy with nwm-loadgen --cpu-hog while a second nwm-loadgen commits on
+# every frame callback, then prints the frame callback intervals that second
+# client saw, p99 and max being the ones to compare.
+#
+#     tools/rt-bench.sh [BUILD_DIR]
+#
+# BUILD_DIR defaults to build. DURATION sets the seconds per run (default
+# 30), HOGS the spinning threads (default one per CPU). Real-time priority
+# needs CAP_SYS_NICE or an RLIMIT_RTPRIO allowance; the mode nwm got is
+# printed with each run.
+#
+set -eu
+
+build=${1:-build}
+duration=${DURATION:-30}
+hogs=${HOGS:-$(nproc)}
+
+for tool in nwm nwm-loadgen; do
+        if [ ! -x "$build/$tool" ]; then
+                echo "$build/$tool not found, build first or pass the build directory" >&2
+                exit 2
+        fi
+done
+: "${XDG_RUNTIME_DIR:?XDG_RUNTIME_DIR must be set, nwm puts its sockets there}"
+
+nwm_pid=
+hog_pid=
+cleanup () {
+        [ -n "$hog_pid" ] && kill "$hog_pid" 2>/dev/null
+        [ -n "$nwm_pid" ] && kill "$nwm_pid" 2>/dev/null
+        wait 2>/dev/null
+        nwm_pid=
+        hog_pid=
+}
+
+log=$(mktemp)
+out=$(mktemp)
+trap 'cleanup; rm -f "$log" "$out"' EXIT
+trap 'exit 1' INT TERM
+
+# Sets WAYLAND_DISPLAY once nwm has logged the display it runs on.
+find_display () {
+        WAYLAND_DISPLAY=$(sed -n 's/.*IPC listening on .*\/nwm-\(.*\)\.sock$/\1/p' "$log")
+        [ -n "$WAYLAND_DISPLAY" ]
+}
+
+run () {
+        mode=$1
+        shift
+        WLR_BACKENDS=headless WLR_RENDERER=pixman WLR_HEADLESS_OUTPUTS=1 WLR_LIBINPUT_NO_DEVICES=1 \
+                "$build/nwm" -v silent -v core=info -v perf=info "$@" >/dev/null 2>"$log" &
+        nwm_pid=$!
+        tries=100
+        while ! find_display; do
+                tries=$((tries - 1))
+                if [ "$tries" -eq 0 ]; then
+                        echo "nwm did not start" >&2
+                        exit 1
+                fi
+                sleep 0.1
+        done
+        export WAYLAND_DISPLAY
+
+        "$build/nwm-loadgen" -n 1 -s 16x16 -r 1 -c "$hogs" >/dev/null 2>&1 &
+        hog_pid=$!
+        "$build/nwm-loadgen" -d "$duration" >"$out"
+
+        granted=$(sed -n 's/.*Low-latency mode: //p' "$log")
+        echo "$mode (${granted:-not requested}):"
+        sed -n 's/^total frame callback interval: /  /p' "$out"
+        cleanup
+}
+
+echo "$hogs CPU hogs, ${duration}s per run"
+run "normal"
+run "low-latency" --low-latency